@@ -0,0 +1,1539 @@
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "WC_HashTable.h"
+#include "WC_HashTableTyped.h"
+#include "WC_ConcurrentHashTable.h"
+#include "WC_PerfectHashTable.h"
+#include "WC_ShardedHashTable.h"
+//Benchmark driver for the hash tables, run by make bench.
+//Every measurement is written as one record, to stdout or
+//--output, as CSV or JSON:
+//
+//  benchmark,variant,key_set,keys,ns_per_op,allocs_per_op,bytes_per_key,rss_bytes,gb_per_s
+//
+//bytes_per_key is the heap the benchmark's table took up per
+//key, for the records that build one, and 0 for the others.
+//gb_per_s is the input read per second by the records that
+//load a file, and 0 for the others.
+//--compare=FILE reads a CSV saved by an earlier run and reports
+//the records that got slower or allocate more than they did,
+//exiting with status 1 when any did. Run with --help for the
+//other options.
+
+//Number of operations each measurement is run for at least,
+//repeating rounds over smaller tables.
+#define OPERATIONS_TARGET ((size_t)2000000)
+//Number of keys looked up or added by each batch call.
+#define BATCH_KEYS 64
+//Largest number of records a run writes.
+#define MAXIMUM_RECORDS 4096
+//Largest number of sizes or thread counts passed on the command line.
+#define MAXIMUM_LIST_LENGTH 32
+//Most tables built up front for the merge benchmarks,
+//which change the tables they measure.
+#define MAXIMUM_MERGE_ROUNDS 16
+
+/* Allocation counting */
+
+//Heap allocations made, and bytes of heap in use, counted by
+//replacing malloc, calloc, realloc, the aligned allocators and free
+//with wrappers around glibc's own, so every pointer free is handed
+//was counted when it was allocated. Elsewhere allocations can't be counted and are
+//reported as -1.
+static _Atomic uint64_t allocation_count = 0;
+static _Atomic int64_t heap_bytes = 0;
+
+#if defined(__GLIBC__)
+    #include <malloc.h>
+    #define COUNTING_ALLOCATIONS 1
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* pointer, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* pointer);
+
+//Counts an allocation of pointer, when it was made.
+static void count_allocation(void* pointer) {
+    if (pointer != NULL) {
+        atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&heap_bytes, (int64_t)malloc_usable_size(pointer), memory_order_relaxed);
+    }
+}
+
+void* malloc(size_t size) {
+    void* pointer = __libc_malloc(size);
+
+    count_allocation(pointer);
+    return pointer;
+}
+
+void* calloc(size_t count, size_t size) {
+    void* pointer = __libc_calloc(count, size);
+
+    count_allocation(pointer);
+    return pointer;
+}
+
+void* realloc(void* pointer, size_t size) {
+    int64_t old_size = pointer != NULL ? (int64_t)malloc_usable_size(pointer) : 0;
+    void* new_pointer = __libc_realloc(pointer, size);
+
+    if (new_pointer != NULL) {
+        atomic_fetch_add_explicit(&allocation_count, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&heap_bytes, (int64_t)malloc_usable_size(new_pointer) - old_size,
+                                  memory_order_relaxed);
+    } else if (size == 0) {
+        atomic_fetch_sub_explicit(&heap_bytes, old_size, memory_order_relaxed);
+    }
+    return new_pointer;
+}
+
+void* memalign(size_t alignment, size_t size) {
+    void* pointer = __libc_memalign(alignment, size);
+
+    count_allocation(pointer);
+    return pointer;
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** pointer, size_t alignment, size_t size) {
+    if (alignment < sizeof(void*) || (alignment & (alignment - 1)) != 0) {
+        return EINVAL;
+    }
+    void* new_pointer = memalign(alignment, size);
+
+    if (new_pointer == NULL) {
+        return ENOMEM;
+    }
+    *pointer = new_pointer;
+    return 0;
+}
+
+void free(void* pointer) {
+    if (pointer != NULL) {
+        atomic_fetch_sub_explicit(&heap_bytes, (int64_t)malloc_usable_size(pointer), memory_order_relaxed);
+    }
+    __libc_free(pointer);
+}
+#endif
+
+//Returns the number of allocations made so far.
+static uint64_t allocations(void) {
+    return atomic_load_explicit(&allocation_count, memory_order_relaxed);
+}
+
+//Returns the number of heap bytes in use.
+static int64_t heap_in_use(void) {
+    return atomic_load_explicit(&heap_bytes, memory_order_relaxed);
+}
+
+/* Measurement */
+
+//Returns the current time in nanoseconds.
+static double nanoseconds_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec * 1e9 + (double)now.tv_nsec;
+}
+
+//Returns the resident set size of the process in bytes.
+static size_t resident_bytes(void) {
+    FILE* statm = fopen("/proc/self/statm", "r");
+
+    if (statm != NULL) {
+        unsigned long total_pages = 0;
+        unsigned long resident_pages = 0;
+        int fields = fscanf(statm, "%lu %lu", &total_pages, &resident_pages);
+        fclose(statm);
+
+        if (fields == 2) {
+            return (size_t)resident_pages * (size_t)sysconf(_SC_PAGESIZE);
+        }
+    }
+    //Fall back to the peak, which is all getrusage reports.
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return (size_t)usage.ru_maxrss * 1024;
+}
+
+//A running measurement of a number of operations.
+struct measurement {
+    double start_time;
+    uint64_t start_allocations;
+};
+
+static void measurement_start(struct measurement* measurement) {
+    measurement->start_allocations = allocations();
+    measurement->start_time = nanoseconds_now();
+}
+
+/* Records */
+
+//One measurement written to the output.
+struct record {
+    char benchmark[32];
+    char variant[48];
+    char key_set[16];
+    size_t keys;
+    double ns_per_op;
+    double allocs_per_op;
+    double bytes_per_key;
+    size_t rss_bytes;
+    double gb_per_s;
+};
+
+static struct record records[MAXIMUM_RECORDS];
+static size_t record_count = 0;
+
+//Finish a measurement of operations operations, recording it
+//under the passed names. Returns the record, so a benchmark
+//can fill in bytes_per_key.
+static struct record* measurement_finish(struct measurement* measurement, const char* benchmark,
+                                         const char* variant, const char* key_set, size_t keys,
+                                         size_t operations) {
+    double elapsed = nanoseconds_now() - measurement->start_time;
+    uint64_t allocated = allocations() - measurement->start_allocations;
+    static struct record overflow;
+    struct record* record = record_count < MAXIMUM_RECORDS ? &records[record_count++] : &overflow;
+    memset(record, 0, sizeof(struct record));
+    snprintf(record->benchmark, sizeof(record->benchmark), "%s", benchmark);
+    snprintf(record->variant, sizeof(record->variant), "%s", variant);
+    snprintf(record->key_set, sizeof(record->key_set), "%s", key_set);
+    record->keys = keys;
+    record->ns_per_op = operations > 0 ? elapsed / (double)operations : 0.0;
+#ifdef COUNTING_ALLOCATIONS
+    record->allocs_per_op = operations > 0 ? (double)allocated / (double)operations : 0.0;
+#else
+    (void)allocated;
+    record->allocs_per_op = -1.0;
+#endif
+    record->rss_bytes = resident_bytes();
+    fprintf(stderr, "%-14s %-28s %-7s %10zu keys %10.1f ns/op %8.3f allocs/op\n", record->benchmark,
+            record->variant, record->key_set, record->keys, record->ns_per_op, record->allocs_per_op);
+    return record;
+}
+
+//Write every record as CSV.
+static void write_csv(FILE* output) {
+    fprintf(output, "benchmark,variant,key_set,keys,ns_per_op,allocs_per_op,bytes_per_key,rss_bytes,gb_per_s\n");
+
+    for (size_t i = 0; i < record_count; i++) {
+        struct record* record = &records[i];
+        fprintf(output, "%s,%s,%s,%zu,%.2f,%.4f,%.2f,%zu,%.3f\n", record->benchmark, record->variant,
+                record->key_set, record->keys, record->ns_per_op, record->allocs_per_op,
+                record->bytes_per_key, record->rss_bytes, record->gb_per_s);
+    }
+}
+
+//Write every record as a JSON array of objects.
+static void write_json(FILE* output) {
+    fprintf(output, "[\n");
+
+    for (size_t i = 0; i < record_count; i++) {
+        struct record* record = &records[i];
+        fprintf(output, "  {\"benchmark\": \"%s\", \"variant\": \"%s\", \"key_set\": \"%s\", "
+                        "\"keys\": %zu, \"ns_per_op\": %.2f, \"allocs_per_op\": %.4f, "
+                        "\"bytes_per_key\": %.2f, \"rss_bytes\": %zu, \"gb_per_s\": %.3f}%s\n",
+                record->benchmark, record->variant, record->key_set, record->keys, record->ns_per_op,
+                record->allocs_per_op, record->bytes_per_key, record->rss_bytes, record->gb_per_s,
+                i + 1 < record_count ? "," : "");
+    }
+    fprintf(output, "]\n");
+}
+
+//Compare the records against the CSV baseline at path, printing
+//how each one changed. A record regressed when it got more than
+//threshold percent slower, or allocates more per operation.
+//Returns the number of regressed records, or -1 on failure.
+static int compare_with_baseline(const char* path, double threshold) {
+    FILE* baseline = fopen(path, "r");
+
+    if (baseline == NULL) {
+        fprintf(stderr, "Error. Unable to open baseline %s.\n", path);
+        return -1;
+    }
+    char line[512];
+    int regressions = 0;
+    size_t matched = 0;
+    printf("%-14s %-28s %-7s %10s %12s %12s %8s\n", "benchmark", "variant", "key_set", "keys",
+           "baseline_ns", "current_ns", "change");
+
+    while (fgets(line, sizeof(line), baseline) != NULL) {
+        struct record old;
+        memset(&old, 0, sizeof(old));
+        //Skips the header, whose keys field isn't a number.
+        if (sscanf(line, "%31[^,],%47[^,],%15[^,],%zu,%lf,%lf,%lf,%zu", old.benchmark, old.variant,
+                   old.key_set, &old.keys, &old.ns_per_op, &old.allocs_per_op, &old.bytes_per_key,
+                   &old.rss_bytes) != 8) {
+            continue;
+        }
+
+        for (size_t i = 0; i < record_count; i++) {
+            struct record* current = &records[i];
+
+            if (strcmp(current->benchmark, old.benchmark) != 0 || strcmp(current->variant, old.variant) != 0 ||
+                strcmp(current->key_set, old.key_set) != 0 || current->keys != old.keys) {
+                continue;
+            }
+            double change = old.ns_per_op > 0.0 ? (current->ns_per_op / old.ns_per_op - 1.0) * 100.0 : 0.0;
+            unsigned char regressed = change > threshold ||
+                                      (old.allocs_per_op >= 0.0 && current->allocs_per_op > old.allocs_per_op + 0.01);
+            printf("%-14s %-28s %-7s %10zu %12.1f %12.1f %+7.1f%%%s\n", old.benchmark, old.variant, old.key_set,
+                   old.keys, old.ns_per_op, current->ns_per_op, change, regressed ? "  REGRESSED" : "");
+            regressions += regressed;
+            matched++;
+            break;
+        }
+    }
+    fclose(baseline);
+    printf("%zu records compared, %d regressed by more than %.1f%%.\n", matched, regressions, threshold);
+    return regressions;
+}
+
+/* Keys */
+
+//A set of distinct keys, stored one after another in bytes.
+struct key_set {
+    //name written to the records.
+    const char* name;
+    unsigned char* bytes;
+    size_t* offsets;
+    size_t* lengths;
+    size_t count;
+};
+
+//Returns the next value of a splitmix64 generator.
+static uint64_t next_random(uint64_t* state) {
+    uint64_t value = (*state += 0x9e3779b97f4a7c15ULL);
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+//Returns a pointer to key i of the set.
+static inline void* key_at(const struct key_set* keys, size_t i) {
+    return keys->bytes + keys->offsets[i];
+}
+
+//Allocate a set of count keys of at most maximum_length bytes.
+static unsigned char key_set_allocate(struct key_set* keys, const char* name, size_t count,
+                                      size_t maximum_length) {
+    keys->name = name;
+    keys->count = count;
+    keys->bytes = malloc(count * maximum_length + 1);
+    keys->offsets = malloc(sizeof(size_t) * (count + 1));
+    keys->lengths = malloc(sizeof(size_t) * (count + 1));
+
+    if (keys->bytes == NULL || keys->offsets == NULL || keys->lengths == NULL) {
+        fprintf(stderr, "Error. System out of memory allocating %zu keys.\n", count);
+        return 0;
+    }
+    return 1;
+}
+
+static void key_set_free(struct key_set* keys) {
+    free(keys->bytes);
+    free(keys->offsets);
+    free(keys->lengths);
+}
+
+//Words read from --words, or made up when no list is passed.
+static char** word_list = NULL;
+static size_t word_count = 0;
+
+//Read the word list at path, one word per line.
+static unsigned char read_word_list(const char* path) {
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Error. Unable to open word list %s.\n", path);
+        return 0;
+    }
+    size_t capacity = 1024;
+    word_list = malloc(sizeof(char*) * capacity);
+    char line[256];
+
+    while (word_list != NULL && fgets(line, sizeof(line), file) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+
+        if (length == 0) {
+            continue;
+        }
+        line[length] = '\0';
+
+        if (word_count == capacity) {
+            capacity *= 2;
+            char** grown = realloc(word_list, sizeof(char*) * capacity);
+
+            if (grown == NULL) {
+                break;
+            }
+            word_list = grown;
+        }
+        word_list[word_count] = malloc(length + 1);
+
+        if (word_list[word_count] != NULL) {
+            memcpy(word_list[word_count++], line, length + 1);
+        }
+    }
+    fclose(file);
+    return word_list != NULL && word_count > 0;
+}
+
+//Fill keys with count words, hit keys when miss is 0 and keys
+//that are none of them otherwise. Once the word list runs out,
+//words are repeated with a number after them. Without a word
+//list, words of 3 to 12 lower case letters are made up.
+static unsigned char make_word_keys(struct key_set* keys, size_t count, unsigned char miss) {
+    if (!key_set_allocate(keys, "words", count, 256 + 24)) {
+        return 0;
+    }
+    uint64_t state = 42;
+    size_t offset = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        char* key = (char*)keys->bytes + offset;
+        int length;
+
+        if (word_count > 0) {
+            const char* word = word_list[i % word_count];
+
+            if (i < word_count) {
+                length = snprintf(key, 256, "%s", word);
+            } else {
+                length = snprintf(key, 256 + 24, "%s%zu", word, i / word_count);
+            }
+        } else {
+            //Made up words end in their index, so they are distinct.
+            size_t letters = 3 + next_random(&state) % 10;
+
+            for (size_t j = 0; j < letters; j++) {
+                key[j] = (char)('a' + next_random(&state) % 26);
+            }
+            length = (int)letters + snprintf(key + letters, 24, "%zx", i);
+        }
+        //No word ends in '~', so adding one makes a miss.
+        if (miss) {
+            key[length++] = '~';
+        }
+        keys->offsets[i] = offset;
+        keys->lengths[i] = (size_t)length;
+        offset += (size_t)length;
+    }
+    return 1;
+}
+
+//Fill keys with count keys of random bytes, 8 to 32 bytes long.
+//Each key starts with a different mix of its index, first
+//from first_index, so sets of different indexes are disjoint.
+static unsigned char make_random_keys(struct key_set* keys, size_t count, size_t first_index) {
+    if (!key_set_allocate(keys, "random", count, 32)) {
+        return 0;
+    }
+    uint64_t state = first_index + 7;
+    size_t offset = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t index_state = first_index + i;
+        uint64_t prefix = next_random(&index_state);
+        size_t length = 8 + next_random(&state) % 25;
+        memcpy(keys->bytes + offset, &prefix, sizeof(prefix));
+
+        for (size_t j = 8; j < length; j++) {
+            keys->bytes[offset + j] = (unsigned char)next_random(&state);
+        }
+        keys->offsets[i] = offset;
+        keys->lengths[i] = length;
+        offset += length;
+    }
+    return 1;
+}
+
+//Fill keys with count keys of exactly length bytes.
+static unsigned char make_fixed_length_keys(struct key_set* keys, size_t count, size_t length) {
+    if (!key_set_allocate(keys, "random", count, length)) {
+        return 0;
+    }
+    uint64_t state = length;
+
+    for (size_t i = 0; i < count; i++) {
+        unsigned char* key = keys->bytes + i * length;
+
+        for (size_t j = 0; j < length; j++) {
+            key[j] = (unsigned char)next_random(&state);
+        }
+        //Keep the keys distinct by storing the index in the
+        //last bytes, as many as the key has room for.
+        for (size_t j = 0; j < length && j < sizeof(size_t); j++) {
+            key[length - 1 - j] = (unsigned char)(i >> (8 * j));
+        }
+        keys->offsets[i] = i * length;
+        keys->lengths[i] = length;
+    }
+    return 1;
+}
+
+//Returns a random order of the numbers below count.
+static size_t* shuffled_order(size_t count, uint64_t seed) {
+    size_t* order = malloc(sizeof(size_t) * (count + 1));
+
+    if (order == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        order[i] = i;
+    }
+
+    for (size_t i = count; i > 1; i--) {
+        size_t j = next_random(&seed) % i;
+        size_t swap = order[i - 1];
+        order[i - 1] = order[j];
+        order[j] = swap;
+    }
+    return order;
+}
+
+//Returns the number of rounds over count items needed to run
+//at least OPERATIONS_TARGET operations.
+static size_t rounds_for(size_t count) {
+    return count >= OPERATIONS_TARGET ? 1 : (OPERATIONS_TARGET + count - 1) / count;
+}
+
+/* Options */
+
+static size_t sizes[MAXIMUM_LIST_LENGTH] = {1000, 10000, 100000, 1000000};
+static size_t size_count = 4;
+static size_t thread_counts[MAXIMUM_LIST_LENGTH] = {1, 2, 4, 8};
+static size_t thread_count_count = 4;
+//comma separated benchmark groups to run. NULL runs them all.
+static const char* only_groups = NULL;
+static const char* snapshot_path = "WCHT_bench_snapshot.bin";
+
+//Returns 1 when the group named should run.
+static unsigned char group_selected(const char* group) {
+    if (only_groups == NULL) {
+        return 1;
+    }
+    size_t length = strlen(group);
+    const char* next = only_groups;
+
+    while (next != NULL && *next != '\0') {
+        if (strncmp(next, group, length) == 0 && (next[length] == ',' || next[length] == '\0')) {
+            return 1;
+        }
+        next = strchr(next, ',');
+        next = next != NULL ? next + 1 : NULL;
+    }
+    return 0;
+}
+
+//Parse a comma separated list of numbers into list.
+//Returns the number of them, 0 on failure.
+static size_t parse_list(const char* text, size_t list[]) {
+    size_t count = 0;
+
+    while (*text != '\0' && count < MAXIMUM_LIST_LENGTH) {
+        char* end;
+        unsigned long long value = strtoull(text, &end, 10);
+
+        if (end == text || value == 0) {
+            return 0;
+        }
+        list[count++] = (size_t)value;
+        text = *end == ',' ? end + 1 : end;
+    }
+    return count;
+}
+
+/* Benchmarks */
+
+//Variants of the generic table run by the core benchmarks.
+struct table_variant {
+    const char* name;
+    enum hash_table_probing probing;
+    unsigned char use_arena;
+    unsigned char incremental_resize;
+};
+
+static const struct table_variant table_variants[] = {
+    {"groups", HASH_TABLE_PROBING_GROUPS, 0, 0},
+    {"robin_hood", HASH_TABLE_PROBING_ROBIN_HOOD, 0, 0},
+    {"groups_arena", HASH_TABLE_PROBING_GROUPS, 1, 0},
+    {"groups_incremental", HASH_TABLE_PROBING_GROUPS, 0, 1}
+};
+
+//Create a table of the passed variant.
+static struct hash_table* new_variant_table(const struct table_variant* variant) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.probing = variant->probing;
+    options.use_arena = variant->use_arena;
+    options.incremental_resize = variant->incremental_resize;
+    struct hash_table* table = hash_table_new_with_options(&options);
+
+    if (table == NULL) {
+        exit(1);
+    }
+    return table;
+}
+
+//Insert, hit and miss lookups, remove churn, a mixed workload
+//and iteration, for every table variant over hits and misses.
+static void bench_core(const struct key_set* hits, const struct key_set* misses) {
+    size_t count = hits->count;
+    size_t* order = shuffled_order(count, count);
+
+    for (size_t v = 0; v < sizeof(table_variants) / sizeof(table_variants[0]); v++) {
+        const struct table_variant* variant = &table_variants[v];
+        struct measurement measurement;
+        //Insert every key into a new table, round after round.
+        size_t rounds = rounds_for(count);
+        struct hash_table* table = NULL;
+        int64_t heap_before = heap_in_use();
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            if (table != NULL) {
+                hash_table_free(table);
+                heap_before = heap_in_use();
+            }
+            table = new_variant_table(variant);
+
+            for (size_t i = 0; i < count; i++) {
+                hash_table_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+            }
+        }
+        struct record* record = measurement_finish(&measurement, "insert", variant->name, hits->name,
+                                                   count, rounds * count);
+        record->bytes_per_key = (double)(heap_in_use() - heap_before) / (double)count;
+        //Look up stored keys in a random order.
+        size_t found = 0;
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < count; i++) {
+                size_t index = order[i];
+                found += hash_table_get(table, key_at(hits, index), hits->lengths[index]).value != NULL;
+            }
+        }
+        measurement_finish(&measurement, "get_hit", variant->name, hits->name, count, rounds * count);
+        //Look up keys that aren't stored.
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < misses->count; i++) {
+                found += hash_table_get(table, key_at(misses, i), misses->lengths[i]).value != NULL;
+            }
+        }
+        measurement_finish(&measurement, "get_miss", variant->name, hits->name, count,
+                           rounds * misses->count);
+        //Remove a key and add it back, leaving tombstones behind.
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < count; i++) {
+                size_t index = order[i];
+                hash_table_remove(table, key_at(hits, index), hits->lengths[index]);
+                hash_table_add(table, key_at(hits, index), hits->lengths[index], &index, sizeof(index));
+            }
+        }
+        measurement_finish(&measurement, "remove_churn", variant->name, hits->name, count,
+                           rounds * count * 2);
+        //70% hits, 15% misses, 10% value replacements
+        //and 5% removes of a key that is added back.
+        uint64_t state = 99;
+        measurement_start(&measurement);
+
+        for (size_t i = 0; i < rounds * count; i++) {
+            uint64_t random = next_random(&state);
+            size_t index = (size_t)(random >> 8) % count;
+            unsigned int operation = (unsigned int)(random % 100);
+
+            if (operation < 70) {
+                found += hash_table_get(table, key_at(hits, index), hits->lengths[index]).value != NULL;
+            } else if (operation < 85) {
+                found += hash_table_get(table, key_at(misses, index), misses->lengths[index]).value != NULL;
+            } else if (operation < 95) {
+                hash_table_upsert(table, key_at(hits, index), hits->lengths[index], &i, sizeof(i), NULL);
+            } else {
+                hash_table_remove(table, key_at(hits, index), hits->lengths[index]);
+                hash_table_add(table, key_at(hits, index), hits->lengths[index], &i, sizeof(i));
+            }
+        }
+        measurement_finish(&measurement, "mixed", variant->name, hits->name, count, rounds * count);
+        //Walk every pair.
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            struct hash_table_key_value_iterator* iterator = hash_table_get_iterator(table);
+            struct hash_table_key_value pair;
+
+            while (hash_table_iterator_next(iterator, &pair)) {
+                found += pair.value_length;
+            }
+            hash_table_iterator_free(iterator);
+        }
+        measurement_finish(&measurement, "iterate", variant->name, hits->name, count, rounds * count);
+        hash_table_free(table);
+
+        if (found == 0) {
+            fprintf(stderr, "Error. No key was found.\n");
+        }
+    }
+    free(order);
+}
+
+//Hit and miss lookups of group and Robin Hood tables filled to
+//50%, 75% and 90% of their slots.
+static void bench_load(const struct key_set* hits, const struct key_set* misses) {
+    static const double loads[] = {0.50, 0.75, 0.90};
+    //The most slots that can be filled to 90% from the keys.
+    size_t length = 32;
+
+    while (length * 2 * 0.90 <= (double)hits->count) {
+        length *= 2;
+    }
+
+    for (size_t robin_hood = 0; robin_hood < 2; robin_hood++) {
+        for (size_t l = 0; l < sizeof(loads) / sizeof(loads[0]); l++) {
+            size_t count = (size_t)((double)length * loads[l]);
+            struct hash_table_options options;
+            hash_table_options_init(&options);
+            options.probing = robin_hood ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+            //Keep the table at length slots while it fills.
+            options.max_load_factor = 0.95;
+            options.initial_capacity = (size_t)((double)length * 0.95);
+            struct hash_table* table = hash_table_new_with_options(&options);
+
+            for (size_t i = 0; i < count; i++) {
+                hash_table_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+            }
+            char variant[48];
+            snprintf(variant, sizeof(variant), "%s/load=%.2f", robin_hood ? "robin_hood" : "groups", loads[l]);
+            size_t* order = shuffled_order(count, count);
+            size_t rounds = rounds_for(count);
+            size_t found = 0;
+            struct measurement measurement;
+            measurement_start(&measurement);
+
+            for (size_t round = 0; round < rounds; round++) {
+                for (size_t i = 0; i < count; i++) {
+                    found += hash_table_get(table, key_at(hits, order[i]), hits->lengths[order[i]]).value != NULL;
+                }
+            }
+            measurement_finish(&measurement, "load_get_hit", variant, hits->name, count, rounds * count);
+            measurement_start(&measurement);
+
+            for (size_t round = 0; round < rounds; round++) {
+                for (size_t i = 0; i < count; i++) {
+                    found += hash_table_get(table, key_at(misses, i), misses->lengths[i]).value != NULL;
+                }
+            }
+            measurement_finish(&measurement, "load_get_miss", variant, hits->name, count, rounds * count);
+            free(order);
+            hash_table_free(table);
+        }
+    }
+}
+
+//Lookup mixes of mostly missing keys, with and without a
+//Bloom filter in front of the table, before and after remove
+//churn has left the table full of deleted slots.
+static void bench_miss_heavy(const struct key_set* hits, const struct key_set* misses) {
+    static const unsigned int miss_percents[] = {50, 90, 100};
+    size_t count = hits->count;
+    size_t rounds = rounds_for(count);
+
+    for (size_t variant = 0; variant < 4; variant++) {
+        unsigned char robin_hood = variant >= 2;
+        unsigned char bloom = variant % 2;
+        struct hash_table_options options;
+        hash_table_options_init(&options);
+        options.probing = robin_hood ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        options.bloom_filter_bits = bloom ? 10 : 0;
+        struct hash_table* table = hash_table_new_with_options(&options);
+
+        for (size_t i = 0; i < count; i++) {
+            hash_table_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+        }
+
+        for (size_t churned = 0; churned < 2; churned++) {
+            if (churned) {
+                //Remove and add back every key.
+                for (size_t i = 0; i < count; i++) {
+                    hash_table_remove(table, key_at(hits, i), hits->lengths[i]);
+                    hash_table_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+                }
+            }
+
+            for (size_t m = 0; m < sizeof(miss_percents) / sizeof(miss_percents[0]); m++) {
+                char name[48];
+                snprintf(name, sizeof(name), "%s%s/miss=%u%%%s", robin_hood ? "robin_hood" : "groups",
+                         bloom ? "_bloom" : "", miss_percents[m], churned ? "/churned" : "");
+                uint64_t state = 17;
+                size_t found = 0;
+                struct measurement measurement;
+                measurement_start(&measurement);
+
+                for (size_t i = 0; i < rounds * count; i++) {
+                    uint64_t random = next_random(&state);
+                    size_t index = (size_t)(random >> 8) % count;
+
+                    if (random % 100 < miss_percents[m]) {
+                        found += hash_table_get(table, key_at(misses, index), misses->lengths[index]).value != NULL;
+                    } else {
+                        found += hash_table_get(table, key_at(hits, index), hits->lengths[index]).value != NULL;
+                    }
+                }
+                measurement_finish(&measurement, "miss_heavy", name, hits->name, count, rounds * count);
+            }
+
+            if (bloom) {
+                fprintf(stderr, "%s: Bloom filter false positive rate %.4f\n",
+                        churned ? "after churn" : "after build", hash_table_bloom_false_positive_rate(table));
+            }
+        }
+        hash_table_free(table);
+    }
+}
+
+//Single lookups and adds against their batched versions.
+static void bench_batch(const struct key_set* hits) {
+    size_t count = hits->count;
+    size_t* order = shuffled_order(count, count + 1);
+    void** keys = malloc(sizeof(void*) * count);
+    size_t* key_lengths = malloc(sizeof(size_t) * count);
+    void** values = malloc(sizeof(void*) * count);
+    size_t* value_lengths = malloc(sizeof(size_t) * count);
+    struct hash_table_key_value* results = malloc(sizeof(struct hash_table_key_value) * BATCH_KEYS);
+
+    if (keys == NULL || key_lengths == NULL || values == NULL || value_lengths == NULL || results == NULL) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = key_at(hits, order[i]);
+        key_lengths[i] = hits->lengths[order[i]];
+        values[i] = &order[i];
+        value_lengths[i] = sizeof(size_t);
+    }
+    size_t rounds = rounds_for(count);
+    struct measurement measurement;
+    struct hash_table* table = NULL;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        if (table != NULL) {
+            hash_table_free(table);
+        }
+        table = hash_table_new();
+
+        for (size_t i = 0; i < count; i++) {
+            hash_table_add(table, keys[i], key_lengths[i], values[i], value_lengths[i]);
+        }
+    }
+    measurement_finish(&measurement, "batch_add", "single", hits->name, count, rounds * count);
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        if (table != NULL) {
+            hash_table_free(table);
+        }
+        table = hash_table_new();
+        hash_table_add_batch(table, keys, key_lengths, values, value_lengths, count);
+    }
+    measurement_finish(&measurement, "batch_add", "batch", hits->name, count, rounds * count);
+    size_t found = 0;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            found += hash_table_get(table, keys[i], key_lengths[i]).value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "batch_get", "single", hits->name, count, rounds * count);
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i += BATCH_KEYS) {
+            size_t batch = count - i < BATCH_KEYS ? count - i : BATCH_KEYS;
+            hash_table_get_batch(table, keys + i, key_lengths + i, batch, results);
+            found += results[0].value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "batch_get", "batch", hits->name, count, rounds * count);
+    hash_table_free(table);
+    free(order);
+    free(keys);
+    free(key_lengths);
+    free(values);
+    free(value_lengths);
+    free(results);
+}
+
+WC_HASHTABLE_DEFINE_U64(bench_u64_table, uint64_t)
+
+//The typed table for 64 bit keys against the generic table
+//storing the same keys as 8 byte strings.
+static void bench_typed(size_t count) {
+    uint64_t* keys = malloc(sizeof(uint64_t) * count);
+    size_t* order = shuffled_order(count, count + 2);
+
+    if (keys == NULL) {
+        exit(1);
+    }
+    uint64_t state = 5;
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = next_random(&state);
+    }
+    size_t rounds = rounds_for(count);
+    struct measurement measurement;
+    struct bench_u64_table* typed = NULL;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        if (typed != NULL) {
+            bench_u64_table_free(typed);
+        }
+        typed = bench_u64_table_new(0);
+
+        for (size_t i = 0; i < count; i++) {
+            bench_u64_table_put(typed, keys[i], i);
+        }
+    }
+    measurement_finish(&measurement, "u64_insert", "typed", "u64", count, rounds * count);
+    struct hash_table* generic = NULL;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        if (generic != NULL) {
+            hash_table_free(generic);
+        }
+        generic = hash_table_new();
+
+        for (size_t i = 0; i < count; i++) {
+            hash_table_add(generic, &keys[i], sizeof(uint64_t), &i, sizeof(i));
+        }
+    }
+    measurement_finish(&measurement, "u64_insert", "generic", "u64", count, rounds * count);
+    uint64_t sum = 0;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            sum += *bench_u64_table_get(typed, keys[order[i]]);
+        }
+    }
+    measurement_finish(&measurement, "u64_get", "typed", "u64", count, rounds * count);
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            sum += hash_table_get(generic, &keys[order[i]], sizeof(uint64_t)).value_length;
+        }
+    }
+    measurement_finish(&measurement, "u64_get", "generic", "u64", count, rounds * count);
+
+    if (sum == 0) {
+        fprintf(stderr, "Error. No key was found.\n");
+    }
+    bench_u64_table_free(typed);
+    hash_table_free(generic);
+    free(keys);
+    free(order);
+}
+
+//Hit lookups of keys from 1 to 256 bytes long, which
+//mostly time comparing the key against the stored one.
+static void bench_key_length(size_t count) {
+    static const size_t lengths[] = {1, 2, 4, 8, 12, 16, 24, 32, 64, 128, 256};
+
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        size_t length = lengths[l];
+        size_t key_count = count;
+        //Short keys only have so many distinct values.
+        if (length == 1 && key_count > 256) {
+            key_count = 256;
+        } else if (length == 2 && key_count > 65536) {
+            key_count = 65536;
+        }
+        struct key_set keys;
+
+        if (!make_fixed_length_keys(&keys, key_count, length)) {
+            exit(1);
+        }
+        struct hash_table* table = hash_table_new();
+
+        for (size_t i = 0; i < key_count; i++) {
+            hash_table_add(table, key_at(&keys, i), length, &i, sizeof(i));
+        }
+        size_t* order = shuffled_order(key_count, length);
+        size_t rounds = rounds_for(key_count);
+        size_t found = 0;
+        char variant[48];
+        snprintf(variant, sizeof(variant), "length=%zu", length);
+        struct measurement measurement;
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            for (size_t i = 0; i < key_count; i++) {
+                found += hash_table_get(table, key_at(&keys, order[i]), length).value != NULL;
+            }
+        }
+        measurement_finish(&measurement, "key_length", variant, keys.name, key_count, rounds * key_count);
+        free(order);
+        hash_table_free(table);
+        key_set_free(&keys);
+    }
+}
+
+//Building a perfect hash table from a filled one, and its
+//lookups against the table it was built from.
+static void bench_perfect(const struct key_set* hits, const struct key_set* misses) {
+    size_t count = hits->count;
+    struct hash_table* table = hash_table_new();
+    struct measurement measurement;
+    int64_t heap_before = heap_in_use();
+    measurement_start(&measurement);
+
+    for (size_t i = 0; i < count; i++) {
+        hash_table_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+    }
+    struct record* record = measurement_finish(&measurement, "static_build", "mutable", hits->name,
+                                               count, count);
+    record->bytes_per_key = (double)(heap_in_use() - heap_before) / (double)count;
+    heap_before = heap_in_use();
+    measurement_start(&measurement);
+    struct hash_table_perfect* perfect = hash_table_perfect_build(table);
+    record = measurement_finish(&measurement, "static_build", "perfect", hits->name, count, count);
+    record->bytes_per_key = (double)(heap_in_use() - heap_before) / (double)count;
+    fprintf(stderr, "perfect hash function: %.2f bits per key\n", hash_table_perfect_bits_per_key(perfect));
+    size_t* order = shuffled_order(count, count + 3);
+    size_t rounds = rounds_for(count);
+    size_t found = 0;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            found += hash_table_get(table, key_at(hits, order[i]), hits->lengths[order[i]]).value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "static_get_hit", "mutable", hits->name, count, rounds * count);
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            found += hash_table_perfect_get(perfect, key_at(hits, order[i]),
+                                            hits->lengths[order[i]]).value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "static_get_hit", "perfect", hits->name, count, rounds * count);
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            found += hash_table_get(table, key_at(misses, i), misses->lengths[i]).value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "static_get_miss", "mutable", hits->name, count, rounds * count);
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            found += hash_table_perfect_get(perfect, key_at(misses, i), misses->lengths[i]).value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "static_get_miss", "perfect", hits->name, count, rounds * count);
+    free(order);
+    hash_table_perfect_free(perfect);
+    hash_table_free(table);
+}
+
+//Saving a snapshot, opening it and looking keys up in it,
+//against building the table with adds.
+static void bench_snapshot(const struct key_set* hits) {
+    size_t count = hits->count;
+    struct hash_table* table = hash_table_new();
+    struct measurement measurement;
+    measurement_start(&measurement);
+
+    for (size_t i = 0; i < count; i++) {
+        hash_table_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+    }
+    measurement_finish(&measurement, "snapshot", "build_with_adds", hits->name, count, count);
+    measurement_start(&measurement);
+
+    if (!hash_table_save(table, snapshot_path)) {
+        exit(1);
+    }
+    measurement_finish(&measurement, "snapshot", "save", hits->name, count, count);
+    hash_table_free(table);
+    //Opening is timed per open, since it doesn't
+    //depend on the number of keys.
+    measurement_start(&measurement);
+    table = hash_table_open_mmap(snapshot_path);
+    measurement_finish(&measurement, "snapshot", "open", hits->name, count, 1);
+
+    if (table == NULL) {
+        exit(1);
+    }
+    size_t* order = shuffled_order(count, count + 4);
+    size_t rounds = rounds_for(count);
+    size_t found = 0;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < count; i++) {
+            found += hash_table_get(table, key_at(hits, order[i]), hits->lengths[order[i]]).value != NULL;
+        }
+    }
+    measurement_finish(&measurement, "snapshot", "get_hit", hits->name, count, rounds * count);
+    free(order);
+    hash_table_free(table);
+    remove(snapshot_path);
+}
+
+//Loading a tab separated file of the keys and their indexes
+//with hash_table_load_stream, copying and borrowing, against
+//reading it line by line with fgets and adding each pair.
+static void bench_load_stream(const struct key_set* hits) {
+    size_t count = hits->count;
+    FILE* stream = tmpfile();
+
+    if (stream == NULL) {
+        fprintf(stderr, "Error. Unable to create a temporary file.\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        fwrite(key_at(hits, i), 1, hits->lengths[i], stream);
+        fprintf(stream, "\t%zu\n", i);
+    }
+    size_t file_bytes = (size_t)ftell(stream);
+    size_t rounds = rounds_for(count);
+    //Lines are at most a 280 byte key and an index.
+    char line[320];
+
+    for (unsigned int variant = 0; variant < 3; variant++) {
+        static const char* const names[] = {"fgets_add", "load_stream", "load_stream_borrow"};
+        struct hash_table_options options;
+        hash_table_options_init(&options);
+        options.borrow_keys_values = variant == 2;
+        struct hash_table* table = NULL;
+        struct measurement measurement;
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            if (table != NULL) {
+                hash_table_free(table);
+            }
+            table = hash_table_new_with_options(&options);
+            rewind(stream);
+
+            if (variant == 0) {
+                while (fgets(line, sizeof(line), stream) != NULL) {
+                    char* value = strchr(line, '\t');
+
+                    if (value != NULL) {
+                        *value++ = '\0';
+                        hash_table_add(table, line, (size_t)(value - 1 - line), value, strcspn(value, "\n"));
+                    }
+                }
+            } else {
+                hash_table_load_stream(table, stream, '\t', variant == 2 ? HASH_TABLE_LOAD_BORROW : 0);
+            }
+        }
+        struct record* record = measurement_finish(&measurement, "load_stream", names[variant], hits->name,
+                                                   count, rounds * count);
+        record->gb_per_s = (double)file_bytes / (record->ns_per_op * (double)count);
+
+        if (hash_table_size(table) != count) {
+            fprintf(stderr, "Error. %s loaded %zu of %zu keys.\n", names[variant], hash_table_size(table), count);
+        }
+        hash_table_free(table);
+    }
+    fclose(stream);
+}
+
+//Work of one thread of the concurrent benchmark.
+struct concurrent_work {
+    struct hash_table_concurrent* table;
+    const struct key_set* keys;
+    size_t operations;
+    uint64_t seed;
+};
+
+//Run a 90% get, 10% add mix against the concurrent table.
+static void* run_concurrent_work(void* arg) {
+    struct concurrent_work* work = arg;
+    struct hash_table_concurrent_reader* reader = hash_table_concurrent_reader_register(work->table);
+    const struct key_set* keys = work->keys;
+    uint64_t state = work->seed;
+    size_t found = 0;
+
+    for (size_t i = 0; i < work->operations; i++) {
+        uint64_t random = next_random(&state);
+        size_t index = (size_t)(random >> 8) % keys->count;
+
+        if (random % 10 != 0) {
+            hash_table_concurrent_read_begin(reader);
+            found += hash_table_concurrent_get(reader, key_at(keys, index), keys->lengths[index]).value != NULL;
+            hash_table_concurrent_read_end(reader);
+        } else {
+            hash_table_concurrent_add(work->table, key_at(keys, index), keys->lengths[index], &i, sizeof(i));
+        }
+    }
+    hash_table_concurrent_reader_unregister(reader);
+    work->seed = found;
+    return NULL;
+}
+
+//Throughput of the concurrent table as threads are added.
+//ns_per_op is the wall time over every thread's operations.
+static void bench_concurrent(const struct key_set* hits) {
+    for (size_t t = 0; t < thread_count_count; t++) {
+        size_t threads = thread_counts[t];
+        struct hash_table_concurrent* table = hash_table_concurrent_new(0);
+
+        for (size_t i = 0; i < hits->count; i++) {
+            hash_table_concurrent_add(table, key_at(hits, i), hits->lengths[i], &i, sizeof(i));
+        }
+        pthread_t* thread_ids = malloc(sizeof(pthread_t) * threads);
+        struct concurrent_work* work = malloc(sizeof(struct concurrent_work) * threads);
+
+        if (thread_ids == NULL || work == NULL) {
+            exit(1);
+        }
+        size_t operations = OPERATIONS_TARGET;
+        struct measurement measurement;
+        measurement_start(&measurement);
+
+        for (size_t i = 0; i < threads; i++) {
+            work[i].table = table;
+            work[i].keys = hits;
+            work[i].operations = operations / threads;
+            work[i].seed = i + 1;
+            pthread_create(&thread_ids[i], NULL, run_concurrent_work, &work[i]);
+        }
+
+        for (size_t i = 0; i < threads; i++) {
+            pthread_join(thread_ids[i], NULL);
+        }
+        char variant[48];
+        snprintf(variant, sizeof(variant), "threads=%zu", threads);
+        measurement_finish(&measurement, "concurrent_mix", variant, hits->name, hits->count,
+                           operations / threads * threads);
+        free(thread_ids);
+        free(work);
+        hash_table_concurrent_free(table);
+    }
+}
+
+//Combine function of bench_sharded, adding
+//the source counter to the destination one.
+static unsigned char add_counters(void* destination_value, size_t destination_value_length,
+                                  const void* source_value, size_t source_value_length) {
+    (void)destination_value_length;
+    (void)source_value_length;
+    *(size_t*)destination_value += *(const size_t*)source_value;
+    return 1;
+}
+
+//Building a sharded table on more and more threads against
+//adding the same keys to one table, then merging two tables
+//sharing half their keys, shard by shard on more and more
+//threads against hash_table_merge. Build times include
+//creating and freeing the tables.
+static void bench_sharded(const struct key_set* hits) {
+    size_t count = hits->count;
+    void** keys = malloc(sizeof(void*) * count);
+    size_t* values = malloc(sizeof(size_t) * count);
+    void** value_pointers = malloc(sizeof(void*) * count);
+    size_t* value_lengths = malloc(sizeof(size_t) * count);
+
+    if (keys == NULL || values == NULL || value_pointers == NULL || value_lengths == NULL) {
+        exit(1);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = key_at(hits, i);
+        values[i] = i;
+        value_pointers[i] = &values[i];
+        value_lengths[i] = sizeof(size_t);
+    }
+    size_t rounds = rounds_for(count);
+    struct measurement measurement;
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < rounds; round++) {
+        struct hash_table* table = hash_table_new();
+        hash_table_reserve(table, count);
+
+        for (size_t i = 0; i < count; i++) {
+            hash_table_add(table, keys[i], hits->lengths[i], &values[i], sizeof(size_t));
+        }
+        hash_table_free(table);
+    }
+    measurement_finish(&measurement, "sharded_build", "serial_add", hits->name, count, rounds * count);
+
+    for (size_t t = 0; t < thread_count_count; t++) {
+        size_t threads = thread_counts[t];
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < rounds; round++) {
+            struct hash_table_sharded* table = hash_table_sharded_new(0, NULL);
+            hash_table_sharded_build(table, keys, hits->lengths, value_pointers, value_lengths, count, threads);
+            hash_table_sharded_free(table);
+        }
+        char variant[48];
+        snprintf(variant, sizeof(variant), "threads=%zu", threads);
+        measurement_finish(&measurement, "sharded_build", variant, hits->name, count, rounds * count);
+    }
+    //The source holds the second half of the keys and as many new
+    //ones, so half its keys are combined and half are copied.
+    size_t half = count / 2;
+    size_t merge_rounds = rounds < MAXIMUM_MERGE_ROUNDS ? rounds : MAXIMUM_MERGE_ROUNDS;
+    struct hash_table* source = hash_table_new();
+    struct hash_table* destinations[MAXIMUM_MERGE_ROUNDS];
+
+    for (size_t i = half; i < count; i++) {
+        hash_table_add(source, keys[i], hits->lengths[i], &values[i], sizeof(size_t));
+        hash_table_add(source, &values[i], sizeof(size_t), &values[i], sizeof(size_t));
+    }
+
+    for (size_t round = 0; round < merge_rounds; round++) {
+        destinations[round] = hash_table_new();
+
+        for (size_t i = 0; i < count; i++) {
+            hash_table_add(destinations[round], keys[i], hits->lengths[i], &values[i], sizeof(size_t));
+        }
+    }
+    measurement_start(&measurement);
+
+    for (size_t round = 0; round < merge_rounds; round++) {
+        hash_table_merge(destinations[round], source, add_counters);
+    }
+    measurement_finish(&measurement, "sharded_merge", "hash_table_merge", hits->name, count,
+                       merge_rounds * hash_table_size(source));
+
+    for (size_t round = 0; round < merge_rounds; round++) {
+        hash_table_free(destinations[round]);
+    }
+    hash_table_free(source);
+
+    for (size_t t = 0; t < thread_count_count; t++) {
+        size_t threads = thread_counts[t];
+        struct hash_table_sharded* sharded_source = hash_table_sharded_new(0, NULL);
+        struct hash_table_sharded* sharded_destinations[MAXIMUM_MERGE_ROUNDS];
+
+        for (size_t i = half; i < count; i++) {
+            hash_table_sharded_add(sharded_source, keys[i], hits->lengths[i], &values[i], sizeof(size_t));
+            hash_table_sharded_add(sharded_source, &values[i], sizeof(size_t), &values[i], sizeof(size_t));
+        }
+
+        for (size_t round = 0; round < merge_rounds; round++) {
+            sharded_destinations[round] = hash_table_sharded_new(0, NULL);
+            hash_table_sharded_build(sharded_destinations[round], keys, hits->lengths, value_pointers,
+                                     value_lengths, count, 0);
+        }
+        measurement_start(&measurement);
+
+        for (size_t round = 0; round < merge_rounds; round++) {
+            hash_table_sharded_merge(sharded_destinations[round], sharded_source, add_counters, threads);
+        }
+        char variant[48];
+        snprintf(variant, sizeof(variant), "threads=%zu", threads);
+        measurement_finish(&measurement, "sharded_merge", variant, hits->name, count,
+                           merge_rounds * hash_table_sharded_size(sharded_source));
+
+        for (size_t round = 0; round < merge_rounds; round++) {
+            hash_table_sharded_free(sharded_destinations[round]);
+        }
+        hash_table_sharded_free(sharded_source);
+    }
+    free(keys);
+    free(values);
+    free(value_pointers);
+    free(value_lengths);
+}
+
+static void print_usage(void) {
+    fprintf(stderr,
+            "usage: WCHT_bench [options]\n"
+            "  --sizes=N,N,...      table sizes to run (default 1000,10000,100000,1000000)\n"
+            "  --quick              only run sizes 1000 and 10000\n"
+            "  --large              also run sizes 10000000 and 100000000, which take\n"
+            "                       minutes and several GB of memory\n"
+            "  --threads=N,N,...    thread counts of the concurrent and sharded benchmarks\n"
+            "                       (default 1,2,4,8)\n"
+            "  --words=FILE         word list, one word per line, for the words key set\n"
+            "  --only=GROUP,...     only run these groups: core, load, miss_heavy, batch,\n"
+            "                       typed, key_length, perfect, snapshot, load_stream,\n"
+            "                       concurrent, sharded\n"
+            "  --format=csv|json    output format (default csv)\n"
+            "  --output=FILE        write the records to FILE instead of stdout\n"
+            "  --compare=FILE       compare against a CSV saved by an earlier run\n"
+            "  --threshold=PERCENT  slowdown counted as a regression (default 10)\n");
+}
+
+int main(int argc, char* argv[]) {
+    const char* format = "csv";
+    const char* output_path = NULL;
+    const char* compare_path = NULL;
+    double threshold = 10.0;
+    unsigned char large = 0;
+
+    for (int i = 1; i < argc; i++) {
+        const char* argument = argv[i];
+
+        if (strncmp(argument, "--sizes=", 8) == 0) {
+            size_count = parse_list(argument + 8, sizes);
+        } else if (strcmp(argument, "--quick") == 0) {
+            sizes[0] = 1000;
+            sizes[1] = 10000;
+            size_count = 2;
+        } else if (strcmp(argument, "--large") == 0) {
+            large = 1;
+        } else if (strncmp(argument, "--threads=", 10) == 0) {
+            thread_count_count = parse_list(argument + 10, thread_counts);
+        } else if (strncmp(argument, "--words=", 8) == 0) {
+            if (!read_word_list(argument + 8)) {
+                return 1;
+            }
+        } else if (strncmp(argument, "--only=", 7) == 0) {
+            only_groups = argument + 7;
+        } else if (strncmp(argument, "--format=", 9) == 0) {
+            format = argument + 9;
+        } else if (strncmp(argument, "--output=", 9) == 0) {
+            output_path = argument + 9;
+        } else if (strncmp(argument, "--compare=", 10) == 0) {
+            compare_path = argument + 10;
+        } else if (strncmp(argument, "--threshold=", 12) == 0) {
+            threshold = atof(argument + 12);
+        } else {
+            print_usage();
+            return strcmp(argument, "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (large && size_count + 2 <= MAXIMUM_LIST_LENGTH) {
+        sizes[size_count++] = 10000000;
+        sizes[size_count++] = 100000000;
+    }
+
+    if (size_count == 0 || thread_count_count == 0 ||
+        (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0)) {
+        print_usage();
+        return 1;
+    }
+#ifndef COUNTING_ALLOCATIONS
+    fprintf(stderr, "Allocations can't be counted on this system, allocs_per_op is -1.\n");
+#endif
+    for (size_t s = 0; s < size_count; s++) {
+        size_t size = sizes[s];
+        struct key_set word_hits;
+        struct key_set word_misses;
+        struct key_set random_hits;
+        struct key_set random_misses;
+
+        if (!make_word_keys(&word_hits, size, 0) || !make_word_keys(&word_misses, size, 1) ||
+            !make_random_keys(&random_hits, size, 0) || !make_random_keys(&random_misses, size, size)) {
+            return 1;
+        }
+
+        if (group_selected("core")) {
+            bench_core(&word_hits, &word_misses);
+            bench_core(&random_hits, &random_misses);
+        }
+
+        if (group_selected("load")) {
+            bench_load(&random_hits, &random_misses);
+        }
+
+        if (group_selected("miss_heavy")) {
+            bench_miss_heavy(&word_hits, &word_misses);
+        }
+
+        if (group_selected("batch")) {
+            bench_batch(&word_hits);
+        }
+
+        if (group_selected("typed")) {
+            bench_typed(size);
+        }
+
+        if (group_selected("key_length")) {
+            bench_key_length(size);
+        }
+
+        if (group_selected("perfect")) {
+            bench_perfect(&word_hits, &word_misses);
+        }
+
+        if (group_selected("snapshot")) {
+            bench_snapshot(&word_hits);
+        }
+
+        if (group_selected("load_stream")) {
+            bench_load_stream(&word_hits);
+        }
+
+        if (group_selected("concurrent")) {
+            bench_concurrent(&word_hits);
+        }
+
+        if (group_selected("sharded")) {
+            bench_sharded(&word_hits);
+        }
+        key_set_free(&word_hits);
+        key_set_free(&word_misses);
+        key_set_free(&random_hits);
+        key_set_free(&random_misses);
+    }
+    FILE* output = stdout;
+
+    if (output_path != NULL) {
+        output = fopen(output_path, "w");
+
+        if (output == NULL) {
+            fprintf(stderr, "Error. Unable to create %s.\n", output_path);
+            return 1;
+        }
+    }
+
+    if (strcmp(format, "json") == 0) {
+        write_json(output);
+    } else {
+        write_csv(output);
+    }
+
+    if (output != stdout) {
+        fclose(output);
+    }
+
+    if (compare_path != NULL) {
+        int regressions = compare_with_baseline(compare_path, threshold);
+        return regressions != 0 ? 1 : 0;
+    }
+    return 0;
+}
@@ -0,0 +1,557 @@
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "WC_ConcurrentHashTable.h"
+
+//Number of segments a table gets when none is requested.
+#define DEFAULT_SEGMENT_COUNT 64
+//Smallest number of slots a segment is given.
+#define MINIMUM_SEGMENT_LENGTH 16
+//Number of epochs whose retired memory is tracked at once.
+#define EPOCH_COUNT 3
+
+//An element of a concurrent hash table. Entries are never
+//changed once they are published to readers. Replacing a
+//value publishes a new entry in the old one's slot.
+struct concurrent_entry {
+    //next entry waiting to be freed in the same epoch.
+    struct concurrent_entry* retired_next;
+    //hash of the key stored in the entry.
+    uint64_t hash;
+    //number of bytes the key takes up.
+    size_t key_length;
+    //number of bytes the value takes up.
+    size_t value_length;
+    //value bytes, immediately followed by the key bytes.
+    unsigned char data[];
+};
+
+//Slots of one segment. Readers load the segment's current
+//array and probe it linearly.
+struct concurrent_slot_array {
+    //next array waiting to be freed in the same epoch.
+    struct concurrent_slot_array* retired_next;
+    //number of slots. Always a power of two.
+    size_t length;
+    //entry stored in each slot. NULL when the slot is
+    //empty, &removed_entry when its entry was removed.
+    _Atomic(struct concurrent_entry*) slots[];
+};
+
+//A part of the table, with its own writer lock.
+struct concurrent_segment {
+    //taken by adds and removes on the segment.
+    pthread_mutex_t lock;
+    //slot array readers and writers currently use.
+    _Atomic(struct concurrent_slot_array*) array;
+    //number of entries stored in the segment.
+    _Atomic size_t elements_stored;
+    //number of slots holding &removed_entry.
+    //Guarded by lock.
+    size_t tombstones;
+};
+
+struct hash_table_concurrent_reader {
+    //table the reader reads from.
+    struct hash_table_concurrent* h_table;
+    //epoch the reader's current read section started in.
+    //0 when the reader is outside a read section.
+    _Atomic uint64_t epoch;
+    //next registered reader. Guarded by the table's reclaim_lock.
+    struct hash_table_concurrent_reader* next;
+};
+
+struct hash_table_concurrent {
+    //segments the table is split into.
+    struct concurrent_segment* segments;
+    //number of segments. Always a power of two.
+    size_t segment_count;
+    //number of high hash bits that pick a segment.
+    unsigned int segment_bits;
+    //current epoch, starting at 1.
+    _Atomic uint64_t epoch;
+    //guards the reader list and the retired lists.
+    pthread_mutex_t reclaim_lock;
+    //readers registered with the table.
+    struct hash_table_concurrent_reader* readers;
+    //entries and slot arrays unlinked from the table, kept
+    //until no reader can still hold them. Indexed by the
+    //epoch they were retired in modulo EPOCH_COUNT.
+    struct concurrent_entry* retired_entries[EPOCH_COUNT];
+    struct concurrent_slot_array* retired_arrays[EPOCH_COUNT];
+};
+
+//Marks slots whose entry was removed.
+static struct concurrent_entry removed_entry;
+
+/* Private concurrent HashTable functions */
+
+//Returns a pointer to the key stored in the passed entry.
+static inline const void* entry_key(const struct concurrent_entry* entry) {
+    return entry->data + entry->value_length;
+}
+
+//Returns the segment that keys hashing to key_hash belong to.
+static inline struct concurrent_segment* segment_for_hash(struct hash_table_concurrent* h_table,
+                                                          uint64_t key_hash) {
+    if (h_table->segment_bits == 0) {
+        return &h_table->segments[0];
+    }
+    return &h_table->segments[key_hash >> (64 - h_table->segment_bits)];
+}
+
+//Returns 1 when entry holds the passed key.
+static inline unsigned char entry_has_key(const struct concurrent_entry* entry, uint64_t key_hash,
+                                          const void* key, size_t key_length) {
+    return entry->hash == key_hash && entry->key_length == key_length &&
+           memcmp(entry_key(entry), key, key_length) == 0;
+}
+
+//Allocate a slot array of length empty slots.
+//Returns NULL on failure.
+static struct concurrent_slot_array* allocate_slot_array(size_t length) {
+    struct concurrent_slot_array* array = malloc(sizeof(struct concurrent_slot_array) +
+                                                 sizeof(array->slots[0]) * length);
+
+    if (array == NULL) {
+        fprintf(stderr, "Error. System out of memory when allocating concurrent table slots.\n");
+        return NULL;
+    }
+    array->retired_next = NULL;
+    array->length = length;
+
+    for (size_t i = 0; i < length; i++) {
+        atomic_init(&array->slots[i], NULL);
+    }
+    return array;
+}
+
+//Free the retired memory of every epoch readers can no longer
+//be in, by moving the epoch forward when every reader inside a
+//read section has seen the current epoch.
+//reclaim_lock must be held.
+static void try_advance_epoch(struct hash_table_concurrent* h_table) {
+    uint64_t epoch = atomic_load(&h_table->epoch);
+
+    for (struct hash_table_concurrent_reader* reader = h_table->readers;
+         reader != NULL; reader = reader->next) {
+        uint64_t reader_epoch = atomic_load(&reader->epoch);
+        //A reader is still reading in an older epoch.
+        if (reader_epoch != 0 && reader_epoch != epoch) {
+            return;
+        }
+    }
+    atomic_store(&h_table->epoch, epoch + 1);
+    //Every reader is now in epoch or later, so memory
+    //retired two epochs before epoch can't be held anymore.
+    size_t index = (epoch + 1) % EPOCH_COUNT;
+    struct concurrent_entry* entry = h_table->retired_entries[index];
+
+    while (entry != NULL) {
+        struct concurrent_entry* next = entry->retired_next;
+        free(entry);
+        entry = next;
+    }
+    struct concurrent_slot_array* array = h_table->retired_arrays[index];
+
+    while (array != NULL) {
+        struct concurrent_slot_array* next = array->retired_next;
+        free(array);
+        array = next;
+    }
+    h_table->retired_entries[index] = NULL;
+    h_table->retired_arrays[index] = NULL;
+}
+
+//Hand entry and array, either of which may be NULL, over to be
+//freed once no reader can still hold them.
+static void retire(struct hash_table_concurrent* h_table, struct concurrent_entry* entry,
+                   struct concurrent_slot_array* array) {
+    pthread_mutex_lock(&h_table->reclaim_lock);
+    size_t index = atomic_load(&h_table->epoch) % EPOCH_COUNT;
+
+    if (entry != NULL) {
+        entry->retired_next = h_table->retired_entries[index];
+        h_table->retired_entries[index] = entry;
+    }
+
+    if (array != NULL) {
+        array->retired_next = h_table->retired_arrays[index];
+        h_table->retired_arrays[index] = array;
+    }
+    try_advance_epoch(h_table);
+    pthread_mutex_unlock(&h_table->reclaim_lock);
+}
+
+//Copy the live entries of a segment into a new slot array sized
+//for them plus room to grow, then publish it to readers.
+//The segment's lock must be held.
+//Returns 1 on success, 0 on failure.
+static unsigned char resize_segment(struct hash_table_concurrent* h_table,
+                                    struct concurrent_segment* segment) {
+    struct concurrent_slot_array* old_array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+    size_t elements_stored = atomic_load_explicit(&segment->elements_stored, memory_order_relaxed);
+    size_t new_length = MINIMUM_SEGMENT_LENGTH;
+    //Keep the new array at most half full.
+    while (new_length < (elements_stored + 1) * 2) {
+        new_length *= 2;
+    }
+    struct concurrent_slot_array* new_array = allocate_slot_array(new_length);
+
+    if (new_array == NULL) {
+        return 0;
+    }
+    size_t mask = new_length - 1;
+    //The new array isn't visible to readers yet,
+    //so its slots can be filled with plain stores.
+    for (size_t i = 0; i < old_array->length; i++) {
+        struct concurrent_entry* entry = atomic_load_explicit(&old_array->slots[i], memory_order_relaxed);
+
+        if (entry == NULL || entry == &removed_entry) {
+            continue;
+        }
+        size_t index = entry->hash & mask;
+
+        while (atomic_load_explicit(&new_array->slots[index], memory_order_relaxed) != NULL) {
+            index = (index + 1) & mask;
+        }
+        atomic_store_explicit(&new_array->slots[index], entry, memory_order_relaxed);
+    }
+    //Publish the filled array, then retire the old one.
+    atomic_store_explicit(&segment->array, new_array, memory_order_release);
+    segment->tombstones = 0;
+    retire(h_table, NULL, old_array);
+    return 1;
+}
+
+/* Public concurrent HashTable functions */
+
+//Create a new concurrent hash table split into
+//segment_count segments, rounded up to a power of two.
+//Passing 0 for segment_count uses a default.
+//Returns NULL on failure.
+struct hash_table_concurrent* hash_table_concurrent_new(size_t segment_count) {
+    if (segment_count == 0) {
+        segment_count = DEFAULT_SEGMENT_COUNT;
+    }
+    unsigned int segment_bits = 0;
+
+    while (((size_t)1 << segment_bits) < segment_count) {
+        segment_bits++;
+    }
+    segment_count = (size_t)1 << segment_bits;
+    struct hash_table_concurrent* new_hash_table = malloc(sizeof(struct hash_table_concurrent));
+
+    if (new_hash_table == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    new_hash_table->segments = malloc(sizeof(struct concurrent_segment) * segment_count);
+
+    if (new_hash_table->segments == NULL) {
+        free(new_hash_table);
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < segment_count; i++) {
+        struct concurrent_segment* segment = &new_hash_table->segments[i];
+        struct concurrent_slot_array* array = allocate_slot_array(MINIMUM_SEGMENT_LENGTH);
+
+        if (array == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                free(atomic_load(&new_hash_table->segments[j].array));
+                pthread_mutex_destroy(&new_hash_table->segments[j].lock);
+            }
+            free(new_hash_table->segments);
+            free(new_hash_table);
+            return NULL;
+        }
+        pthread_mutex_init(&segment->lock, NULL);
+        atomic_init(&segment->array, array);
+        atomic_init(&segment->elements_stored, 0);
+        segment->tombstones = 0;
+    }
+    new_hash_table->segment_count = segment_count;
+    new_hash_table->segment_bits = segment_bits;
+    atomic_init(&new_hash_table->epoch, 1);
+    pthread_mutex_init(&new_hash_table->reclaim_lock, NULL);
+    new_hash_table->readers = NULL;
+
+    for (size_t i = 0; i < EPOCH_COUNT; i++) {
+        new_hash_table->retired_entries[i] = NULL;
+        new_hash_table->retired_arrays[i] = NULL;
+    }
+    return new_hash_table;
+}
+
+//free a passed concurrent hash_table from memory.
+void hash_table_concurrent_free(struct hash_table_concurrent* h_table) {
+    //Make sure that the passed hash table actually exists.
+    if (h_table == NULL) {
+        fprintf(stderr, "Error. Attempting to free a NULL concurrent hash table.\n");
+        return;
+    }
+    //free every segment's entries and slot array.
+    for (size_t i = 0; i < h_table->segment_count; i++) {
+        struct concurrent_segment* segment = &h_table->segments[i];
+        struct concurrent_slot_array* array = atomic_load(&segment->array);
+
+        for (size_t j = 0; j < array->length; j++) {
+            struct concurrent_entry* entry = atomic_load(&array->slots[j]);
+
+            if (entry != NULL && entry != &removed_entry) {
+                free(entry);
+            }
+        }
+        free(array);
+        pthread_mutex_destroy(&segment->lock);
+    }
+    free(h_table->segments);
+    //free everything still waiting for readers to move on.
+    for (size_t i = 0; i < EPOCH_COUNT; i++) {
+        struct concurrent_entry* entry = h_table->retired_entries[i];
+
+        while (entry != NULL) {
+            struct concurrent_entry* next = entry->retired_next;
+            free(entry);
+            entry = next;
+        }
+        struct concurrent_slot_array* array = h_table->retired_arrays[i];
+
+        while (array != NULL) {
+            struct concurrent_slot_array* next = array->retired_next;
+            free(array);
+            array = next;
+        }
+    }
+    struct hash_table_concurrent_reader* reader = h_table->readers;
+
+    while (reader != NULL) {
+        struct hash_table_concurrent_reader* next = reader->next;
+        free(reader);
+        reader = next;
+    }
+    pthread_mutex_destroy(&h_table->reclaim_lock);
+    free(h_table);
+}
+
+//Register a reader for the calling thread.
+//Returns NULL on failure.
+struct hash_table_concurrent_reader* hash_table_concurrent_reader_register(struct hash_table_concurrent* h_table) {
+    if (h_table == NULL) {
+        fprintf(stderr, "Error. NULL h_table passed to hash_table_concurrent_reader_register.\n");
+        return NULL;
+    }
+    struct hash_table_concurrent_reader* reader = malloc(sizeof(struct hash_table_concurrent_reader));
+
+    if (reader == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    reader->h_table = h_table;
+    atomic_init(&reader->epoch, 0);
+    pthread_mutex_lock(&h_table->reclaim_lock);
+    reader->next = h_table->readers;
+    h_table->readers = reader;
+    pthread_mutex_unlock(&h_table->reclaim_lock);
+    return reader;
+}
+
+//Unregister and free a reader.
+void hash_table_concurrent_reader_unregister(struct hash_table_concurrent_reader* reader) {
+    if (reader == NULL) {
+        fprintf(stderr, "Error. NULL reader passed to hash_table_concurrent_reader_unregister.\n");
+        return;
+    }
+    struct hash_table_concurrent* h_table = reader->h_table;
+    pthread_mutex_lock(&h_table->reclaim_lock);
+    struct hash_table_concurrent_reader** current = &h_table->readers;
+
+    while (*current != NULL && *current != reader) {
+        current = &(*current)->next;
+    }
+
+    if (*current == reader) {
+        *current = reader->next;
+    }
+    pthread_mutex_unlock(&h_table->reclaim_lock);
+    free(reader);
+}
+
+//Start a read section.
+void hash_table_concurrent_read_begin(struct hash_table_concurrent_reader* reader) {
+    //Announce the epoch the section reads in before loading
+    //anything from the table. The sequentially consistent store
+    //orders it before those loads, so a writer either sees the
+    //reader in this epoch or the reader sees the writer's unlink.
+    atomic_store(&reader->epoch, atomic_load(&reader->h_table->epoch));
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+//End a read section.
+void hash_table_concurrent_read_end(struct hash_table_concurrent_reader* reader) {
+    atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+//Add the passed value to the hash table accessable by the key
+//passed, replacing the value stored under the key if there is one.
+//function will return 1 on success, 0 on failure.
+unsigned char hash_table_concurrent_add(struct hash_table_concurrent* h_table, const void* key,
+                                        size_t key_length, const void* value, size_t value_length) {
+    //Make sure that parameters passed exist.
+    if (h_table == NULL || key == NULL || value == NULL) {
+        fprintf(stderr, "Error. NULL h_table, key or value passed to hash_table_concurrent_add.\n");
+        return 0;
+    }
+    uint64_t key_hash = hash_table_hash_default(key, key_length, 0);
+    //Build the entry before taking the lock.
+    struct concurrent_entry* new_entry = malloc(sizeof(struct concurrent_entry) +
+                                                value_length + key_length);
+
+    if (new_entry == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+    new_entry->retired_next = NULL;
+    new_entry->hash = key_hash;
+    new_entry->key_length = key_length;
+    new_entry->value_length = value_length;
+    memcpy(new_entry->data, value, value_length);
+    memcpy(new_entry->data + value_length, key, key_length);
+
+    struct concurrent_segment* segment = segment_for_hash(h_table, key_hash);
+    pthread_mutex_lock(&segment->lock);
+    struct concurrent_slot_array* array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+    size_t elements_stored = atomic_load_explicit(&segment->elements_stored, memory_order_relaxed);
+    //Keep the slots at most three quarters used,
+    //counting removed slots.
+    if ((elements_stored + segment->tombstones + 1) * 4 > array->length * 3) {
+        if (!resize_segment(h_table, segment)) {
+            pthread_mutex_unlock(&segment->lock);
+            free(new_entry);
+            return 0;
+        }
+        array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+    }
+    size_t mask = array->length - 1;
+    size_t index = key_hash & mask;
+    //First removed slot passed, which the entry
+    //takes if its key isn't stored yet.
+    size_t free_index = (size_t)-1;
+    struct concurrent_entry* current;
+
+    while ((current = atomic_load_explicit(&array->slots[index], memory_order_relaxed)) != NULL) {
+        if (current == &removed_entry) {
+            if (free_index == (size_t)-1) {
+                free_index = index;
+            }
+        } else if (entry_has_key(current, key_hash, key, key_length)) {
+            //Replace the stored entry. Readers holding the
+            //old entry keep it until their section ends.
+            atomic_store_explicit(&array->slots[index], new_entry, memory_order_release);
+            pthread_mutex_unlock(&segment->lock);
+            retire(h_table, current, NULL);
+            return 1;
+        }
+        index = (index + 1) & mask;
+    }
+
+    if (free_index != (size_t)-1) {
+        index = free_index;
+        segment->tombstones--;
+    }
+    atomic_store_explicit(&array->slots[index], new_entry, memory_order_release);
+    atomic_store_explicit(&segment->elements_stored, elements_stored + 1, memory_order_relaxed);
+    pthread_mutex_unlock(&segment->lock);
+    return 1;
+}
+
+//removes the value stored at the key passed in the hash table
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_concurrent_remove(struct hash_table_concurrent* h_table, const void* key,
+                                           size_t key_length) {
+    //Make sure that parameters passed exist.
+    if (h_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. NULL h_table or key passed to hash_table_concurrent_remove.\n");
+        return 0;
+    }
+    uint64_t key_hash = hash_table_hash_default(key, key_length, 0);
+    struct concurrent_segment* segment = segment_for_hash(h_table, key_hash);
+    pthread_mutex_lock(&segment->lock);
+    struct concurrent_slot_array* array = atomic_load_explicit(&segment->array, memory_order_relaxed);
+    size_t mask = array->length - 1;
+    size_t index = key_hash & mask;
+    struct concurrent_entry* current;
+
+    while ((current = atomic_load_explicit(&array->slots[index], memory_order_relaxed)) != NULL) {
+        if (current != &removed_entry && entry_has_key(current, key_hash, key, key_length)) {
+            atomic_store_explicit(&array->slots[index], &removed_entry, memory_order_release);
+            segment->tombstones++;
+            atomic_fetch_sub_explicit(&segment->elements_stored, 1, memory_order_relaxed);
+            pthread_mutex_unlock(&segment->lock);
+            retire(h_table, current, NULL);
+            return 1;
+        }
+        index = (index + 1) & mask;
+    }
+    pthread_mutex_unlock(&segment->lock);
+    return 0;
+}
+
+//returns the value stored at the key passed. Takes no locks.
+//will return null if there is nothing stored at the key passed.
+struct hash_table_key_value hash_table_concurrent_get(struct hash_table_concurrent_reader* reader,
+                                                      const void* key, size_t key_length) {
+    struct hash_table_key_value value_to_return = {NULL, 0, NULL, 0};
+    //Make sure that the parameters passed exist
+    if (reader == NULL || key == NULL) {
+        fprintf(stderr, "Error. either NULL key or reader passed to hash_table_concurrent_get.\n");
+        return value_to_return;
+    }
+    uint64_t key_hash = hash_table_hash_default(key, key_length, 0);
+    struct concurrent_segment* segment = segment_for_hash(reader->h_table, key_hash);
+    //Whichever array is loaded stays allocated until
+    //the reader's section ends, even if it is replaced.
+    struct concurrent_slot_array* array = atomic_load_explicit(&segment->array, memory_order_acquire);
+    size_t mask = array->length - 1;
+    size_t index = key_hash & mask;
+
+    for (size_t probes = 0; probes < array->length; probes++) {
+        struct concurrent_entry* current = atomic_load_explicit(&array->slots[index], memory_order_acquire);
+
+        if (current == NULL) {
+            break;
+        }
+
+        if (current != &removed_entry && entry_has_key(current, key_hash, key, key_length)) {
+            value_to_return.key = entry_key(current);
+            value_to_return.key_length = current->key_length;
+            value_to_return.value = current->data;
+            value_to_return.value_length = current->value_length;
+            break;
+        }
+        index = (index + 1) & mask;
+    }
+    return value_to_return;
+}
+
+//returns the number of elements stored in the hash table
+size_t hash_table_concurrent_size(struct hash_table_concurrent* h_table) {
+    //can't have any elements in it then
+    if (h_table == NULL) {
+        return 0;
+    }
+    size_t size = 0;
+
+    for (size_t i = 0; i < h_table->segment_count; i++) {
+        size += atomic_load_explicit(&h_table->segments[i].elements_stored, memory_order_relaxed);
+    }
+    return size;
+}
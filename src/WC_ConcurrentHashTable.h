@@ -0,0 +1,51 @@
+#ifndef WC_CONCURRENT_HASH_TABLE_H
+    #define WC_CONCURRENT_HASH_TABLE_H
+    #include <stddef.h>
+    #include "WC_HashTable.h"
+    //A hash table that can be used from many threads at once.
+    //The table is split into segments, each guarded by its own
+    //lock that adds and removes take. Gets take no locks at all.
+    //Memory that gets may still be reading is only freed once
+    //every reader has moved past it.
+    struct hash_table_concurrent;
+    //A thread's handle for reading from a concurrent hash table.
+    //Each reading thread registers its own reader.
+    struct hash_table_concurrent_reader;
+    //Create a new concurrent hash table split into
+    //segment_count segments, rounded up to a power of two.
+    //Passing 0 for segment_count uses a default.
+    //Returns NULL on failure.
+    struct hash_table_concurrent* hash_table_concurrent_new(size_t segment_count);
+    //free a passed concurrent hash_table from memory.
+    //No other thread may be using the table, and any
+    //readers still registered are freed with it.
+    void hash_table_concurrent_free(struct hash_table_concurrent* h_table);
+    //Register a reader for the calling thread.
+    //Returns NULL on failure.
+    struct hash_table_concurrent_reader* hash_table_concurrent_reader_register(struct hash_table_concurrent* h_table);
+    //Unregister and free a reader. The reader must not be
+    //inside a read section.
+    void hash_table_concurrent_reader_unregister(struct hash_table_concurrent_reader* reader);
+    //Start a read section. Key value pairs returned by
+    //hash_table_concurrent_get stay valid until the section ends.
+    void hash_table_concurrent_read_begin(struct hash_table_concurrent_reader* reader);
+    //End a read section started by hash_table_concurrent_read_begin.
+    void hash_table_concurrent_read_end(struct hash_table_concurrent_reader* reader);
+    //Add the passed value to the hash table accessable by the key
+    //passed, replacing the value stored under the key if there is one.
+    //values and keys will be copied into memory managed by the hash table.
+    //function will return 1 on success, 0 on failure.
+    unsigned char hash_table_concurrent_add(struct hash_table_concurrent* h_table, const void* key,
+                                            size_t key_length, const void* value, size_t value_length);
+    //removes the value stored at the key passed in the hash table
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_concurrent_remove(struct hash_table_concurrent* h_table, const void* key,
+                                               size_t key_length);
+    //returns the value stored at the key passed. Must be called
+    //inside a read section of the passed reader.
+    //will return null if there is nothing stored at the key passed.
+    struct hash_table_key_value hash_table_concurrent_get(struct hash_table_concurrent_reader* reader,
+                                                          const void* key, size_t key_length);
+    //returns the number of elements stored in the hash table
+    size_t hash_table_concurrent_size(struct hash_table_concurrent* h_table);
+#endif
@@ -1,522 +1,3899 @@
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
 #include <stdlib.h>
 #include <stdio.h>
-#include <math.h>
+#include <stdint.h>
 #include <string.h>
+#include <time.h>
 #include "WC_HashTable.h"
 
+//Snapshots are mapped into memory where the system has mmap,
+//and read into an allocation everywhere else.
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H) && defined(HAVE_FCNTL_H) && defined(HAVE_UNISTD_H)
+    #define WC_HT_USE_MMAP 1
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+//The group probing engine is chosen at configure time.
+//Control bytes of GROUP_WIDTH slots are checked at once.
+#if defined(WC_HT_USE_AVX2)
+    #include <immintrin.h>
+    #define GROUP_WIDTH 32
+#elif defined(WC_HT_USE_SSE2)
+    #include <emmintrin.h>
+    #define GROUP_WIDTH 16
+#else
+    #define GROUP_WIDTH 16
+#endif
+
+//Hits, misses and probe steps of each operation are only
+//counted when configured with --enable-op-counters, so
+//counting costs nothing otherwise.
+#ifdef WC_HT_OP_COUNTERS
+    #define COUNT_OPERATION(counter) ((counter)++)
+#else
+    #define COUNT_OPERATION(counter) ((void)0)
+#endif
+
+//Control byte values. A full slot's control byte holds
+//the low 7 bits of its key's hash (0 to 127), so empty
+//and deleted slots are the only ones with the sign bit set.
+#define CTRL_EMPTY ((int8_t)-128)
+#define CTRL_DELETED ((int8_t)-2)
+
+//A table element is a single allocation holding
+//the element header, followed by the value bytes,
+//followed by the key bytes. Tables that borrow their
+//keys and values store a struct borrowed_data in
+//place of the bytes.
 struct table_element {
-    //key the value is stored under.
-    void* key;
     //number of bytes the key takes up.
     size_t key_length;
-    //value stored, accessable by key.
-    void* value;
     //number of bytes the value takes up.
     size_t value_length;
+    //value bytes, immediately followed by the key bytes.
+    //The value is stored first so that it keeps the
+    //alignment of the allocation.
+    unsigned char data[];
+};
+
+//Data of an element whose key and value are
+//owned by the caller rather than copied.
+struct borrowed_data {
+    //caller's value.
+    void* value;
+    //caller's key.
+    void* key;
+};
+
+/* Group probing engine */
+
+#if defined(WC_HT_USE_AVX2)
+//Returns a bit mask of the slots in the group starting at
+//group whose control byte equals h2.
+static inline uint32_t group_match(const int8_t* group, int8_t h2) {
+    __m256i control = _mm256_loadu_si256((const __m256i*)group);
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), control));
+}
+
+//Returns a bit mask of the empty slots in the group.
+static inline uint32_t group_match_empty(const int8_t* group) {
+    return group_match(group, CTRL_EMPTY);
+}
+
+//Returns a bit mask of the empty or deleted slots in the group.
+static inline uint32_t group_match_empty_or_deleted(const int8_t* group) {
+    __m256i control = _mm256_loadu_si256((const __m256i*)group);
+    return (uint32_t)_mm256_movemask_epi8(control);
+}
+#elif defined(WC_HT_USE_SSE2)
+//Returns a bit mask of the slots in the group starting at
+//group whose control byte equals h2.
+static inline uint32_t group_match(const int8_t* group, int8_t h2) {
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), control));
+}
+
+//Returns a bit mask of the empty slots in the group.
+static inline uint32_t group_match_empty(const int8_t* group) {
+    return group_match(group, CTRL_EMPTY);
+}
+
+//Returns a bit mask of the empty or deleted slots in the group.
+static inline uint32_t group_match_empty_or_deleted(const int8_t* group) {
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (uint32_t)_mm_movemask_epi8(control);
+}
+#else
+//Returns a bit mask of the slots in the group starting at
+//group whose control byte equals h2.
+static inline uint32_t group_match(const int8_t* group, int8_t h2) {
+    uint32_t mask = 0;
+
+    for (uint32_t i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] == h2) << i;
+    }
+    return mask;
+}
+
+//Returns a bit mask of the empty slots in the group.
+static inline uint32_t group_match_empty(const int8_t* group) {
+    return group_match(group, CTRL_EMPTY);
+}
+
+//Returns a bit mask of the empty or deleted slots in the group.
+static inline uint32_t group_match_empty_or_deleted(const int8_t* group) {
+    uint32_t mask = 0;
+
+    for (uint32_t i = 0; i < GROUP_WIDTH; i++) {
+        mask |= (uint32_t)(group[i] < 0) << i;
+    }
+    return mask;
+}
+#endif
+
+//Returns the index of the lowest set bit in a non zero mask.
+static inline uint32_t mask_lowest_bit(uint32_t mask) {
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_ctz(mask);
+#else
+    uint32_t index = 0;
+
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        index++;
+    }
+    return index;
+#endif
+}
+
+//Returns the number of zero bits above the highest set
+//bit of a non zero GROUP_WIDTH bit mask.
+static inline uint32_t mask_leading_zeros(uint32_t mask) {
+#if defined(__GNUC__)
+    return (uint32_t)__builtin_clz(mask) - (32 - GROUP_WIDTH);
+#else
+    uint32_t count = 0;
+
+    while ((mask & ((uint32_t)1 << (GROUP_WIDTH - 1))) == 0) {
+        mask <<= 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+//Returns the position a hash's probe sequence starts at.
+static inline size_t hash_position(uint64_t key_hash) {
+    return (size_t)(key_hash >> 7);
+}
+
+//Returns the control byte stored for a full slot
+//holding a key with the passed hash.
+static inline int8_t hash_control(uint64_t key_hash) {
+    return (int8_t)(key_hash & 0x7F);
+}
+
+//Set the control byte of the slot at index, keeping the
+//copy of the first GROUP_WIDTH - 1 control bytes in sync.
+static inline void set_control(int8_t* control, size_t table_length,
+                               size_t index, int8_t value) {
+    control[index] = value;
+
+    if (index < GROUP_WIDTH - 1) {
+        control[table_length + index] = value;
+    }
+}
+
+//Smallest block handed out by an element arena
+//is 1 << ARENA_MIN_CLASS_SHIFT bytes.
+#define ARENA_MIN_CLASS_SHIFT 4
+//Number of power of two size classes an arena keeps
+//free lists for.
+#define ARENA_CLASS_COUNT (sizeof(size_t) * 8)
+//Size of an arena chunk when none is requested.
+#define ARENA_DEFAULT_CHUNK_SIZE ((size_t)64 * 1024)
+
+//A large block of memory that arena blocks
+//are bump allocated out of.
+struct arena_chunk {
+    //next chunk in the arena.
+    struct arena_chunk* next;
+    //number of usable bytes in data.
+    size_t size;
+    //memory blocks are carved out of.
+    unsigned char data[];
+};
+
+//Allocator that hands out element memory from
+//large chunks, so that a whole table can be
+//released with a handful of frees.
+struct element_arena {
+    //first chunk owned by the arena.
+    struct arena_chunk* chunks;
+    //chunk currently being bump allocated from.
+    struct arena_chunk* current;
+    //offset of the next free byte in current.
+    size_t current_offset;
+    //size of newly allocated chunks.
+    size_t chunk_size;
+    //released blocks, kept in one singly linked
+    //list per power of two size class.
+    void* free_lists[ARENA_CLASS_COUNT];
+};
+
+//Longest key and value, in bytes, stored in a slot
+//itself rather than in a separately allocated element.
+#define INLINE_KEY_MAX 15
+#define INLINE_VALUE_MAX 8
+//Tag of a slot whose key and value are in an element.
+#define SLOT_TAG_ELEMENT 0xFF
+//Tag of an erased slot of a draining Robin Hood array.
+//The slot's key hash is cached as it is for an element.
+#define SLOT_TAG_ERASED 0xFE
+
+//A slot in the hash table.
+//Short keys and values are stored in the slot itself.
+//The last key byte is then the slot's tag, holding the
+//key length in its high four bits and the value length
+//in its low four. Such keys are compared a word at a time
+//and are cheap to hash again, so their hash isn't kept.
+//Other keys and values live in an element, marked by
+//SLOT_TAG_ELEMENT. The key's full hash is then cached in the
+//slot, so that probes landing on a different key are
+//rejected without touching the element, and resizing never
+//has to hash a long key again.
+//Only meaningful when the slot's control byte marks it full.
+struct table_slot {
+    union {
+        //element stored in this slot.
+        struct table_element* element;
+        //the element's offset from its slot array's
+        //element_base, see slot_element.
+        uintptr_t element_offset;
+        //key bytes, zero padded, followed by the tag.
+        unsigned char bytes[INLINE_KEY_MAX + 1];
+        //the same bytes, for comparing a word at a time.
+        uint64_t words[2];
+    } key;
+    union {
+        //value bytes.
+        unsigned char bytes[INLINE_VALUE_MAX];
+        //keeps the value 8 byte aligned.
+        uint64_t word;
+        //hash of the key of a slot holding an element.
+        uint64_t hash;
+    } value;
+};
+
+//Control byte of an empty slot in a Robin Hood slot array.
+//A full slot's control byte holds its distance from the slot
+//its key hashes to plus one, or ROBIN_HOOD_DISTANCE_SATURATED
+//when that doesn't fit in a byte.
+#define ROBIN_HOOD_EMPTY 0
+#define ROBIN_HOOD_DISTANCE_SATURATED 255
+
+//The control bytes and slots of one table.
+struct slot_array {
+    //control bytes, one per slot, marking the
+    //slot empty, deleted or full. The first
+    //GROUP_WIDTH - 1 control bytes are repeated after
+    //the last one, so a group can be loaded at any index.
+    //Robin Hood slot arrays store each slot's probe
+    //distance here instead, see ROBIN_HOOD_EMPTY.
+    int8_t* control;
+    //array of table slots
+    struct table_slot* slots;
+    //number of slots. Always a power of two.
+    size_t length;
+    //number of slots marked deleted.
+    size_t tombstones;
+    //when set, slots are placed with Robin Hood linear
+    //probing rather than group probing.
+    unsigned char robin_hood;
+    //when set, elements point to borrowed keys and values
+    //instead of holding copies, see struct borrowed_data.
+    unsigned char borrowed;
+    //the table's hash function and seed, used to hash
+    //the keys of slots that don't cache their hash.
+    hash_table_hash_function hash_function;
+    uint64_t seed;
+    //set once the array is the old table of an incremental
+    //resize. Robin Hood arrays then mark erased slots by
+    //tagging them SLOT_TAG_ERASED instead of shifting later
+    //slots back, so no slot moves behind the resize's position.
+    unsigned char draining;
+    //address element offsets are relative to. 0 for
+    //arrays whose slots hold element pointers, and the
+    //start of the image for snapshot arrays, whose slots
+    //hold offsets into the image instead.
+    uintptr_t element_base;
+    //blocked Bloom filter of the keys stored in the array, made
+    //of bloom_blocks cache line sized blocks. NULL when the table
+    //keeps no filter. Bits can't be taken back out, so removed
+    //keys stay in the filter until it is rebuilt, see bloom_rebuild.
+    uint64_t* bloom;
+    size_t bloom_blocks;
+    //number of bits each key sets in its block.
+    unsigned int bloom_hashes;
+    //number of keys removed from the array since
+    //its Bloom filter was cleared or rebuilt.
+    size_t bloom_removals;
+    //allocation bloom points into, which starts
+    //wherever malloc put it rather than on a cache line.
+    void* bloom_allocation;
+#ifdef WC_HT_OP_COUNTERS
+    //probe step counter of the array's table.
+    uint64_t* probe_counter;
+#endif
 };
 
+//Number of old table slots moved into the new table
+//by each add, get and remove while an incremental
+//resize is in progress.
+#define MIGRATION_SLOTS_PER_OPERATION 64
+
 struct hash_table {
-    //takes up deleted spaces in
-    //the hash table.
-    struct table_element deleted;
-    //array of table elements
-    struct table_element** table;
+    //slot array that elements are added to.
+    struct slot_array table;
+    //slot array elements are being moved out of by
+    //an incremental resize. Its control is NULL when
+    //no resize is in progress.
+    struct slot_array old_table;
+    //index of the next old_table slot to move into table.
+    size_t migrate_index;
+    //when set, resizes move elements into the new table
+    //a few slots at a time instead of all at once.
+    unsigned char incremental_resize;
+    //when set, slot arrays use Robin Hood probing.
+    unsigned char robin_hood;
+    //fraction of the table's slots that can be used
+    //before it grows.
+    double max_load_factor;
     //the current amount of elements
     //that the table can store at
     //it's current size.
-    //This will be equal to 50% the length
-    //of table. table's length must be
-    //a prime number.
+    //This will be equal to max_load_factor
+    //of the length of table.
     size_t table_capacity;
-    //actual length of the current table.
-    //useful for freeing the values stored.
-    size_t table_length;
     //the number of elements stored in the
-    //hash table. Must be less than or
-    //equal to the table_capacity.
+    //hash table, counting both table and old_table.
+    //Must be less than or equal to the table_capacity.
     size_t elements_stored;
+    //arena element memory is allocated from.
+    //NULL when elements are allocated with malloc.
+    struct element_arena* arena;
+    //function used to hash keys.
+    hash_table_hash_function hash_function;
+    //seed passed to hash_function.
+    uint64_t seed;
+    //when set, elements borrow the caller's keys
+    //and values instead of copying them.
+    unsigned char borrowed;
+    //called on borrowed keys and values when their
+    //element is removed. NULL leaves them alone.
+    hash_table_free_function key_free;
+    hash_table_free_function value_free;
+    //image of a table opened by hash_table_open_mmap,
+    //which its slots and elements are read from in place.
+    //NULL for tables built in memory. Snapshot tables
+    //are read only.
+    unsigned char* snapshot;
+    //number of bytes in the snapshot image.
+    size_t snapshot_size;
+    //set when the image is mapped from its file rather
+    //than read into allocated memory.
+    unsigned char snapshot_mapped;
+    //bits of Bloom filter slot arrays keep per element of
+    //capacity. 0 when the table keeps no filter.
+    size_t bloom_filter_bits;
+    //images of streams loaded by hash_table_load_stream
+    //with HASH_TABLE_LOAD_BORROW, which elements point
+    //into. Released when the table is freed.
+    struct loaded_image* loaded_images;
+    //number of times the table has been resized.
+    size_t resize_count;
+    //seconds spent resizing, see hash_table_stats.
+    double resize_seconds;
+#ifdef WC_HT_OP_COUNTERS
+    //operations that found their key, and ones that didn't.
+    uint64_t hits;
+    uint64_t misses;
+    //probe steps taken by lookups of either kind.
+    uint64_t probes;
+#endif
 };
 
 /* Private HashTable functions*/
 
-//djb2 hash function
-static size_t hash(unsigned char *str, size_t str_len) {
-    //Initial hash value
-    size_t hash = 5381;
+//Returns the current time in seconds, for timing resizes.
+static inline double seconds_now(void) {
+    struct timespec now;
 
-    for (size_t i = 0; i < str_len; i++) {
-        hash = ((hash << 5) + hash) + str[i];
+    if (timespec_get(&now, TIME_UTC) != TIME_UTC) {
+        return 0.0;
     }
-    return hash;
+    return (double)now.tv_sec + (double)now.tv_nsec / 1e9;
 }
 
-//allocates a new hash_table element.
-//Returns a allocated table element on success.
-//Returns NULL on failure.
-static struct table_element* allocate_element(void* value, size_t value_length,
-                                  void* key, size_t key_length) {
-    //make sure that key and value exist.
-    if (value == NULL || key == NULL) {
-        fprintf(stderr, "Error. value or key passed to allocate element is NULL.\n");
-        return NULL;
-    }
-    //Get the amount of memory required to store a table_element_t from the heap.
-    struct table_element* new_element = malloc(sizeof(struct table_element));
-    //System out of memory.
-    if (new_element == NULL) {
-        fprintf(stderr, "Error. System out of memory.\n");
-        return NULL;
+//Returns the hash of the passed key using the
+//table's hash function and seed.
+static inline uint64_t hash_key(struct hash_table* h_table, const void* key, size_t key_length) {
+    return h_table->hash_function(key, key_length, h_table->seed);
+}
+
+//Returns 1 when h_table is a read only snapshot, printing
+//an error naming the function that tried to change it.
+static inline unsigned char is_snapshot(struct hash_table* h_table, const char* function_name) {
+    if (h_table->snapshot == NULL) {
+        return 0;
     }
-    //allocate key, then value
-    //and copy the passed values in
-    void* key_value_pair[2] = {key, value};
-    void* new_key_value_pair[2];
-    size_t* key_value_length_pair[2] = {&key_length, &value_length};
-
-    for (unsigned char i = 0; i < 2; i++) {
-        new_key_value_pair[i] = malloc(*key_value_length_pair[i]);
-        //System out of memory check.
-        if (new_key_value_pair[i] == NULL) {
-            fprintf(stderr, "Error. Failed to allocate adequate memory for an element.\n");
-            
-            if (i == 1) {
-                free(new_key_value_pair[0]);
-            }
-            return NULL;
+    fprintf(stderr, "Error. %s can't change a snapshot opened by hash_table_open_mmap.\n",
+            function_name);
+    return 1;
+}
+
+//Returns a seed that is hard for an outside party to
+//guess. Reads the system's random source when there is
+//one, and otherwise mixes the clock with the passed address.
+static uint64_t random_seed(const void* salt) {
+    uint64_t seed = 0;
+    FILE* random_source = fopen("/dev/urandom", "rb");
+
+    if (random_source != NULL) {
+        size_t bytes_read = fread(&seed, sizeof(seed), 1, random_source);
+        fclose(random_source);
+
+        if (bytes_read == 1) {
+            return seed;
         }
-        //copy the bytes into their new container.
-        memcpy(new_key_value_pair[i], key_value_pair[i], *key_value_length_pair[i]);
     }
-    new_element->key = new_key_value_pair[0];
-    new_element->key_length = key_length;
-    new_element->value = new_key_value_pair[1];
-    new_element->value_length = value_length;
-    return new_element;
+    uint64_t entropy[3] = {(uint64_t)time(NULL), (uint64_t)clock(), (uint64_t)(uintptr_t)salt};
+    return hash_table_hash_default(entropy, sizeof(entropy), seed);
 }
 
-static void free_element(struct table_element* element) {
-    free(element->value);
-    free(element->key);
-    free(element);
-}
+//Returns the power of two size class that
+//a block of the passed size belongs to.
+static size_t arena_size_class(size_t size) {
+    size_t size_class = ARENA_MIN_CLASS_SHIFT;
 
-//Returns 1 on equal, 0 otherwise.
-static unsigned char is_equal(void* obj_one, size_t obj_one_length,
-                       void* obj_two, size_t obj_two_length) {
-    //Make sure that passed parameters exist
-    if (obj_one == NULL || obj_two == NULL) {
-        fprintf(stderr, "Error. Either obj_one or obj_two "
-                        "is NULL in is_equal.\n");
-        return 0;
-    }
-    //Objects of different lengths
-    //cannot be equal.
-    if (obj_one_length != obj_two_length) {
-        return 0;
-    }
-    //check each byte of both objects, and check whether
-    //they are equal.
-    for (size_t i = 0; i < obj_one_length; i++) {
-        
-        if (*(unsigned char*)obj_one != *(unsigned char*)obj_two) {
-            return 0;
-        }
+    while (((size_t)1 << size_class) < size) {
+        size_class++;
     }
-    //The elements must be equal then
-    return 1;
+    return size_class;
 }
 
-//Return the element that the key maps to,
-//and the index it is at in the passed size_t element_index pointer
-//
-//On failure, the returned element will be NULL, and the element_index
-//will be set to 0
-static struct table_element* get_element(struct hash_table* h_table, void* key, size_t key_length,
-                             size_t* element_index) {
-    //Make sure that the parameters passed exist.
-    if (h_table == NULL || key == NULL || element_index == NULL) {
-        fprintf(stderr, "Error. either key, h_table, or element_index "
-                        "passed to get_element is NULL.\n");
+//Create a new element arena that allocates
+//chunks of chunk_size bytes.
+//Returns NULL on failure.
+static struct element_arena* arena_new(size_t chunk_size) {
+    struct element_arena* new_arena = malloc(sizeof(struct element_arena));
+
+    if (new_arena == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
         return NULL;
     }
-    //Pull out relevant properties of hash table
-    size_t table_length = h_table->table_length;
-    struct table_element** table_elements = h_table->table;
-    struct table_element* deleted = &h_table->deleted;
-    //Make sure that pointer elements retrieved
-    //exist.
-    if (table_elements == NULL || deleted == NULL) {
-        fprintf(stderr, "Error. table element array or deleted is NULL in "
-                        "get_element when retrieving from h_table struct.\n");
-        *element_index = 0;
-        return NULL;
+    new_arena->chunks = NULL;
+    new_arena->current = NULL;
+    new_arena->current_offset = 0;
+    new_arena->chunk_size = chunk_size;
+
+    for (size_t i = 0; i < ARENA_CLASS_COUNT; i++) {
+        new_arena->free_lists[i] = NULL;
     }
-    //offset for quadratic probing
-    size_t offset = 1;
-    //Find the index where the element should be stored.
-    size_t search_start_index = hash(key, key_length) % table_length;
-    //Get the element that should be element to return
-    //(without considering collisions)
-    struct table_element* current = table_elements[search_start_index];
-    //There isn't an element stored at the key passed.
-    if (current == NULL) {
-        *element_index = 0;
-        return NULL;
+    return new_arena;
+}
+
+//Allocate a block of at least size bytes out of the arena.
+//Released blocks of the same size class are reused first,
+//otherwise the block is bump allocated from the current chunk.
+//Returns NULL on failure.
+static void* arena_allocate(struct element_arena* arena, size_t size) {
+    size_t size_class = arena_size_class(size);
+    size_t block_size = (size_t)1 << size_class;
+    //Reuse a previously released block if there is one.
+    void* block = arena->free_lists[size_class];
+
+    if (block != NULL) {
+        arena->free_lists[size_class] = *(void**)block;
+        return block;
     }
-    //Look for current until NULL is reached. 
-    while (current != NULL) {
-        //Don't try to check against stepping
-        //stones.
-        if (current != deleted) {
-            void* current_key = current->key;
-            size_t current_key_length = current->key_length;
-            //Make sure that the
-            //key pulled out of current
-            //actually exists.
-            if (current_key == NULL) {
-                fprintf(stderr, "Error. A key retrieved from an element "
-                                "was NULL in get_element.\n");
-                *element_index = 0;
+    struct arena_chunk* current = arena->current;
+    //The current chunk is out of room, move on to the
+    //next chunk (left over from before a clear) if it
+    //is large enough, otherwise allocate a new one.
+    if (current == NULL || current->size - arena->current_offset < block_size) {
+        struct arena_chunk* next = (current == NULL) ? arena->chunks : current->next;
+
+        if (next == NULL || next->size < block_size) {
+            size_t chunk_size = (block_size > arena->chunk_size) ? block_size : arena->chunk_size;
+            struct arena_chunk* new_chunk = malloc(sizeof(struct arena_chunk) + chunk_size);
+
+            if (new_chunk == NULL) {
+                fprintf(stderr, "Error. System out of memory when allocating an arena chunk.\n");
                 return NULL;
             }
-            //Found the element.
-            if (is_equal(current_key, current_key_length, key, key_length)) {
-                *element_index = search_start_index;
-                return current;
+            new_chunk->size = chunk_size;
+            //Link the new chunk in after the current one, so
+            //that chunks are reused in order after a clear.
+            if (current == NULL) {
+                new_chunk->next = arena->chunks;
+                arena->chunks = new_chunk;
+            } else {
+                new_chunk->next = current->next;
+                current->next = new_chunk;
             }
+            next = new_chunk;
         }
-        //Jump to the next position for quadratic probing.
-        search_start_index = (search_start_index + offset) % table_length;
-        //Set current to the element stored there.
-        current = table_elements[search_start_index];
-        //Increment the offset for the next time around.
-        offset += 2;
+        arena->current = current = next;
+        arena->current_offset = 0;
     }
-    //Didn't find the element
-    *element_index = 0;
-    return NULL;
+    block = current->data + arena->current_offset;
+    arena->current_offset += block_size;
+    return block;
 }
 
-//Calculate the next size of the hash table,
-//by first doubling the current size,
-//then finding the next prime.
-//Return 0 on failure.
-static size_t find_next_table_length(size_t current_table_length) {
-    //Calculate the new resized table length by doubling
-    //the current length.
-    size_t new_table_length = current_table_length * 2;
-    //Truth value for whether the new table length is prime.
-    unsigned char length_is_prime;
-    //Increment new_table_length until it is prime
-    do {
-        //check whether new_table_length is prime.
-        length_is_prime = 1;
-        size_t loop_delim = sqrt(new_table_length);
-        
-        for (size_t i = 2; i < loop_delim; i++) {
-            
-            if (new_table_length % i == 0) {
-                length_is_prime = 0;
-                new_table_length += 1;
-                //break out and see if new_table_length + 1
-                //is prime
-                break;
-            }
-        }
-    } while (length_is_prime == 0);
+//Return a block of size bytes to the arena's free
+//list for its size class.
+static void arena_release(struct element_arena* arena, void* block, size_t size) {
+    size_t size_class = arena_size_class(size);
+    *(void**)block = arena->free_lists[size_class];
+    arena->free_lists[size_class] = block;
+}
+
+//Forget every block handed out by the arena, keeping
+//its chunks around to be allocated from again.
+static void arena_reset(struct element_arena* arena) {
+    arena->current = arena->chunks;
+    arena->current_offset = 0;
 
-    return new_table_length;
+    for (size_t i = 0; i < ARENA_CLASS_COUNT; i++) {
+        arena->free_lists[i] = NULL;
+    }
 }
 
-//Add the passed value 
-static unsigned char hash_table_add_element(struct hash_table* h_table, struct table_element* element) {
-    //Make sure that the hash table passed actually exists.
-    if (h_table == NULL) {
-        fprintf(stderr, "Error. passed h_table doesn't exist in add.\n");
-        return 0;
-    }
-    //Make sure that the passed element to add is not null.
-    if (element == NULL) {
-        fprintf(stderr, "Error. element passed in is NULL.\n");
-        return 0;
-    }
-    //check if hash table is at capacity, and if it is,
-    //double its size before adding the next element.
-    if (h_table->elements_stored >= h_table->table_capacity) {
-        //Double the size of the table, and add all the elements from the old table
-        //to the new one.
-        //copy out previous hash table
-        size_t table_previous_length = h_table->table_length;
-        size_t next_table_length = find_next_table_length(table_previous_length);
-        //Pull out the current table from h_table
-        //to be resized.
-        struct table_element** prev_table = h_table->table;
-        //make sure the previous table exists.
-        if (prev_table == NULL) {
-            fprintf(stderr, "Error. previous table on realloc is NULL.\n");
-            return 0;
-        }
-        //This table holds the values currently stored in
-        //the table, and are re-hashed and re-added
-        //when the table is expanded to its new size.
-        struct table_element** temp_table = malloc(sizeof(struct table_element*) * table_previous_length);
-        //make sure the system is not out of memory and cannot allocate temp_table
-        if (temp_table == NULL) {
-            fprintf(stderr, "Error. System out of memory when trying to allocate temp_table in add_element.\n");
-            return 0;
-        }
-        //Copy all the values from the previous table
-        //into the temporary table.
-        memcpy(temp_table, prev_table, sizeof(struct table_element*) * table_previous_length);
-        //reallocate the table to the new size.
-        struct table_element** new_table = h_table->table = realloc(prev_table, sizeof(struct table_element*) * next_table_length);
-        //Make sure the reallocated table still exists.
-        if (new_table == NULL) {
-            fprintf(stderr, "Error. hash table is NULL after reallocating in add element.\n");
-            free(temp_table);
-            return 0;
-        }
-        //Initialize all elements in the new table to NULL.
-        for (size_t i = 0; i < next_table_length; i++) {
-            new_table[i] = NULL;
-        }
-        //Update the lengths in the h_table structure.
-        h_table->table_capacity = next_table_length / 2;
-        h_table->table_length = next_table_length;
-        h_table->elements_stored = 0;
-        //Add back all of the elements stored away in
-        //temp_table to the newly resized table.
-        struct table_element* deleted = &h_table->deleted;
-        
-        for (size_t i = 0; i < table_previous_length; i++) {
-            struct table_element* current = temp_table[i];
-            
-            if (current != deleted && current != NULL) {
-                hash_table_add_element(h_table, current);
-            }
-        }
-        //Free the allocated temporary table
-        free(temp_table);
-    }
-    //Pull key and key_length out of the passed element.
-    void* key = element->key;
-    size_t key_length = element->key_length;
-    //make sure that key exists.
-    if (key == NULL) {
-        fprintf(stderr, "Error. key is NULL in add_element.\n");
-        return 0;
-    }
-    //Pulls the current table length out of the hash table.
-    size_t table_length = h_table->table_length;
-    //Find the index at which to store the new element
-    //by hashing it's key, and fitting it within the
-    //bounds of the table.
-    size_t table_index = hash(key, key_length) % table_length;
-    //Stores the new wrapped index, that is updated
-    //while resolving collisions.
-    size_t wrapped_index = table_index;
-    //retrieve the table from the h_table
-    struct table_element** table = h_table->table;
-    //retrieve deleted pointer from h_table
-    struct table_element* deleted = &h_table->deleted;
-    //Quadratically probe until there is no collision
-    struct table_element* current_element = table[table_index];
-    size_t offset = 1;
-    //Will only enter loop on a collision.
-    while (current_element != NULL && current_element != deleted) {
-        //increment the table index by the offset required
-        //for quadratic probing.
-        table_index += offset;
-        wrapped_index = table_index % table_length;
-        current_element = table[wrapped_index];
-        //increment the offset again for quadratic probing.
-        offset += 2;
-    }
-    //add the passed element into the table.
-    table[wrapped_index] = element;
-    //Added an element to the table, therefore increment
-    //number of elements stored in table.
-    h_table->elements_stored++;
-    return 0;
+//free an arena and all of its chunks.
+static void arena_free(struct element_arena* arena) {
+    struct arena_chunk* current = arena->chunks;
+
+    while (current != NULL) {
+        struct arena_chunk* next = current->next;
+        free(current);
+        current = next;
+    }
+    free(arena);
 }
 
-/* Public HashTable functions */
+//Returns the number of bytes a table element
+//holding the passed lengths takes up.
+static inline size_t element_size(unsigned char borrowed, size_t key_length, size_t value_length) {
+    if (borrowed) {
+        return sizeof(struct table_element) + sizeof(struct borrowed_data);
+    }
+    return sizeof(struct table_element) + value_length + key_length;
+}
 
-//Create a new hash table. Returns a
-//pointer to a new hash table on success.
-//Returns NULL on failure.
-struct hash_table* hash_table_new(void) {
-    const size_t initial_table_size = 13;
-    struct hash_table* new_hash_table = malloc(sizeof(struct hash_table));
+//Returns a pointer to the key stored in the passed element,
+//or to the key it borrows when borrowed is set.
+static inline void* element_key(struct table_element* element, unsigned char borrowed) {
+    if (borrowed) {
+        return ((struct borrowed_data*)element->data)->key;
+    }
+    return element->data + element->value_length;
+}
 
-    if (new_hash_table == NULL) {
-        fprintf(stderr, "Error. System out of memory.\n");
-        return NULL;
+//Returns a pointer to the value stored in the passed element,
+//or to the value it borrows when borrowed is set.
+static inline void* element_value(struct table_element* element, unsigned char borrowed) {
+    if (borrowed) {
+        return ((struct borrowed_data*)element->data)->value;
     }
-    struct table_element** new_table = malloc(sizeof(struct table_element*) * initial_table_size);
+    return element->data;
+}
 
-    if (new_table == NULL) {
-        free(new_hash_table);
+//allocates a new hash_table element.
+//The element header, value and key are placed in one
+//contiguous allocation, taken from the table's arena
+//if it has one. Tables that borrow keys and values
+//store the passed pointers instead of copies.
+//Returns a allocated table element on success.
+//Returns NULL on failure.
+static struct table_element* allocate_element(struct hash_table* h_table, void* value, size_t value_length,
+                                  void* key, size_t key_length) {
+    //make sure that the table, key and value exist.
+    if (h_table == NULL || value == NULL || key == NULL) {
+        fprintf(stderr, "Error. h_table, value or key passed to allocate element is NULL.\n");
+        return NULL;
+    }
+    //Get the amount of memory required to store the element header,
+    //the value and the key in one allocation.
+    size_t new_element_size = element_size(h_table->borrowed, key_length, value_length);
+    struct table_element* new_element = (h_table->arena != NULL) ?
+                                        arena_allocate(h_table->arena, new_element_size) :
+                                        malloc(new_element_size);
+    //System out of memory.
+    if (new_element == NULL) {
         fprintf(stderr, "Error. System out of memory.\n");
         return NULL;
     }
-    //initialize all the table elements of the hash table to NULL;
-    for (size_t i = 0; i < initial_table_size; i++) {
-        new_table[i] = NULL;
+    new_element->key_length = key_length;
+    new_element->value_length = value_length;
+
+    if (h_table->borrowed) {
+        struct borrowed_data* borrowed = (struct borrowed_data*)new_element->data;
+        borrowed->value = value;
+        borrowed->key = key;
+        return new_element;
     }
-    //initialize the newly allocated table to sane default values.
-    new_hash_table->table = new_table;
-    new_hash_table->table_capacity = initial_table_size / 2;
-    new_hash_table->table_length = initial_table_size;
-    new_hash_table->elements_stored = 0;
-    return new_hash_table;
+    //copy the value, then the key into the element.
+    memcpy(element_value(new_element, 0), value, value_length);
+    memcpy(element_key(new_element, 0), key, key_length);
+    return new_element;
 }
 
-//free a passed hash_table from memory.
-void hash_table_free(struct hash_table* h_table) {
-    //Make sure that the passed hash table actually exists.
-    if (h_table == NULL) {
-        fprintf(stderr, "Error. Attempting to free a NULL hash table.\n");
-        return;
+//free a table element. The key and value live inside
+//the element's allocation, so one free releases everything.
+//Borrowed keys and values are handed to the table's free
+//functions, if it has them.
+//Arena backed tables hand the element back to their arena.
+static void free_element(struct hash_table* h_table, struct table_element* element) {
+    if (h_table->borrowed) {
+        if (h_table->key_free != NULL) {
+            h_table->key_free(element_key(element, 1));
+        }
+
+        if (h_table->value_free != NULL) {
+            h_table->value_free(element_value(element, 1));
+        }
     }
-    //pull the pointer to the start of the table out of h_table
-    struct table_element** table = h_table->table;
 
-    if (table == NULL) {
-        free(h_table);
-        fprintf(stderr, "Error. Hashtable is corrupt.\n");
+    if (h_table->arena != NULL) {
+        arena_release(h_table->arena, element,
+                      element_size(h_table->borrowed, element->key_length, element->value_length));
         return;
     }
-    //pull the memory address of the deleted dummy element
-    //out of h_table.
-    struct table_element* deleted = &h_table->deleted;
-    //go through each element in the hash table, and
-    //free every used element (not deleted or NULL)
-    for (size_t i = 0; i < h_table->table_length; i++) {
-        struct table_element* current = table[i];
+    free(element);
+}
 
-        if (current != deleted && current != NULL) {
-            free_element(current);
-            table[i] = deleted;
-        }
-    }
-    //free the table stored in the hash table
-    //now that all the allocated elements are freed.
-    free(table);
-    //free the hash table itself, now that all of
-    //it's dynamically allocated internals are freed.
-    free(h_table);
+//Returns the tag of a slot, see struct table_slot.
+static inline uint8_t slot_tag(const struct table_slot* slot) {
+    return slot->key.bytes[INLINE_KEY_MAX];
 }
 
-//Add the passed value to the hash table accessable by the
-//key passed.
-//values and keys will be copied into memory managed by the
-//hash table.
-//function will return 1 on success, 0 on failure.
-unsigned char hash_table_add(struct hash_table* h_table, void* key, size_t key_length,
-                             void* value, size_t value_length) {
-    //create a new element containing the passed values.
-    struct table_element* new_element = allocate_element(value, value_length,
-                                                    key, key_length);
-    //Use the private function to add the newly allocated element
-    //into the hash table.
-    return hash_table_add_element(h_table, new_element);
+//Returns the element stored in a slot of array.
+static inline struct table_element* slot_element(const struct slot_array* array,
+                                                 const struct table_slot* slot) {
+    return (struct table_element*)(array->element_base + slot->key.element_offset);
 }
 
-//removes the value stored at the key passed in the hash table
-//returns 1 on success, 0 on failure.
-unsigned char hash_table_remove(struct hash_table* h_table, void* key, size_t key_length) {
-    //Make sure that parameters passed exist.
-    if (h_table == NULL || key == NULL) {
-        fprintf(stderr, "Error. Either NULL h_table or NULL key passed to "
-                        "hash_table_remove.\n");
-        return 0;
+//Returns a pointer to the key stored in a slot of array.
+static inline void* slot_key(struct slot_array* array, struct table_slot* slot) {
+    if (slot_tag(slot) == SLOT_TAG_ELEMENT) {
+        return element_key(slot_element(array, slot), array->borrowed);
     }
-    //Get the element at the key passed.
-    size_t element_index;
-    struct table_element* element_to_remove = get_element(h_table, key, key_length, &element_index);
-    //Check if the get_element found
-    //the element at the key successfully.
-    if (element_to_remove == NULL) {
-        return 0;
+    return slot->key.bytes;
+}
+
+//Returns the length of the key stored in a slot of array.
+static inline size_t slot_key_length(const struct slot_array* array, const struct table_slot* slot) {
+    if (slot_tag(slot) == SLOT_TAG_ELEMENT) {
+        return slot_element(array, slot)->key_length;
     }
-    //Set the element in h_table to deleted.
-    h_table->table[element_index] = &h_table->deleted;
-    //free the element
-    free_element(element_to_remove);
-    //Update the count of stored items
-    h_table->elements_stored--;
-    //element was removed successfully.
-    return 1;
+    return slot_tag(slot) >> 4;
 }
 
-//returns the value stored at the key passed.
-//will return NULL if there is nothing stored at the key passed.
-struct hash_table_key_value hash_table_get(struct hash_table* h_table, void* key, size_t key_length) {
-    //Initialize value_to_return
-    struct hash_table_key_value value_to_return;
-    //Initialize key and key length
-    //to sane defaults.
-    value_to_return.key = NULL;
-    value_to_return.key_length = 0;
-    //Initialize value and value length
-    //to sane defaults.
-    value_to_return.value = NULL;
-    value_to_return.value_length = 0;
-    //Make sure that the parameters passed exist
-    if (h_table == NULL || key == NULL) {
-        fprintf(stderr, "Error. either NULL key or table passed to hash_table_get.\n");
-        return value_to_return;
+//Returns a pointer to the value stored in a slot of array.
+static inline void* slot_value(struct slot_array* array, struct table_slot* slot) {
+    if (slot_tag(slot) == SLOT_TAG_ELEMENT) {
+        return element_value(slot_element(array, slot), array->borrowed);
     }
-    //element index for passing to get_element
-    size_t element_index;
-    struct table_element* element = get_element(h_table, key, key_length, &element_index);
-    //If the element wasn't found.
-    if (element == NULL) {
-        return value_to_return;
+    return slot->value.bytes;
+}
+
+//Returns the length of the value stored in a slot of array.
+static inline size_t slot_value_length(const struct slot_array* array, const struct table_slot* slot) {
+    if (slot_tag(slot) == SLOT_TAG_ELEMENT) {
+        return slot_element(array, slot)->value_length;
     }
-    //Set the values passed into the key and 
-    //key length fields of value_to_return
-    value_to_return.key = key;
-    value_to_return.key_length = key_length;
-    //Set the values in value_to_return to
-    //reflect the values in the element.
-    value_to_return.value = element->value;
-    value_to_return.value_length = element->value_length;
-    return value_to_return;
+    return slot_tag(slot) & 0x0F;
 }
 
-//returns the number of elements stored in the hash table
-size_t hash_table_size(struct hash_table* h_table) {
-    //can't have any elements in it then
-    if (h_table == NULL) {
-        return 0;
+//Returns the hash of the key stored in a slot of array.
+static inline uint64_t slot_hash(struct slot_array* array, struct table_slot* slot) {
+    if (slot_tag(slot) == SLOT_TAG_ELEMENT || slot_tag(slot) == SLOT_TAG_ERASED) {
+        return slot->value.hash;
     }
-    //Return the size stored in the hash table struct
-    return h_table->elements_stored;
+    return array->hash_function(slot->key.bytes, slot_tag(slot) >> 4, array->seed);
 }
 
-/*
-* (Key, Value) iterator
-*/
-struct hash_table_key_value_iterator {
-    //the current pair looking at
-    struct table_element* current;
-    //default new flag, to return
-    //the first value on the first
-    //call
-    unsigned char is_new;
-    //current iteration index
-    size_t current_index;
-    //end iteration index
-    size_t max_index;
-};
+//Fill slot with the passed key and value, whose key hashes to
+//key_hash. Short keys and values are copied into the slot, other
+//ones into a newly allocated element.
+//Returns 1 on success, 0 on failure.
+static unsigned char fill_slot(struct hash_table* h_table, struct table_slot* slot, uint64_t key_hash,
+                               void* key, size_t key_length, void* value, size_t value_length) {
+    //Borrowed keys and values have to stay where the
+    //caller put them, so they always get an element.
+    if (h_table->borrowed || key_length > INLINE_KEY_MAX || value_length > INLINE_VALUE_MAX) {
+        slot->key.element = allocate_element(h_table, value, value_length, key, key_length);
+
+        if (slot->key.element == NULL) {
+            return 0;
+        }
+        slot->key.bytes[INLINE_KEY_MAX] = SLOT_TAG_ELEMENT;
+        slot->value.hash = key_hash;
+        return 1;
+    }
+    //make sure that the key and value exist.
+    if (key == NULL || value == NULL) {
+        fprintf(stderr, "Error. value or key passed to fill_slot is NULL.\n");
+        return 0;
+    }
+    //Zero the padding, so keys compare a word at a time.
+    memset(&slot->key, 0, sizeof(slot->key));
+    slot->value.word = 0;
+    memcpy(slot->key.bytes, key, key_length);
+    memcpy(slot->value.bytes, value, value_length);
+    slot->key.bytes[INLINE_KEY_MAX] = (uint8_t)((key_length << 4) | value_length);
+    return 1;
+}
+
+//free what a slot holds outside of its slot array.
+static inline void free_slot(struct hash_table* h_table, struct table_slot* slot) {
+    if (slot_tag(slot) == SLOT_TAG_ELEMENT) {
+        free_element(h_table, slot->key.element);
+    }
+}
+
+//A key being looked up, along with its inline form
+//when it is short enough to be stored in a slot.
+struct lookup_key {
+    //key passed to the lookup.
+    void* key;
+    //number of bytes the key takes up.
+    size_t key_length;
+    //the key as an inline slot would store it, with
+    //the key length in the tag and no value length.
+    uint64_t words[2];
+};
+
+//Mask clearing the value length out of a slot's second key word.
+static const union {
+    unsigned char bytes[INLINE_KEY_MAX + 1];
+    uint64_t words[2];
+} inline_key_mask = {{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+                      0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0}};
+
+//Prepare the passed key for being looked up.
+static inline void make_lookup_key(struct lookup_key* lookup, void* key, size_t key_length) {
+    lookup->key = key;
+    lookup->key_length = key_length;
+
+    if (key_length <= INLINE_KEY_MAX) {
+        unsigned char bytes[INLINE_KEY_MAX + 1] = {0};
+        memcpy(bytes, key, key_length);
+        bytes[INLINE_KEY_MAX] = (uint8_t)(key_length << 4);
+        memcpy(lookup->words, bytes, sizeof(bytes));
+    }
+}
+
+//Returns 1 when the length bytes at one and two, at most
+//16 of them, are equal. Two loads of a word, or of half a word,
+//that overlap for lengths between the word sizes cover every byte.
+static inline unsigned char short_keys_equal(const unsigned char* one, const unsigned char* two,
+                                             size_t length) {
+    if (length >= 8) {
+        uint64_t first[2], last[2];
+        memcpy(&first[0], one, 8);
+        memcpy(&first[1], two, 8);
+        memcpy(&last[0], one + length - 8, 8);
+        memcpy(&last[1], two + length - 8, 8);
+        return ((first[0] ^ first[1]) | (last[0] ^ last[1])) == 0;
+    }
+
+    if (length >= 4) {
+        uint32_t first[2], last[2];
+        memcpy(&first[0], one, 4);
+        memcpy(&first[1], two, 4);
+        memcpy(&last[0], one + length - 4, 4);
+        memcpy(&last[1], two + length - 4, 4);
+        return ((first[0] ^ first[1]) | (last[0] ^ last[1])) == 0;
+    }
+
+    if (length == 0) {
+        return 1;
+    }
+    //The first, middle and last byte cover lengths 1 to 3.
+    return one[0] == two[0] && one[length / 2] == two[length / 2] &&
+           one[length - 1] == two[length - 1];
+}
+
+//Returns 1 when the length bytes at one and two, more than
+//16 of them, are equal. Compares a vector or a word at a time,
+//finishing with one that overlaps the last full one.
+static inline unsigned char long_keys_equal(const unsigned char* one, const unsigned char* two,
+                                            size_t length) {
+#if defined(WC_HT_USE_AVX2)
+    if (length >= 32) {
+        for (size_t i = 0; i + 32 < length; i += 32) {
+            __m256i a = _mm256_loadu_si256((const __m256i*)(one + i));
+            __m256i b = _mm256_loadu_si256((const __m256i*)(two + i));
+
+            if ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) != 0xFFFFFFFF) {
+                return 0;
+            }
+        }
+        __m256i a = _mm256_loadu_si256((const __m256i*)(one + length - 32));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(two + length - 32));
+        return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) == 0xFFFFFFFF;
+    }
+#endif
+#if defined(WC_HT_USE_AVX2) || defined(WC_HT_USE_SSE2)
+    for (size_t i = 0; i + 16 < length; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(one + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(two + i));
+
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xFFFF) {
+            return 0;
+        }
+    }
+    __m128i a = _mm_loadu_si128((const __m128i*)(one + length - 16));
+    __m128i b = _mm_loadu_si128((const __m128i*)(two + length - 16));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+#else
+    for (size_t i = 0; i + 8 < length; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, one + i, 8);
+        memcpy(&b, two + i, 8);
+
+        if (a != b) {
+            return 0;
+        }
+    }
+    uint64_t a, b;
+    memcpy(&a, one + length - 8, 8);
+    memcpy(&b, two + length - 8, 8);
+    return a == b;
+#endif
+}
+
+//Returns 1 on equal, 0 otherwise.
+//Callers compare the keys' cached hashes first,
+//so this only runs when the keys are likely equal.
+static unsigned char is_equal(const void* obj_one, size_t obj_one_length,
+                              const void* obj_two, size_t obj_two_length) {
+    //Make sure that passed parameters exist
+    if (obj_one == NULL || obj_two == NULL) {
+        fprintf(stderr, "Error. Either obj_one or obj_two "
+                        "is NULL in is_equal.\n");
+        return 0;
+    }
+    //Objects of different lengths
+    //cannot be equal.
+    if (obj_one_length != obj_two_length) {
+        return 0;
+    }
+
+    if (obj_one_length <= 16) {
+        return short_keys_equal(obj_one, obj_two, obj_one_length);
+    }
+    return long_keys_equal(obj_one, obj_two, obj_one_length);
+}
+
+//Returns 1 when slot holds the lookup key, which hashes to key_hash.
+//Inline keys are compared two words at a time.
+static inline unsigned char slot_has_key(struct slot_array* array, struct table_slot* slot,
+                                         uint64_t key_hash, const struct lookup_key* lookup) {
+    uint8_t tag = slot_tag(slot);
+
+    if (tag == SLOT_TAG_ELEMENT) {
+        return slot->value.hash == key_hash &&
+               is_equal(element_key(slot_element(array, slot), array->borrowed),
+                        slot_element(array, slot)->key_length, lookup->key, lookup->key_length);
+    }
+    //Erased slots and keys too long to be inline never match.
+    if (tag == SLOT_TAG_ERASED || lookup->key_length > INLINE_KEY_MAX) {
+        return 0;
+    }
+    return slot->key.words[0] == lookup->words[0] &&
+           (slot->key.words[1] & inline_key_mask.words[1]) == lookup->words[1];
+}
+
+/* Bloom filter */
+
+//Number of bits in a block of a Bloom filter, one cache line.
+//A key's bits all land in one block, so checking a key
+//costs at most one cache miss however many bits it sets.
+#define BLOOM_BLOCK_BITS 512
+#define BLOOM_BLOCK_WORDS (BLOOM_BLOCK_BITS / 64)
+#define BLOOM_BLOCK_BYTES (BLOOM_BLOCK_BITS / 8)
+//Most bits a key sets in its block.
+#define BLOOM_MAXIMUM_HASHES 16
+//Odd multipliers mixing a key's hash into its block index and
+//bit positions, so they are independent of the hash bits the
+//probe and control bytes use.
+#define BLOOM_BLOCK_MIX 0x9e3779b97f4a7c15ULL
+#define BLOOM_BIT_MIX 0xbf58476d1ce4e5b9ULL
+
+//Returns the block of array's Bloom filter a key
+//hashing to key_hash sets its bits in.
+static inline uint64_t* bloom_block(const struct slot_array* array, uint64_t key_hash) {
+    //Scale 32 mixed bits to the number of blocks, which
+    //needn't be a power of two, with a multiply and shift.
+    uint64_t block = (((key_hash * BLOOM_BLOCK_MIX) >> 32) * (uint64_t)array->bloom_blocks) >> 32;
+    return array->bloom + (size_t)block * BLOOM_BLOCK_WORDS;
+}
+
+//Add a key hashing to key_hash to array's Bloom filter.
+static inline void bloom_add(struct slot_array* array, uint64_t key_hash) {
+    if (array->bloom == NULL) {
+        return;
+    }
+    uint64_t* block = bloom_block(array, key_hash);
+    uint64_t bits = key_hash;
+    //Each step's top 9 bits pick one of the block's bits.
+    for (unsigned int i = 0; i < array->bloom_hashes; i++) {
+        bits *= BLOOM_BIT_MIX;
+        size_t bit = (size_t)(bits >> 55);
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+}
+
+//Returns 0 when array's Bloom filter rules out a key hashing
+//to key_hash being stored in array, 1 when it may be stored.
+static inline unsigned char bloom_may_contain(const struct slot_array* array, uint64_t key_hash) {
+    if (array->bloom == NULL) {
+        return 1;
+    }
+    const uint64_t* block = bloom_block(array, key_hash);
+    uint64_t bits = key_hash;
+
+    for (unsigned int i = 0; i < array->bloom_hashes; i++) {
+        bits *= BLOOM_BIT_MIX;
+        size_t bit = (size_t)(bits >> 55);
+
+        if ((block[bit / 64] & ((uint64_t)1 << (bit % 64))) == 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+//Returns the number of set bits in word.
+static inline unsigned int count_bits(uint64_t word) {
+#if defined(__GNUC__)
+    return (unsigned int)__builtin_popcountll(word);
+#else
+    unsigned int count = 0;
+
+    while (word != 0) {
+        word &= word - 1;
+        count++;
+    }
+    return count;
+#endif
+}
+
+//Returns the estimated fraction of missing keys array's
+//Bloom filter lets through. A missing key passes when all
+//of its bits happen to be set in its block, so each block
+//passes the fraction of its bits that are set, raised to
+//the number of bits a key sets.
+static double bloom_false_positive_rate(const struct slot_array* array) {
+    if (array->bloom == NULL) {
+        return 1.0;
+    }
+    double rate_sum = 0.0;
+
+    for (size_t i = 0; i < array->bloom_blocks; i++) {
+        const uint64_t* block = array->bloom + i * BLOOM_BLOCK_WORDS;
+        unsigned int set_bits = 0;
+
+        for (size_t j = 0; j < BLOOM_BLOCK_WORDS; j++) {
+            set_bits += count_bits(block[j]);
+        }
+        double block_rate = 1.0;
+
+        for (unsigned int j = 0; j < array->bloom_hashes; j++) {
+            block_rate *= (double)set_bits / BLOOM_BLOCK_BITS;
+        }
+        rate_sum += block_rate;
+    }
+    return rate_sum / (double)array->bloom_blocks;
+}
+
+//Returned by find_slot when the key isn't stored.
+#define SLOT_NOT_FOUND ((size_t)-1)
+
+//Return the index of the slot in a group probed array
+//holding the key passed, whose hash is key_hash.
+//Returns SLOT_NOT_FOUND when the key isn't stored in array.
+//When free_index isn't NULL, it is set to the first empty or
+//deleted slot the probe passed, where the key would be inserted,
+//or SLOT_NOT_FOUND when it passed none.
+static size_t group_find_slot(struct slot_array* array, uint64_t key_hash,
+                              const struct lookup_key* lookup, size_t* free_index) {
+    int8_t* control = array->control;
+    struct table_slot* slots = array->slots;
+    int8_t key_control = hash_control(key_hash);
+    //length is a power of two, so positions
+    //are wrapped into the table with a mask.
+    size_t mask = array->length - 1;
+    //Find the index where the group the element
+    //should be stored in starts.
+    size_t position = hash_position(key_hash) & mask;
+
+    if (free_index != NULL) {
+        *free_index = SLOT_NOT_FOUND;
+    }
+    //Probe one group of slots at a time, moving on by
+    //one more group each time. Every slot has been looked
+    //at once length / GROUP_WIDTH groups have been probed.
+    for (size_t probes = 1; probes <= array->length / GROUP_WIDTH; probes++) {
+        const int8_t* group = control + position;
+        COUNT_OPERATION(*array->probe_counter);
+        //Remember where an insert of the key would go, the
+        //same slot group_insert_slot would pick.
+        if (free_index != NULL && *free_index == SLOT_NOT_FOUND) {
+            uint32_t free_match = group_match_empty_or_deleted(group);
+
+            if (free_match != 0) {
+                *free_index = (position + mask_lowest_bit(free_match)) & mask;
+            }
+        }
+        //Only slots whose control byte matches the key's
+        //hash bits can hold the element.
+        uint32_t match = group_match(group, key_control);
+
+        while (match != 0) {
+            size_t index = (position + mask_lowest_bit(match)) & mask;
+            struct table_slot* current = &slots[index];
+            //Found the element.
+            if (slot_has_key(array, current, key_hash, lookup)) {
+                return index;
+            }
+            match &= match - 1;
+        }
+        //An empty slot ends the probe sequence.
+        if (group_match_empty(group) != 0) {
+            break;
+        }
+        //Move on to the next group.
+        position = (position + probes * GROUP_WIDTH) & mask;
+    }
+    //Didn't find the element
+    return SLOT_NOT_FOUND;
+}
+
+//Returns the distance of the full slot at index of a
+//Robin Hood array from the slot its key hashes to.
+static inline size_t robin_hood_distance(struct slot_array* array, size_t index) {
+    uint8_t distance = (uint8_t)array->control[index];
+    //Long distances are worked out from the cached hash.
+    if (distance == ROBIN_HOOD_DISTANCE_SATURATED) {
+        return (index - hash_position(slot_hash(array, &array->slots[index]))) & (array->length - 1);
+    }
+    return (size_t)distance - 1;
+}
+
+//Set the control byte of the slot at index of a
+//Robin Hood array to hold the passed distance.
+static inline void robin_hood_set_distance(struct slot_array* array, size_t index,
+                                           size_t distance) {
+    if (distance >= ROBIN_HOOD_DISTANCE_SATURATED - 1) {
+        array->control[index] = (int8_t)ROBIN_HOOD_DISTANCE_SATURATED;
+        return;
+    }
+    array->control[index] = (int8_t)(distance + 1);
+}
+
+//Return the index of the slot in a Robin Hood array
+//holding the key passed, whose hash is key_hash.
+//Returns SLOT_NOT_FOUND when the key isn't stored in array.
+static size_t robin_hood_find_slot(struct slot_array* array, uint64_t key_hash,
+                                   const struct lookup_key* lookup) {
+    size_t mask = array->length - 1;
+    size_t index = hash_position(key_hash) & mask;
+    //Probe slot by slot. Elements are kept in order of their
+    //distance, so the key can't be stored past a slot that is
+    //empty or closer to its own home slot than the probe is.
+    for (size_t distance = 0; distance < array->length; distance++) {
+        COUNT_OPERATION(*array->probe_counter);
+
+        if ((uint8_t)array->control[index] == ROBIN_HOOD_EMPTY ||
+            robin_hood_distance(array, index) < distance) {
+            break;
+        }
+        struct table_slot* current = &array->slots[index];
+        //Found the element. Erased slots of a
+        //draining array never match.
+        if (slot_has_key(array, current, key_hash, lookup)) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+    //Didn't find the element
+    return SLOT_NOT_FOUND;
+}
+
+//Return the index of the slot in array holding the key
+//passed, whose hash is key_hash.
+//Returns SLOT_NOT_FOUND when the key isn't stored in array.
+static inline size_t find_slot(struct slot_array* array, uint64_t key_hash,
+                               const struct lookup_key* lookup) {
+    //Most missing keys are ruled out without probing.
+    if (!bloom_may_contain(array, key_hash)) {
+        return SLOT_NOT_FOUND;
+    }
+
+    if (array->robin_hood) {
+        return robin_hood_find_slot(array, key_hash, lookup);
+    }
+    return group_find_slot(array, key_hash, lookup, NULL);
+}
+
+//Returns 1 when the slot at index of array holds an element.
+static inline unsigned char slot_is_full(struct slot_array* array, size_t index) {
+    if (array->robin_hood) {
+        return (uint8_t)array->control[index] != ROBIN_HOOD_EMPTY &&
+               slot_tag(&array->slots[index]) != SLOT_TAG_ERASED;
+    }
+    return array->control[index] >= 0;
+}
+
+//Return the slot that the key, which hashes to key_hash, maps
+//to, the slot array it is stored in, and the index it is at in
+//that array. Both the table and the old table of an incremental
+//resize are searched.
+//
+//On failure, the returned slot will be NULL.
+static struct table_slot* get_slot(struct hash_table* h_table, uint64_t key_hash, void* key,
+                                   size_t key_length, struct slot_array** slot_array, size_t* slot_index) {
+    //Make sure that the parameters passed exist.
+    if (h_table == NULL || key == NULL || slot_array == NULL || slot_index == NULL) {
+        fprintf(stderr, "Error. either key, h_table, slot_array or slot_index "
+                        "passed to get_slot is NULL.\n");
+        return NULL;
+    }
+    struct lookup_key lookup;
+    make_lookup_key(&lookup, key, key_length);
+    struct slot_array* array = &h_table->table;
+    size_t index = find_slot(array, key_hash, &lookup);
+    //Elements not moved yet by an incremental
+    //resize are still in the old table.
+    if (index == SLOT_NOT_FOUND && h_table->old_table.control != NULL) {
+        array = &h_table->old_table;
+        index = find_slot(array, key_hash, &lookup);
+    }
+    //Didn't find the element
+    if (index == SLOT_NOT_FOUND) {
+        COUNT_OPERATION(h_table->misses);
+        return NULL;
+    }
+    COUNT_OPERATION(h_table->hits);
+    *slot_array = array;
+    *slot_index = index;
+    return &array->slots[index];
+}
+
+//Number of keys a batch operation hashes and prefetches
+//before it resolves any of their probes.
+#define BATCH_WIDTH 16
+
+//Start loading the cache line holding address,
+//without waiting for it to arrive.
+static inline void prefetch(const void* address) {
+#if defined(__GNUC__)
+    __builtin_prefetch(address);
+#else
+    (void)address;
+#endif
+}
+
+//Returns the index of the first slot in array that may hold
+//a key hashing to key_hash, going by its control bytes only.
+//Returns SLOT_NOT_FOUND when the home group or slot rules the
+//key out.
+static inline size_t batch_candidate_slot(struct slot_array* array, uint64_t key_hash) {
+    size_t mask = array->length - 1;
+    size_t position = hash_position(key_hash) & mask;
+
+    if (array->robin_hood) {
+        if ((uint8_t)array->control[position] == ROBIN_HOOD_EMPTY) {
+            return SLOT_NOT_FOUND;
+        }
+        return position;
+    }
+    uint32_t match = group_match(array->control + position, hash_control(key_hash));
+
+    if (match == 0) {
+        return SLOT_NOT_FOUND;
+    }
+    return (position + mask_lowest_bit(match)) & mask;
+}
+
+//Smallest length a table is ever given. A power of two of
+//at least GROUP_WIDTH slots, so a group never wraps around
+//the table more than once.
+#define MINIMUM_TABLE_LENGTH ((size_t)32)
+
+//Calculate the next size of the hash table,
+//by doubling the current size.
+static size_t find_next_table_length(size_t current_table_length) {
+    return current_table_length * 2;
+}
+
+//Default fraction of a table's slots that can be used
+//before it grows, and the range a caller can pick from.
+#define DEFAULT_MAX_LOAD_FACTOR 0.875
+#define MINIMUM_MAX_LOAD_FACTOR 0.25
+#define MAXIMUM_MAX_LOAD_FACTOR 0.95
+
+//Returns the table's capacity at the passed length,
+//which is max_load_factor of its slots.
+static inline size_t capacity_for_length(double max_load_factor, size_t table_length) {
+    return (size_t)((double)table_length * max_load_factor);
+}
+
+//Calculate the smallest table length able to store
+//capacity elements without resizing. Lengths are powers
+//of two, so this takes a shift per doubling rather than
+//searching for a size.
+//Returns 0 when no table can hold capacity elements.
+static size_t table_length_for_capacity(double max_load_factor, size_t capacity) {
+    size_t table_length = MINIMUM_TABLE_LENGTH;
+
+    while (capacity_for_length(max_load_factor, table_length) < capacity) {
+        //Doubling again would overflow.
+        if (table_length > ((size_t)-1 / 2) / sizeof(struct table_slot)) {
+            return 0;
+        }
+        table_length *= 2;
+    }
+    return table_length;
+}
+
+//Store the passed slot, whose key hashes to element_hash,
+//at table_index, an empty or deleted slot of a group probed array.
+static inline void group_place_slot(struct slot_array* array, size_t table_index,
+                                    const struct table_slot* slot, uint64_t element_hash) {
+    //Reusing a deleted slot takes a tombstone out of the table.
+    if (array->control[table_index] == CTRL_DELETED) {
+        array->tombstones--;
+    }
+    //add the passed slot into the table.
+    set_control(array->control, array->length, table_index, hash_control(element_hash));
+    array->slots[table_index] = *slot;
+}
+
+//Store the passed slot, whose key hashes to element_hash,
+//in the first empty or deleted slot of its group probe sequence.
+//Returns the index the slot was stored at.
+static size_t group_insert_slot(struct slot_array* array, const struct table_slot* slot,
+                                uint64_t element_hash) {
+    int8_t* control = array->control;
+    //Find the index where the first group to probe
+    //starts by fitting the hash within the bounds of the table.
+    size_t mask = array->length - 1;
+    size_t position = hash_position(element_hash) & mask;
+    uint32_t match = group_match_empty_or_deleted(control + position);
+    //Probe group by group until a group has a free slot.
+    //The table is never full, so one is always found.
+    for (size_t probes = 1; match == 0; probes++) {
+        position = (position + probes * GROUP_WIDTH) & mask;
+        match = group_match_empty_or_deleted(control + position);
+    }
+    size_t table_index = (position + mask_lowest_bit(match)) & mask;
+    group_place_slot(array, table_index, slot, element_hash);
+    return table_index;
+}
+
+//Store the passed slot, whose key hashes to element_hash, in a
+//Robin Hood array. Walking from the slot's home, whenever the
+//slot being placed is further from home than the slot in the
+//way, the two swap and the displaced slot is placed next.
+//Returns the index the passed slot was stored at.
+static size_t robin_hood_insert_slot(struct slot_array* array, const struct table_slot* slot,
+                                     uint64_t element_hash) {
+    size_t mask = array->length - 1;
+    size_t index = hash_position(element_hash) & mask;
+    size_t distance = 0;
+    struct table_slot placing = *slot;
+    size_t placed_index = SLOT_NOT_FOUND;
+    //The table is never full, so an empty slot is always found.
+    while ((uint8_t)array->control[index] != ROBIN_HOOD_EMPTY) {
+        size_t current_distance = robin_hood_distance(array, index);
+        //Take the slot from an element closer to its home.
+        if (current_distance < distance) {
+            struct table_slot displaced = array->slots[index];
+            array->slots[index] = placing;
+            robin_hood_set_distance(array, index, distance);
+            placing = displaced;
+            distance = current_distance;
+            //The passed slot is the first one placed.
+            if (placed_index == SLOT_NOT_FOUND) {
+                placed_index = index;
+            }
+        }
+        index = (index + 1) & mask;
+        distance++;
+    }
+    array->slots[index] = placing;
+    robin_hood_set_distance(array, index, distance);
+    return placed_index == SLOT_NOT_FOUND ? index : placed_index;
+}
+
+//Store the passed slot, whose key hashes to element_hash, in array.
+//Returns the index the slot was stored at.
+static inline size_t insert_slot(struct slot_array* array, const struct table_slot* slot,
+                                 uint64_t element_hash) {
+    bloom_add(array, element_hash);
+
+    if (array->robin_hood) {
+        return robin_hood_insert_slot(array, slot, element_hash);
+    }
+    return group_insert_slot(array, slot, element_hash);
+}
+
+//Mark the slot at index of a Robin Hood array as no longer
+//holding an element, by shifting every following element that
+//isn't in its home slot back by one. No tombstones are left.
+static void robin_hood_erase_slot(struct slot_array* array, size_t index) {
+    //A draining array's slots must stay where they
+    //are, so the erased slot is only tagged as erased.
+    //It keeps its hash, probes still need its distance.
+    if (array->draining) {
+        struct table_slot* slot = &array->slots[index];
+        slot->value.hash = slot_hash(array, slot);
+        slot->key.bytes[INLINE_KEY_MAX] = SLOT_TAG_ERASED;
+        return;
+    }
+    size_t mask = array->length - 1;
+    size_t next = (index + 1) & mask;
+
+    while ((uint8_t)array->control[next] != ROBIN_HOOD_EMPTY) {
+        size_t next_distance = robin_hood_distance(array, next);
+        //Elements in their home slot stay there.
+        if (next_distance == 0) {
+            break;
+        }
+        array->slots[index] = array->slots[next];
+        robin_hood_set_distance(array, index, next_distance - 1);
+        index = next;
+        next = (next + 1) & mask;
+    }
+    array->control[index] = ROBIN_HOOD_EMPTY;
+}
+
+//Mark the slot at index of a group probed array as no longer
+//holding an element.
+//When every group a probe could have loaded the slot in
+//also has an empty slot, no probe sequence ever continued
+//past it, so it can be marked empty again. Otherwise it
+//becomes a deleted slot that probes continue past.
+static void group_erase_slot(struct slot_array* array, size_t index) {
+    size_t mask = array->length - 1;
+    uint32_t empty_after = group_match_empty(array->control + index);
+    uint32_t empty_before = group_match_empty(array->control + ((index - GROUP_WIDTH) & mask));
+    //Count the full and deleted slots running into the slot
+    //from both sides. Fewer than GROUP_WIDTH of them means no
+    //group holding the slot was ever without an empty slot.
+    if (empty_after != 0 && empty_before != 0 &&
+        mask_lowest_bit(empty_after) + mask_leading_zeros(empty_before) < GROUP_WIDTH) {
+        set_control(array->control, array->length, index, CTRL_EMPTY);
+        return;
+    }
+    set_control(array->control, array->length, index, CTRL_DELETED);
+    array->tombstones++;
+}
+
+//Mark the slot at index of array as no longer holding an element.
+static inline void erase_slot(struct slot_array* array, size_t index) {
+    if (array->robin_hood) {
+        robin_hood_erase_slot(array, index);
+        return;
+    }
+    group_erase_slot(array, index);
+}
+
+//Clear array's Bloom filter and add the keys of its full
+//slots back, dropping the bits only removed keys had set.
+static void bloom_rebuild(struct slot_array* array) {
+    if (array->bloom == NULL) {
+        return;
+    }
+    memset(array->bloom, 0, array->bloom_blocks * BLOOM_BLOCK_BYTES);
+
+    for (size_t i = 0; i < array->length; i++) {
+        if (slot_is_full(array, i)) {
+            bloom_add(array, slot_hash(array, &array->slots[i]));
+        }
+    }
+    array->bloom_removals = 0;
+}
+
+//Count a key removed from array, a slot array of h_table.
+//Robin Hood arrays never leave tombstones, and group probed
+//ones are only rehashed once tombstones crowd the table, so
+//the filter is rebuilt on its own once the removed keys
+//reach half the keys it was sized for. That keeps it from
+//filling up with their bits under remove and add churn, at
+//the cost of a pass over the slots every so many removals.
+static inline void bloom_count_removal(struct hash_table* h_table, struct slot_array* array) {
+    //The old table of a resize is on its way out.
+    if (array->bloom == NULL || array->draining) {
+        return;
+    }
+    array->bloom_removals++;
+
+    if (array->bloom_removals >= capacity_for_length(h_table->max_load_factor, array->length) / 2) {
+        bloom_rebuild(array);
+    }
+}
+
+//Allocate the Bloom filter of a slot array of length slots,
+//sized for the elements h_table can store in them, with
+//every bit clear. Tables without a filter get none.
+//Returns 1 on success, 0 on failure.
+static unsigned char allocate_bloom_filter(struct hash_table* h_table, struct slot_array* array,
+                                           size_t length) {
+    array->bloom = NULL;
+    array->bloom_blocks = 0;
+    array->bloom_hashes = 0;
+    array->bloom_removals = 0;
+    array->bloom_allocation = NULL;
+
+    if (h_table->bloom_filter_bits == 0) {
+        return 1;
+    }
+    size_t capacity = capacity_for_length(h_table->max_load_factor, length);
+    double bits = (double)capacity * (double)h_table->bloom_filter_bits;
+    //Blocks are picked with 32 bits of the key's hash.
+    if (bits / BLOOM_BLOCK_BITS >= 4294967295.0 ||
+        bits / BLOOM_BLOCK_BITS >= (double)(SIZE_MAX / BLOOM_BLOCK_BYTES - 1)) {
+        fprintf(stderr, "Error. Bloom filter of the requested size is too large.\n");
+        return 0;
+    }
+    size_t blocks = (size_t)(bits / BLOOM_BLOCK_BITS) + 1;
+    //Setting the bits per key times ln 2 bits for each
+    //key gives the fewest false positives.
+    unsigned int hashes = (unsigned int)((double)h_table->bloom_filter_bits * 0.6931 + 0.5);
+
+    if (hashes < 1) {
+        hashes = 1;
+    } else if (hashes > BLOOM_MAXIMUM_HASHES) {
+        hashes = BLOOM_MAXIMUM_HASHES;
+    }
+    //Start the filter on a cache line, so
+    //every block is a cache line of its own.
+    array->bloom_allocation = calloc(blocks * BLOOM_BLOCK_BYTES + BLOOM_BLOCK_BYTES - 1, 1);
+
+    if (array->bloom_allocation == NULL) {
+        fprintf(stderr, "Error. System out of memory when allocating a Bloom filter.\n");
+        return 0;
+    }
+    uintptr_t start = ((uintptr_t)array->bloom_allocation + BLOOM_BLOCK_BYTES - 1) &
+                      ~(uintptr_t)(BLOOM_BLOCK_BYTES - 1);
+    array->bloom = (uint64_t*)start;
+    array->bloom_blocks = blocks;
+    array->bloom_hashes = hashes;
+    return 1;
+}
+
+//Allocate the control bytes and slots for a slot array of
+//length slots of h_table, with every slot marked empty.
+//Returns 1 on success, 0 on failure.
+static unsigned char allocate_slot_array(struct hash_table* h_table, struct slot_array* array,
+                                         size_t length) {
+    unsigned char robin_hood = h_table->robin_hood;
+    array->control = malloc(length + GROUP_WIDTH - 1);
+    array->slots = malloc(sizeof(struct table_slot) * length);
+
+    if (array->control == NULL || array->slots == NULL) {
+        free(array->control);
+        free(array->slots);
+        array->control = NULL;
+        array->slots = NULL;
+        fprintf(stderr, "Error. System out of memory when allocating table slots.\n");
+        return 0;
+    }
+
+    if (!allocate_bloom_filter(h_table, array, length)) {
+        free(array->control);
+        free(array->slots);
+        array->control = NULL;
+        array->slots = NULL;
+        return 0;
+    }
+    memset(array->control, robin_hood ? ROBIN_HOOD_EMPTY : CTRL_EMPTY, length + GROUP_WIDTH - 1);
+    array->length = length;
+    array->tombstones = 0;
+    array->robin_hood = robin_hood;
+    array->borrowed = h_table->borrowed;
+    array->hash_function = h_table->hash_function;
+    array->seed = h_table->seed;
+    array->draining = 0;
+    array->element_base = 0;
+#ifdef WC_HT_OP_COUNTERS
+    array->probe_counter = &h_table->probes;
+#endif
+    return 1;
+}
+
+//free the control bytes and slots of a slot array.
+static void free_slot_array(struct slot_array* array) {
+    free(array->control);
+    free(array->slots);
+    free(array->bloom_allocation);
+    array->control = NULL;
+    array->slots = NULL;
+    array->bloom = NULL;
+    array->bloom_allocation = NULL;
+    array->bloom_removals = 0;
+    array->length = 0;
+    array->tombstones = 0;
+}
+
+//Returns 1 when removing an element of h_table
+//calls free functions on what it borrowed.
+static inline unsigned char table_frees_borrowed(struct hash_table* h_table) {
+    return h_table->borrowed && (h_table->key_free != NULL || h_table->value_free != NULL);
+}
+
+//free every element stored in a slot array.
+static void free_slot_array_elements(struct hash_table* h_table, struct slot_array* array) {
+    for (size_t i = 0; i < array->length; i++) {
+        if (slot_is_full(array, i)) {
+            free_slot(h_table, &array->slots[i]);
+        }
+    }
+}
+
+//Move up to slot_count slots of an in progress incremental
+//resize from the old table into the table. The old table
+//is freed once every slot in it has been moved.
+static void migrate_slots(struct hash_table* h_table, size_t slot_count) {
+    struct slot_array* old_table = &h_table->old_table;
+    //No resize in progress.
+    if (old_table->control == NULL) {
+        return;
+    }
+    size_t end_index = old_table->length;
+
+    if (slot_count < end_index - h_table->migrate_index) {
+        end_index = h_table->migrate_index + slot_count;
+    }
+    //Time moves of more slots than an operation moves, the
+    //small steps of incremental resizes would cost more to time.
+    double start_time = slot_count > MIGRATION_SLOTS_PER_OPERATION ? seconds_now() : 0.0;
+
+    for (size_t i = h_table->migrate_index; i < end_index; i++) {
+        if (slot_is_full(old_table, i)) {
+            insert_slot(&h_table->table, &old_table->slots[i],
+                        slot_hash(old_table, &old_table->slots[i]));
+            //Erase the moved slot, probes for elements still in
+            //the old table continue past it if they have to.
+            erase_slot(old_table, i);
+        }
+    }
+    h_table->migrate_index = end_index;
+    //free the old table, now that its elements are moved.
+    if (end_index == old_table->length) {
+        free_slot_array(old_table);
+    }
+
+    if (slot_count > MIGRATION_SLOTS_PER_OPERATION) {
+        h_table->resize_seconds += seconds_now() - start_time;
+    }
+}
+
+//Move every remaining slot of an in progress
+//incremental resize into the table.
+static void finish_migration(struct hash_table* h_table) {
+    migrate_slots(h_table, (size_t)-1);
+}
+
+//Resize the hash table to new_length slots. The current
+//slots become the old table, and are moved into the new
+//table all at once, or a few at a time by later operations
+//when the table resizes incrementally.
+//Returns 1 on success, 0 on failure.
+static unsigned char resize_table(struct hash_table* h_table, size_t new_length) {
+    struct slot_array new_table;
+    double start_time = seconds_now();
+
+    if (!allocate_slot_array(h_table, &new_table, new_length)) {
+        return 0;
+    }
+    h_table->resize_count++;
+    h_table->resize_seconds += seconds_now() - start_time;
+    //Only one resize can be in progress at a time.
+    finish_migration(h_table);
+    h_table->old_table = h_table->table;
+    h_table->old_table.draining = 1;
+    h_table->table = new_table;
+    h_table->migrate_index = 0;
+    h_table->table_capacity = capacity_for_length(h_table->max_load_factor, new_length);
+
+    if (!h_table->incremental_resize) {
+        finish_migration(h_table);
+    }
+    return 1;
+}
+
+//Resize the hash table when it can't store capacity elements,
+//to the smallest length that can. An incremental resize this
+//starts is left in progress. function_name is the public
+//function growing the table, for error messages.
+//Returns 1 on success, 0 on failure.
+static unsigned char grow_table(struct hash_table* h_table, size_t capacity, const char* function_name) {
+    size_t required_length = table_length_for_capacity(h_table->max_load_factor, capacity);
+
+    if (required_length == 0) {
+        fprintf(stderr, "Error. Capacity passed to %s is too large.\n", function_name);
+        return 0;
+    }
+    //The table can already store capacity elements.
+    if (required_length <= h_table->table.length) {
+        return 1;
+    }
+    return resize_table(h_table, required_length);
+}
+
+//Outcomes of find_or_insert_slot besides failure.
+#define SLOT_FOUND 1
+#define SLOT_INSERTED 2
+
+//Find the slot holding the passed key, which hashes to key_hash,
+//or insert the passed value at the key when it isn't stored.
+//Group probed tables find the key and the slot to insert it at
+//in the same probe. The slot array and index of the found or
+//inserted slot are stored in slot_array and slot_index.
+//Returns SLOT_FOUND or SLOT_INSERTED on success, 0 on failure.
+static unsigned char find_or_insert_slot(struct hash_table* h_table, uint64_t key_hash,
+                                         void* key, size_t key_length, void* value, size_t value_length,
+                                         struct slot_array** slot_array, size_t* slot_index) {
+    //Move part of an in progress incremental resize along.
+    migrate_slots(h_table, MIGRATION_SLOTS_PER_OPERATION);
+    struct lookup_key lookup;
+    make_lookup_key(&lookup, key, key_length);
+    struct slot_array* array = &h_table->table;
+    size_t free_index = SLOT_NOT_FOUND;
+    size_t index = SLOT_NOT_FOUND;
+    //Keys the Bloom filter rules out are inserted
+    //without probing for them first.
+    if (bloom_may_contain(array, key_hash)) {
+        index = array->robin_hood ? robin_hood_find_slot(array, key_hash, &lookup) :
+                                    group_find_slot(array, key_hash, &lookup, &free_index);
+    }
+    //Elements not moved yet by an incremental
+    //resize are still in the old table.
+    if (index == SLOT_NOT_FOUND && h_table->old_table.control != NULL) {
+        index = find_slot(&h_table->old_table, key_hash, &lookup);
+
+        if (index != SLOT_NOT_FOUND) {
+            array = &h_table->old_table;
+        }
+    }
+
+    if (index != SLOT_NOT_FOUND) {
+        COUNT_OPERATION(h_table->hits);
+        *slot_array = array;
+        *slot_index = index;
+        return SLOT_FOUND;
+    }
+    COUNT_OPERATION(h_table->misses);
+    //check if hash table is at capacity, counting deleted slots
+    //since they lengthen probes just like elements do.
+    if (h_table->elements_stored + h_table->table.tombstones >= h_table->table_capacity) {
+        size_t new_length = h_table->table.length;
+        //When deleted slots make up a large part of the load,
+        //rehash at the same size to clear them out. Otherwise
+        //double the table's size before adding the next element.
+        if (h_table->elements_stored > h_table->table_capacity / 32 * 25) {
+            new_length = find_next_table_length(new_length);
+        }
+
+        if (!resize_table(h_table, new_length)) {
+            return 0;
+        }
+        //The free slot found belonged to the old slots.
+        free_index = SLOT_NOT_FOUND;
+    }
+    struct table_slot new_slot;
+
+    if (!fill_slot(h_table, &new_slot, key_hash, key, key_length, value, value_length)) {
+        return 0;
+    }
+    //add the new slot into the table.
+    if (free_index != SLOT_NOT_FOUND) {
+        group_place_slot(&h_table->table, free_index, &new_slot, key_hash);
+        bloom_add(&h_table->table, key_hash);
+        index = free_index;
+    } else {
+        index = insert_slot(&h_table->table, &new_slot, key_hash);
+    }
+    //Added an element to the table, therefore increment
+    //number of elements stored in table.
+    h_table->elements_stored++;
+    *slot_array = &h_table->table;
+    *slot_index = index;
+    return SLOT_INSERTED;
+}
+
+//Replace the value stored in a slot of array, whose key hashes
+//to key_hash, with the passed one. Values of the same length are
+//copied over the old one in place.
+//Returns 1 on success, 0 on failure.
+static unsigned char replace_slot_value(struct hash_table* h_table, struct slot_array* array,
+                                        struct table_slot* slot, uint64_t key_hash,
+                                        void* value, size_t value_length) {
+    //make sure that the value exists.
+    if (value == NULL) {
+        fprintf(stderr, "Error. NULL value passed to replace_slot_value.\n");
+        return 0;
+    }
+    //Borrowed values are swapped for the passed pointer,
+    //handing the old value to the table's free function.
+    if (array->borrowed) {
+        struct borrowed_data* borrowed = (struct borrowed_data*)slot->key.element->data;
+
+        if (h_table->value_free != NULL && borrowed->value != value) {
+            h_table->value_free(borrowed->value);
+        }
+        borrowed->value = value;
+        slot->key.element->value_length = value_length;
+        return 1;
+    }
+
+    if (slot_value_length(array, slot) == value_length) {
+        memmove(slot_value(array, slot), value, value_length);
+        return 1;
+    }
+    //The key and new value take up a different
+    //amount of memory, so store them again.
+    struct table_slot new_slot;
+
+    if (!fill_slot(h_table, &new_slot, key_hash, slot_key(array, slot), slot_key_length(array, slot),
+                   value, value_length)) {
+        return 0;
+    }
+    free_slot(h_table, slot);
+    *slot = new_slot;
+    return 1;
+}
+
+//Store value at key, either replacing the value stored there
+//when replace is set, or keeping it.
+//inserted, when not NULL, is set to whether the key was added.
+//Returns a pointer to the value stored at key, NULL on failure.
+static void* upsert(struct hash_table* h_table, void* key, size_t key_length,
+                    void* value, size_t value_length, unsigned char* inserted,
+                    unsigned char replace) {
+    if (inserted != NULL) {
+        *inserted = 0;
+    }
+    //Make sure that parameters passed exist.
+    if (h_table == NULL || key == NULL || value == NULL) {
+        fprintf(stderr, "Error. NULL h_table, key or value passed to upsert.\n");
+        return NULL;
+    }
+
+    if (is_snapshot(h_table, replace ? "hash_table_upsert" : "hash_table_get_or_insert")) {
+        return NULL;
+    }
+    uint64_t key_hash = hash_key(h_table, key, key_length);
+    struct slot_array* array;
+    size_t index;
+    unsigned char outcome = find_or_insert_slot(h_table, key_hash, key, key_length,
+                                                value, value_length, &array, &index);
+
+    if (outcome == 0) {
+        return NULL;
+    }
+    struct table_slot* slot = &array->slots[index];
+
+    if (outcome == SLOT_FOUND && replace &&
+        !replace_slot_value(h_table, array, slot, key_hash, value, value_length)) {
+        return NULL;
+    }
+
+    if (inserted != NULL) {
+        *inserted = (outcome == SLOT_INSERTED);
+    }
+    return slot_value(array, slot);
+}
+
+//Add count key value pairs, keys[i] and values[i], in order.
+//The keys are hashed and their home slots prefetched BATCH_WIDTH
+//at a time before they are added. Keys already stored have their
+//value replaced when replace is set, and are left alone otherwise.
+//Either way they are counted in duplicates.
+//Returns 1 on success, 0 when a pair couldn't be added.
+static unsigned char insert_batch(struct hash_table* h_table, void* const keys[], const size_t key_lengths[],
+                                  void* const values[], const size_t value_lengths[], size_t count,
+                                  unsigned char replace, size_t* duplicates) {
+    uint64_t hashes[BATCH_WIDTH];
+    unsigned char success = 1;
+
+    for (size_t start = 0; start < count; start += BATCH_WIDTH) {
+        size_t width = count - start < BATCH_WIDTH ? count - start : BATCH_WIDTH;
+        struct slot_array* array = &h_table->table;
+        //Hash every key, and prefetch the control
+        //bytes and slot its probe starts at.
+        for (size_t i = 0; i < width; i++) {
+            hashes[i] = 0;
+
+            if (keys[start + i] == NULL) {
+                continue;
+            }
+            hashes[i] = hash_key(h_table, keys[start + i], key_lengths[start + i]);
+            size_t position = hash_position(hashes[i]) & (array->length - 1);
+            prefetch(array->control + position);
+            prefetch(&array->slots[position]);
+        }
+        //Add every pair, probing the now loaded slots.
+        for (size_t i = 0; i < width; i++) {
+            struct slot_array* slot_array;
+            size_t slot_index;
+
+            if (keys[start + i] == NULL || values[start + i] == NULL) {
+                fprintf(stderr, "Error. NULL key or value passed to insert_batch.\n");
+                success = 0;
+                continue;
+            }
+            unsigned char outcome = find_or_insert_slot(h_table, hashes[i], keys[start + i],
+                                                        key_lengths[start + i], values[start + i],
+                                                        value_lengths[start + i], &slot_array, &slot_index);
+
+            if (outcome == 0) {
+                success = 0;
+            } else if (outcome == SLOT_FOUND) {
+                (*duplicates)++;
+
+                if (replace && !replace_slot_value(h_table, slot_array, &slot_array->slots[slot_index],
+                                                   hashes[i], values[start + i], value_lengths[start + i])) {
+                    success = 0;
+                }
+            }
+        }
+    }
+    return success;
+}
+
+//Create a new hash table configured by the passed options.
+//Returns NULL on failure.
+static struct hash_table* hash_table_create(const struct hash_table_options* options) {
+    //Keep the load factor within the range
+    //the probing schemes stay fast in.
+    double max_load_factor = options->max_load_factor;
+
+    if (max_load_factor < MINIMUM_MAX_LOAD_FACTOR) {
+        max_load_factor = MINIMUM_MAX_LOAD_FACTOR;
+    } else if (max_load_factor > MAXIMUM_MAX_LOAD_FACTOR) {
+        max_load_factor = MAXIMUM_MAX_LOAD_FACTOR;
+    }
+    unsigned char robin_hood = (options->probing == HASH_TABLE_PROBING_ROBIN_HOOD);
+    //Start the table large enough to hold the
+    //requested number of elements without resizing.
+    const size_t initial_table_size = table_length_for_capacity(max_load_factor,
+                                                                options->initial_capacity);
+
+    if (initial_table_size == 0) {
+        fprintf(stderr, "Error. Requested initial capacity is too large.\n");
+        return NULL;
+    }
+    struct hash_table* new_hash_table = malloc(sizeof(struct hash_table));
+
+    if (new_hash_table == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    new_hash_table->arena = NULL;
+
+    if (options->use_arena) {
+        size_t arena_chunk_size = options->arena_chunk_size;
+
+        if (arena_chunk_size == 0) {
+            arena_chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+        }
+        new_hash_table->arena = arena_new(arena_chunk_size);
+
+        if (new_hash_table->arena == NULL) {
+            free(new_hash_table);
+            return NULL;
+        }
+    }
+    //initialize the newly allocated table to sane default values.
+    new_hash_table->old_table.control = NULL;
+    new_hash_table->old_table.slots = NULL;
+    new_hash_table->old_table.length = 0;
+    new_hash_table->old_table.bloom = NULL;
+    new_hash_table->old_table.bloom_allocation = NULL;
+    new_hash_table->migrate_index = 0;
+    new_hash_table->incremental_resize = options->incremental_resize;
+    new_hash_table->robin_hood = robin_hood;
+    new_hash_table->max_load_factor = max_load_factor;
+    new_hash_table->table_capacity = capacity_for_length(max_load_factor, initial_table_size);
+    new_hash_table->elements_stored = 0;
+    //Keys are hashed with the built in default hash
+    //unless the options pick another hash function.
+    new_hash_table->hash_function = options->hash_function;
+
+    if (new_hash_table->hash_function == NULL) {
+        new_hash_table->hash_function = hash_table_hash_default;
+    }
+    new_hash_table->seed = options->seed;
+    new_hash_table->borrowed = options->borrow_keys_values != 0;
+    new_hash_table->key_free = options->key_free;
+    new_hash_table->value_free = options->value_free;
+    new_hash_table->snapshot = NULL;
+    new_hash_table->snapshot_size = 0;
+    new_hash_table->snapshot_mapped = 0;
+    new_hash_table->bloom_filter_bits = options->bloom_filter_bits;
+    new_hash_table->loaded_images = NULL;
+    new_hash_table->resize_count = 0;
+    new_hash_table->resize_seconds = 0.0;
+#ifdef WC_HT_OP_COUNTERS
+    new_hash_table->hits = 0;
+    new_hash_table->misses = 0;
+    new_hash_table->probes = 0;
+#endif
+
+    if (options->randomize_seed) {
+        new_hash_table->seed = random_seed(new_hash_table);
+    }
+    //Slot arrays take their settings from the table,
+    //so they are allocated once it is configured.
+    if (!allocate_slot_array(new_hash_table, &new_hash_table->table, initial_table_size)) {
+        if (new_hash_table->arena != NULL) {
+            arena_free(new_hash_table->arena);
+        }
+        free(new_hash_table);
+        return NULL;
+    }
+    return new_hash_table;
+}
+
+/* Snapshot images */
+
+//A snapshot file is a header followed by the table's control
+//bytes, its slots and the elements they hold, each section
+//starting at a multiple of SNAPSHOT_ALIGNMENT bytes. Element
+//slots hold the offset of their element from the start of the
+//file instead of a pointer, so the image can be used wherever
+//it is mapped.
+
+//First bytes of every snapshot file.
+static const char snapshot_magic[8] = {'W', 'C', 'H', 'T', 'S', 'N', 'A', 'P'};
+//Version of the format written by hash_table_save.
+#define SNAPSHOT_VERSION 2
+//Saved as is, so that images written on a machine
+//of the other byte order are refused.
+#define SNAPSHOT_BYTE_ORDER 0x0102030405060708ULL
+//Sections of a snapshot start at multiples of this many bytes.
+#define SNAPSHOT_ALIGNMENT ((size_t)64)
+//Elements start at multiples of this many bytes, keeping
+//their values as aligned as malloc would.
+#define SNAPSHOT_ELEMENT_ALIGNMENT ((size_t)16)
+//Number of control bytes saved after the last slot's. Enough
+//copies of the first control bytes for the widest group engine.
+//Group probed snapshots only open with the group width they were
+//saved with though, since their probe sequences step a group at
+//a time, see snapshot_header_valid. Robin Hood ones open with any.
+#define SNAPSHOT_CONTROL_PADDING ((size_t)31)
+#if GROUP_WIDTH - 1 > 31
+    #error "SNAPSHOT_CONTROL_PADDING is too small for GROUP_WIDTH"
+#endif
+//Size of the buffer snapshot files are written through.
+#define SNAPSHOT_BUFFER_SIZE ((size_t)64 * 1024)
+//Multiplier mixing each word into a snapshot's checksum.
+#define SNAPSHOT_CHECKSUM_PRIME 0x9e3779b97f4a7c15ULL
+
+//Header at the start of a snapshot file.
+struct snapshot_header {
+    //snapshot_magic.
+    char magic[8];
+    //SNAPSHOT_VERSION of the writer.
+    uint32_t version;
+    //sizes of a slot and of a size_t where the snapshot was
+    //saved. Elements and slots are only read back by builds
+    //that lay them out the same way.
+    uint16_t slot_size;
+    uint16_t size_size;
+    //SNAPSHOT_BYTE_ORDER.
+    uint64_t byte_order;
+    //index of the table's hash function in snapshot_hash_functions.
+    uint32_t hash_id;
+    //set when the slots are placed with Robin Hood probing.
+    uint32_t robin_hood;
+    //GROUP_WIDTH of the writer. Group probes step a group at a
+    //time, and removes choose between empty and deleted slots by
+    //group, so group probed slots are placed for this width only.
+    uint32_t group_width;
+    //seed passed to the hash function.
+    uint64_t seed;
+    //number of slots.
+    uint64_t length;
+    //number of elements stored.
+    uint64_t elements_stored;
+    //number of slots marked deleted.
+    uint64_t tombstones;
+    //offsets of the sections from the start of the file.
+    uint64_t control_offset;
+    uint64_t slots_offset;
+    uint64_t elements_offset;
+    //size of the whole file.
+    uint64_t size;
+    //checksum of every byte after the header.
+    uint64_t checksum;
+    //checksum of the header up to this field.
+    uint64_t header_checksum;
+};
+
+//Size of the header, rounded up to the alignment of the sections.
+#define SNAPSHOT_HEADER_SIZE ((sizeof(struct snapshot_header) + SNAPSHOT_ALIGNMENT - 1) / \
+                              SNAPSHOT_ALIGNMENT * SNAPSHOT_ALIGNMENT)
+
+//Built in hash functions a snapshot can be saved with, indexed
+//by the hash id stored in its header. Tables hashing keys with
+//any other function can't be saved, since it can't be found again
+//when the snapshot is opened. Id 0 is left unused.
+static const hash_table_hash_function snapshot_hash_functions[] = {
+    NULL, hash_table_hash_default, hash_table_hash_djb2
+};
+#define SNAPSHOT_HASH_FUNCTION_COUNT (sizeof(snapshot_hash_functions) / sizeof(snapshot_hash_functions[0]))
+
+//Returns the hash id of the passed hash function,
+//or 0 when it isn't a built in one.
+static uint32_t snapshot_hash_id(hash_table_hash_function hash_function) {
+    for (uint32_t id = 1; id < SNAPSHOT_HASH_FUNCTION_COUNT; id++) {
+        if (snapshot_hash_functions[id] == hash_function) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+//Returns value rounded up to a multiple of alignment,
+//which must be a power of two.
+static inline uint64_t align_up(uint64_t value, uint64_t alignment) {
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+//Fold length bytes, a multiple of 8, into a running checksum.
+static uint64_t snapshot_checksum(uint64_t checksum, const unsigned char* bytes, size_t length) {
+    for (size_t i = 0; i < length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes + i, sizeof(word));
+        checksum = (checksum ^ word) * SNAPSHOT_CHECKSUM_PRIME;
+        checksum ^= checksum >> 32;
+    }
+    return checksum;
+}
+
+//Writes a snapshot file through a buffer, checksumming
+//everything written after the header.
+struct snapshot_writer {
+    //file being written.
+    FILE* file;
+    //bytes not yet written to file.
+    unsigned char* buffer;
+    //number of bytes in buffer.
+    size_t buffered;
+    //offset from the start of the file of the next byte written.
+    uint64_t offset;
+    //checksum of the bytes written so far.
+    uint64_t checksum;
+    //set once a write to file has failed.
+    unsigned char failed;
+};
+
+//Write out the writer's buffer. Every section is padded to
+//a multiple of 8 bytes, as is the buffer, so the buffer only
+//ever holds whole words to checksum.
+static void snapshot_flush(struct snapshot_writer* writer) {
+    writer->checksum = snapshot_checksum(writer->checksum, writer->buffer, writer->buffered);
+
+    if (fwrite(writer->buffer, 1, writer->buffered, writer->file) != writer->buffered) {
+        writer->failed = 1;
+    }
+    writer->buffered = 0;
+}
+
+//Append length bytes to the snapshot. NULL bytes appends zeros.
+static void snapshot_write(struct snapshot_writer* writer, const void* bytes, size_t length) {
+    const unsigned char* next = bytes;
+
+    while (length > 0) {
+        size_t chunk = SNAPSHOT_BUFFER_SIZE - writer->buffered;
+
+        if (chunk > length) {
+            chunk = length;
+        }
+
+        if (next != NULL) {
+            memcpy(writer->buffer + writer->buffered, next, chunk);
+            next += chunk;
+        } else {
+            memset(writer->buffer + writer->buffered, 0, chunk);
+        }
+        writer->buffered += chunk;
+        writer->offset += chunk;
+        length -= chunk;
+
+        if (writer->buffered == SNAPSHOT_BUFFER_SIZE) {
+            snapshot_flush(writer);
+        }
+    }
+}
+
+//Pad the snapshot with zeros up to a multiple of alignment bytes.
+static void snapshot_pad(struct snapshot_writer* writer, uint64_t alignment) {
+    snapshot_write(writer, NULL, (size_t)(align_up(writer->offset, alignment) - writer->offset));
+}
+
+//Returns 1 when the header at the start of a size byte
+//image describes a snapshot this build can read.
+static unsigned char snapshot_header_valid(const struct snapshot_header* header, size_t size) {
+    if (memcmp(header->magic, snapshot_magic, sizeof(snapshot_magic)) != 0) {
+        fprintf(stderr, "Error. File is not a hash table snapshot.\n");
+        return 0;
+    }
+
+    if (header->version != SNAPSHOT_VERSION || header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->slot_size != sizeof(struct table_slot) || header->size_size != sizeof(size_t)) {
+        fprintf(stderr, "Error. Snapshot was saved by an incompatible version or machine.\n");
+        return 0;
+    }
+
+    if (!header->robin_hood && header->group_width != GROUP_WIDTH) {
+        fprintf(stderr, "Error. Snapshot was saved by a build probing groups of %u slots, "
+                        "this one probes groups of %u.\n", (unsigned int)header->group_width,
+                (unsigned int)GROUP_WIDTH);
+        return 0;
+    }
+    uint64_t length = header->length;
+
+    if (snapshot_checksum(0, (const unsigned char*)header,
+                          offsetof(struct snapshot_header, header_checksum)) != header->header_checksum ||
+        header->size != size || header->hash_id == 0 || header->hash_id >= SNAPSHOT_HASH_FUNCTION_COUNT ||
+        length < MINIMUM_TABLE_LENGTH || (length & (length - 1)) != 0 || length > size ||
+        header->elements_stored > length || header->control_offset < SNAPSHOT_HEADER_SIZE ||
+        header->control_offset > size || header->slots_offset > size || header->elements_offset > size ||
+        header->slots_offset % SNAPSHOT_ALIGNMENT != 0 || header->elements_offset % SNAPSHOT_ALIGNMENT != 0 ||
+        header->slots_offset < header->control_offset ||
+        header->slots_offset - header->control_offset < length + SNAPSHOT_CONTROL_PADDING ||
+        header->slots_offset > header->elements_offset ||
+        (header->elements_offset - header->slots_offset) / sizeof(struct table_slot) < length) {
+        fprintf(stderr, "Error. Snapshot header is corrupt.\n");
+        return 0;
+    }
+    return 1;
+}
+
+//Read the snapshot file at path into memory, mapping it read
+//only where mmap is available. The image's size and whether it
+//was mapped are stored in size and mapped.
+//Returns the image, NULL on failure.
+static unsigned char* load_snapshot_image(const char* path, size_t* size, unsigned char* mapped) {
+#ifdef WC_HT_USE_MMAP
+    int file = open(path, O_RDONLY);
+
+    if (file < 0) {
+        fprintf(stderr, "Error. Unable to open snapshot %s.\n", path);
+        return NULL;
+    }
+    struct stat file_status;
+
+    if (fstat(file, &file_status) != 0 || file_status.st_size < (off_t)SNAPSHOT_HEADER_SIZE) {
+        close(file);
+        fprintf(stderr, "Error. Snapshot %s is too short.\n", path);
+        return NULL;
+    }
+    void* image = mmap(NULL, (size_t)file_status.st_size, PROT_READ, MAP_SHARED, file, 0);
+    //The mapping keeps the file's pages, not its descriptor.
+    close(file);
+
+    if (image == MAP_FAILED) {
+        fprintf(stderr, "Error. Unable to map snapshot %s.\n", path);
+        return NULL;
+    }
+    *size = (size_t)file_status.st_size;
+    *mapped = 1;
+    return image;
+#else
+    FILE* file = fopen(path, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Error. Unable to open snapshot %s.\n", path);
+        return NULL;
+    }
+    long file_size = -1;
+
+    if (fseek(file, 0, SEEK_END) == 0) {
+        file_size = ftell(file);
+    }
+
+    if (file_size < (long)SNAPSHOT_HEADER_SIZE || fseek(file, 0, SEEK_SET) != 0) {
+        fclose(file);
+        fprintf(stderr, "Error. Snapshot %s is too short.\n", path);
+        return NULL;
+    }
+    //malloc's alignment is enough for every section.
+    unsigned char* image = malloc((size_t)file_size);
+
+    if (image == NULL || fread(image, 1, (size_t)file_size, file) != (size_t)file_size) {
+        free(image);
+        fclose(file);
+        fprintf(stderr, "Error. Unable to read snapshot %s.\n", path);
+        return NULL;
+    }
+    fclose(file);
+    *size = (size_t)file_size;
+    *mapped = 0;
+    return image;
+#endif
+}
+
+//Release an image returned by load_snapshot_image or map_stream.
+static void release_image(unsigned char* image, size_t size, unsigned char mapped) {
+#ifdef WC_HT_USE_MMAP
+    if (mapped) {
+        munmap(image, size);
+        return;
+    }
+#endif
+    (void)size;
+    (void)mapped;
+    free(image);
+}
+
+/* Stream loading */
+
+//Size of the blocks streams that can't be mapped are read in.
+#define LOAD_BLOCK_SIZE ((size_t)1 << 20)
+//Number of records parsed before they are added together.
+#define LOAD_BATCH_PAIRS 256
+
+//Image of a stream loaded with HASH_TABLE_LOAD_BORROW,
+//kept while elements may point into it.
+struct loaded_image {
+    struct loaded_image* next;
+    unsigned char* bytes;
+    size_t size;
+    //set when bytes is mapped from the stream's file
+    //rather than read into allocated memory.
+    unsigned char mapped;
+};
+
+//Records parsed out of a stream, waiting to be added
+//to the table by insert_batch.
+struct load_batch {
+    void* keys[LOAD_BATCH_PAIRS];
+    size_t key_lengths[LOAD_BATCH_PAIRS];
+    void* values[LOAD_BATCH_PAIRS];
+    size_t value_lengths[LOAD_BATCH_PAIRS];
+    size_t count;
+    //set when stored keys take the value of later records.
+    unsigned char replace;
+    //set once a record failed to be added.
+    unsigned char failed;
+};
+
+//Add the records waiting in batch to h_table.
+static void flush_load_batch(struct hash_table* h_table, struct load_batch* batch) {
+    size_t duplicates = 0;
+
+    if (!insert_batch(h_table, batch->keys, batch->key_lengths, batch->values, batch->value_lengths,
+                      batch->count, batch->replace, &duplicates)) {
+        batch->failed = 1;
+    }
+    batch->count = 0;
+}
+
+//Parse the records in length bytes, adding them to batch and
+//adding full batches to h_table. A record is a line holding a
+//key, the delimiter and a value, or only a key, whose value is
+//then empty. Carriage returns ending lines and empty lines are
+//skipped. When final isn't set, a last line without a line feed
+//is left for the next call, since more of it may follow.
+//Returns the number of bytes parsed.
+static size_t parse_records(struct hash_table* h_table, struct load_batch* batch, unsigned char* bytes,
+                            size_t length, char delimiter, unsigned char final) {
+    unsigned char* position = bytes;
+    unsigned char* end = bytes + length;
+
+    while (position < end) {
+        unsigned char* line_end = memchr(position, '\n', (size_t)(end - position));
+        unsigned char* next = end;
+
+        if (line_end != NULL) {
+            next = line_end + 1;
+        } else if (!final) {
+            break;
+        } else {
+            line_end = end;
+        }
+        unsigned char* record_end = line_end;
+
+        if (record_end > position && record_end[-1] == '\r') {
+            record_end--;
+        }
+
+        if (record_end > position) {
+            unsigned char* key_end = memchr(position, (unsigned char)delimiter, (size_t)(record_end - position));
+            unsigned char* value = key_end != NULL ? key_end + 1 : record_end;
+            key_end = key_end != NULL ? key_end : record_end;
+            batch->keys[batch->count] = position;
+            batch->key_lengths[batch->count] = (size_t)(key_end - position);
+            batch->values[batch->count] = value;
+            batch->value_lengths[batch->count] = (size_t)(record_end - value);
+            batch->count++;
+
+            if (batch->count == LOAD_BATCH_PAIRS) {
+                flush_load_batch(h_table, batch);
+            }
+        }
+        position = next;
+    }
+    return (size_t)(position - bytes);
+}
+
+//Returns the number of bytes left in stream, or 0
+//when that isn't known, such as for pipes.
+static size_t stream_remaining_size(FILE* stream) {
+    long position = ftell(stream);
+
+    if (position < 0 || fseek(stream, 0, SEEK_END) != 0) {
+        return 0;
+    }
+    long end = ftell(stream);
+
+    if (fseek(stream, position, SEEK_SET) != 0 || end < position) {
+        return 0;
+    }
+    return (size_t)(end - position);
+}
+
+//Map the file stream reads from into memory. The part not yet
+//read starts offset bytes into the image returned.
+//Returns NULL when the stream isn't a file that can be mapped.
+static unsigned char* map_stream(FILE* stream, size_t* size, size_t* offset) {
+#ifdef WC_HT_USE_MMAP
+    struct stat file_status;
+    long position = ftell(stream);
+
+    if (position < 0 || fstat(fileno(stream), &file_status) != 0 || !S_ISREG(file_status.st_mode) ||
+        file_status.st_size <= (off_t)position) {
+        return NULL;
+    }
+    void* image = mmap(NULL, (size_t)file_status.st_size, PROT_READ, MAP_PRIVATE, fileno(stream), 0);
+
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)file_status.st_size;
+    *offset = (size_t)position;
+    return image;
+#else
+    (void)stream;
+    (void)size;
+    (void)offset;
+    return NULL;
+#endif
+}
+
+//Read the rest of stream into one allocation.
+//Returns NULL on failure.
+static unsigned char* read_stream(FILE* stream, size_t* size) {
+    size_t capacity = stream_remaining_size(stream) + 1;
+    size_t length = 0;
+    unsigned char* bytes = malloc(capacity);
+
+    while (bytes != NULL) {
+        length += fread(bytes + length, 1, capacity - length, stream);
+
+        if (length < capacity) {
+            break;
+        }
+        //Filled the allocation, there may be more.
+        unsigned char* grown = capacity <= SIZE_MAX / 2 ? realloc(bytes, capacity * 2) : NULL;
+
+        if (grown == NULL) {
+            free(bytes);
+        }
+        bytes = grown;
+        capacity *= 2;
+    }
+
+    if (bytes == NULL || ferror(stream)) {
+        free(bytes);
+        fprintf(stderr, "Error. Unable to read the stream passed to hash_table_load_stream.\n");
+        return NULL;
+    }
+    *size = length;
+    return bytes;
+}
+
+//Returns the number of records in the length bytes
+//passed, counting the lines they hold.
+static size_t count_records(const unsigned char* bytes, size_t length) {
+    size_t records = 0;
+    const unsigned char* end = bytes + length;
+
+    for (const unsigned char* position = bytes; position < end; records++) {
+        const unsigned char* line_end = memchr(position, '\n', (size_t)(end - position));
+
+        if (line_end == NULL) {
+            records++;
+            break;
+        }
+        position = line_end + 1;
+    }
+    return records;
+}
+
+//Load the records of a whole image into h_table,
+//growing it to fit them first.
+static void load_image(struct hash_table* h_table, struct load_batch* batch, unsigned char* bytes,
+                       size_t length, char delimiter) {
+    size_t records = count_records(bytes, length);
+    //Reserve only fails for counts the table can't hold,
+    //leaving the table to grow as records are added.
+    if (records <= SIZE_MAX - h_table->elements_stored) {
+        hash_table_reserve(h_table, h_table->elements_stored + records);
+    }
+    parse_records(h_table, batch, bytes, length, delimiter, 1);
+}
+
+//Load the records of stream into h_table a block at a time,
+//keeping a line split between blocks for the next one.
+//Returns 1 on success, 0 on failure.
+static unsigned char load_blocks(struct hash_table* h_table, struct load_batch* batch, FILE* stream,
+                                 char delimiter) {
+    size_t remaining_size = stream_remaining_size(stream);
+    size_t capacity = LOAD_BLOCK_SIZE;
+    unsigned char* block = malloc(capacity);
+    size_t length = 0;
+    unsigned char presized = 0;
+
+    if (block == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+
+    for (;;) {
+        size_t read = fread(block + length, 1, capacity - length, stream);
+        length += read;
+        unsigned char final = read == 0;
+
+        if (final && ferror(stream)) {
+            fprintf(stderr, "Error. Unable to read the stream passed to hash_table_load_stream.\n");
+            free(block);
+            return 0;
+        }
+        //Estimate the stream's records from the
+        //length of the lines in its first block.
+        if (!presized && remaining_size > 0) {
+            size_t sampled = count_records(block, length);
+            double records = (double)remaining_size * (double)sampled / (double)length;
+
+            if (records < (double)(SIZE_MAX - h_table->elements_stored)) {
+                hash_table_reserve(h_table, h_table->elements_stored + (size_t)records);
+            }
+            presized = 1;
+        }
+        size_t parsed = parse_records(h_table, batch, block, length, delimiter, final);
+        //Add what points into the block before it is overwritten.
+        flush_load_batch(h_table, batch);
+
+        if (final) {
+            break;
+        }
+        //Move the unparsed part of a line to the start
+        //of the block, growing it for lines too long to fit.
+        length -= parsed;
+        memmove(block, block + parsed, length);
+
+        if (length == capacity) {
+            unsigned char* grown = capacity <= SIZE_MAX / 2 ? realloc(block, capacity * 2) : NULL;
+
+            if (grown == NULL) {
+                fprintf(stderr, "Error. System out of memory.\n");
+                free(block);
+                return 0;
+            }
+            block = grown;
+            capacity *= 2;
+        }
+    }
+    free(block);
+    return 1;
+}
+
+//Give a borrowing table an arena when it has none, so the
+//elements of borrowed records are carved out of its chunks
+//instead of allocated one by one. A table that already has an
+//arena keeps it. Elements the table already holds are moved
+//into the new arena, since removing them later hands them back
+//to it. The table keeps the arena once the load is done.
+//Returns 1 on success, 0 on failure.
+static unsigned char use_arena_for_borrowed(struct hash_table* h_table) {
+    if (h_table->arena != NULL) {
+        return 1;
+    }
+    //Every borrowed element takes a block of the same size.
+    size_t block_size = (size_t)1 << arena_size_class(element_size(1, 0, 0));
+    size_t stored_bytes = h_table->elements_stored * block_size;
+    struct element_arena* arena = arena_new(stored_bytes > ARENA_DEFAULT_CHUNK_SIZE ? stored_bytes :
+                                                                                     ARENA_DEFAULT_CHUNK_SIZE);
+
+    if (arena == NULL) {
+        return 0;
+    }
+    //Allocate a first chunk every stored element fits
+    //in, so moving them can't fail part way through.
+    void* first_block = arena_allocate(arena, block_size);
+
+    if (first_block == NULL) {
+        arena_free(arena);
+        return 0;
+    }
+    arena_release(arena, first_block, block_size);
+    arena->chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+    struct slot_array* arrays[2] = {&h_table->table, &h_table->old_table};
+
+    for (size_t a = 0; a < 2; a++) {
+        struct slot_array* array = arrays[a];
+
+        for (size_t i = 0; array->control != NULL && i < array->length; i++) {
+            struct table_slot* slot = &array->slots[i];
+
+            if (!slot_is_full(array, i) || slot_tag(slot) != SLOT_TAG_ELEMENT) {
+                continue;
+            }
+            struct table_element* element = arena_allocate(arena, block_size);
+            memcpy(element, slot->key.element, element_size(1, 0, 0));
+            free(slot->key.element);
+            slot->key.element = element;
+        }
+    }
+    h_table->arena = arena;
+    return 1;
+}
+
+/* Public HashTable functions */
+
+//Constants used by the default hash function.
+static const uint64_t default_hash_primes[4] = {
+    0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL
+};
+
+//Multiply a and b into a 128 bit product, returning
+//the low 64 bits in a and the high 64 bits in b.
+static inline void multiply_128(uint64_t* a, uint64_t* b) {
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)*a * *b;
+    *a = (uint64_t)product;
+    *b = (uint64_t)(product >> 64);
+#else
+    uint64_t a_high = *a >> 32, a_low = (uint32_t)*a;
+    uint64_t b_high = *b >> 32, b_low = (uint32_t)*b;
+    uint64_t high_high = a_high * b_high, high_low = a_high * b_low;
+    uint64_t low_high = a_low * b_high, low_low = a_low * b_low;
+    uint64_t middle = high_low + (low_low >> 32) + (uint32_t)low_high;
+    *a = (middle << 32) | (uint32_t)low_low;
+    *b = high_high + (middle >> 32) + (low_high >> 32);
+#endif
+}
+
+//Multiply a and b, folding the 128 bit product to 64 bits.
+static inline uint64_t multiply_mix(uint64_t a, uint64_t b) {
+    multiply_128(&a, &b);
+    return a ^ b;
+}
+
+//Read 8 bytes starting at bytes.
+static inline uint64_t read_64(const unsigned char* bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+//Read 4 bytes starting at bytes.
+static inline uint64_t read_32(const unsigned char* bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+//Default hash function. A 64 bit multiply-mix hash
+//in the style of wyhash that consumes keys 16 or 48
+//bytes per step.
+uint64_t hash_table_hash_default(const void* key, size_t key_length, uint64_t seed) {
+    const unsigned char* bytes = key;
+    const uint64_t* primes = default_hash_primes;
+    uint64_t a, b;
+    seed ^= multiply_mix(seed ^ primes[0], primes[1]);
+
+    if (key_length <= 16) {
+        if (key_length >= 4) {
+            //Read the first and last 4 bytes, and the 4 bytes
+            //a quarter of the way in from each end.
+            size_t quarter = (key_length >> 3) << 2;
+            a = (read_32(bytes) << 32) | read_32(bytes + quarter);
+            b = (read_32(bytes + key_length - 4) << 32) | read_32(bytes + key_length - 4 - quarter);
+        } else if (key_length > 0) {
+            a = ((uint64_t)bytes[0] << 16) | ((uint64_t)bytes[key_length >> 1] << 8) |
+                bytes[key_length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t remaining = key_length;
+        //Long keys are consumed 48 bytes at a time
+        //over three independent lanes.
+        if (remaining > 48) {
+            uint64_t lane_one = seed, lane_two = seed;
+
+            do {
+                seed = multiply_mix(read_64(bytes) ^ primes[1], read_64(bytes + 8) ^ seed);
+                lane_one = multiply_mix(read_64(bytes + 16) ^ primes[2], read_64(bytes + 24) ^ lane_one);
+                lane_two = multiply_mix(read_64(bytes + 32) ^ primes[3], read_64(bytes + 40) ^ lane_two);
+                bytes += 48;
+                remaining -= 48;
+            } while (remaining > 48);
+            seed ^= lane_one ^ lane_two;
+        }
+
+        while (remaining > 16) {
+            seed = multiply_mix(read_64(bytes) ^ primes[1], read_64(bytes + 8) ^ seed);
+            bytes += 16;
+            remaining -= 16;
+        }
+        //The last 16 bytes of the key.
+        a = read_64(bytes + remaining - 16);
+        b = read_64(bytes + remaining - 8);
+    }
+    a ^= primes[1];
+    b ^= seed;
+    multiply_128(&a, &b);
+    return multiply_mix(a ^ primes[0] ^ key_length, b ^ primes[1]);
+}
+
+//djb2 hash function. The seed is added to djb2's
+//initial value, so a seed of 0 gives the classic djb2.
+uint64_t hash_table_hash_djb2(const void* key, size_t key_length, uint64_t seed) {
+    const unsigned char* str = key;
+    //Initial hash value
+    uint64_t hash = 5381 + seed;
+
+    for (size_t i = 0; i < key_length; i++) {
+        hash = ((hash << 5) + hash) + str[i];
+    }
+    return hash;
+}
+
+//Fill the passed options with the defaults
+//used by hash_table_new.
+void hash_table_options_init(struct hash_table_options* options) {
+    if (options == NULL) {
+        fprintf(stderr, "Error. NULL options passed to hash_table_options_init.\n");
+        return;
+    }
+    options->hash_function = NULL;
+    options->seed = 0;
+    options->randomize_seed = 0;
+    options->initial_capacity = 0;
+    options->use_arena = 0;
+    options->arena_chunk_size = 0;
+    options->incremental_resize = 0;
+    options->probing = HASH_TABLE_PROBING_GROUPS;
+    options->max_load_factor = DEFAULT_MAX_LOAD_FACTOR;
+    options->borrow_keys_values = 0;
+    options->key_free = NULL;
+    options->value_free = NULL;
+    options->bloom_filter_bits = 0;
+}
+
+//Create a new hash table. Returns a
+//pointer to a new hash table on success.
+//Returns NULL on failure.
+struct hash_table* hash_table_new(void) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    return hash_table_create(&options);
+}
+
+//Create a new hash table whose elements are allocated
+//out of an arena of chunk_size byte chunks.
+//Passing 0 for chunk_size uses a default chunk size.
+//Returns NULL on failure.
+struct hash_table* hash_table_new_with_arena(size_t chunk_size) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.use_arena = 1;
+    options.arena_chunk_size = chunk_size;
+    return hash_table_create(&options);
+}
+
+//Create a new hash table able to store capacity
+//elements before it has to resize.
+//Returns NULL on failure.
+struct hash_table* hash_table_new_with_capacity(size_t capacity) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.initial_capacity = capacity;
+    return hash_table_create(&options);
+}
+
+//Create a new hash table configured by the passed options.
+//Returns NULL on failure.
+struct hash_table* hash_table_new_with_options(const struct hash_table_options* options) {
+    if (options == NULL) {
+        fprintf(stderr, "Error. NULL options passed to hash_table_new_with_options.\n");
+        return NULL;
+    }
+    return hash_table_create(options);
+}
+
+//free a passed hash_table from memory.
+void hash_table_free(struct hash_table* h_table) {
+    //Make sure that the passed hash table actually exists.
+    if (h_table == NULL) {
+        fprintf(stderr, "Error. Attempting to free a NULL hash table.\n");
+        return;
+    }
+    //Make sure the table's slots exist.
+    if (h_table->table.control == NULL) {
+        free(h_table);
+        fprintf(stderr, "Error. Hashtable is corrupt.\n");
+        return;
+    }
+    //Snapshot tables own nothing but their image.
+    if (h_table->snapshot != NULL) {
+        release_image(h_table->snapshot, h_table->snapshot_size, h_table->snapshot_mapped);
+        free(h_table);
+        return;
+    }
+    //go through each slot in the hash table, and
+    //free every used element (not deleted or empty).
+    //Arena backed tables release all of their elements
+    //at once by freeing the arena's chunks, unless
+    //borrowed keys and values have to be freed one by one.
+    if (h_table->arena == NULL || table_frees_borrowed(h_table)) {
+        free_slot_array_elements(h_table, &h_table->table);
+
+        if (h_table->old_table.control != NULL) {
+            free_slot_array_elements(h_table, &h_table->old_table);
+        }
+    }
+
+    if (h_table->arena != NULL) {
+        arena_free(h_table->arena);
+    }
+    //Release the streams borrowed elements pointed into.
+    while (h_table->loaded_images != NULL) {
+        struct loaded_image* image = h_table->loaded_images;
+        h_table->loaded_images = image->next;
+        release_image(image->bytes, image->size, image->mapped);
+        free(image);
+    }
+    //free the table stored in the hash table
+    //now that all the allocated elements are freed.
+    free_slot_array(&h_table->table);
+    free_slot_array(&h_table->old_table);
+    //free the hash table itself, now that all of
+    //it's dynamically allocated internals are freed.
+    free(h_table);
+}
+
+//remove every element stored in the hash table, keeping
+//the table's current size. Arena backed tables keep
+//their chunks so they can be refilled without going
+//back to the system allocator.
+void hash_table_clear(struct hash_table* h_table) {
+    //Make sure that the passed hash table actually exists.
+    if (h_table == NULL || h_table->table.control == NULL) {
+        fprintf(stderr, "Error. Attempting to clear a NULL or corrupt hash table.\n");
+        return;
+    }
+
+    if (is_snapshot(h_table, "hash_table_clear")) {
+        return;
+    }
+    //Elements of arena backed tables are released
+    //together when the arena is reset.
+    if (h_table->arena == NULL || table_frees_borrowed(h_table)) {
+        free_slot_array_elements(h_table, &h_table->table);
+
+        if (h_table->old_table.control != NULL) {
+            free_slot_array_elements(h_table, &h_table->old_table);
+        }
+    }
+    //Drop any incremental resize in progress, everything
+    //it still had to move has been freed.
+    free_slot_array(&h_table->old_table);
+    memset(h_table->table.control, h_table->robin_hood ? ROBIN_HOOD_EMPTY : CTRL_EMPTY,
+           h_table->table.length + GROUP_WIDTH - 1);
+    h_table->table.tombstones = 0;
+
+    if (h_table->table.bloom != NULL) {
+        memset(h_table->table.bloom, 0, h_table->table.bloom_blocks * BLOOM_BLOCK_BYTES);
+        h_table->table.bloom_removals = 0;
+    }
+
+    if (h_table->arena != NULL) {
+        arena_reset(h_table->arena);
+    }
+    h_table->elements_stored = 0;
+}
+
+//Grow the hash table so that it can store capacity
+//elements before it has to resize again.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_reserve(struct hash_table* h_table, size_t capacity) {
+    //Make sure that the passed hash table actually exists.
+    if (h_table == NULL) {
+        fprintf(stderr, "Error. NULL h_table passed to hash_table_reserve.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_reserve")) {
+        return 0;
+    }
+    if (!grow_table(h_table, capacity, "hash_table_reserve")) {
+        return 0;
+    }
+    //The caller is about to fill the table, so move every
+    //element now rather than during the adds that follow.
+    finish_migration(h_table);
+    return 1;
+}
+
+//Shrink the hash table to the smallest size able to store
+//the elements it holds, giving the rest of its slot memory
+//back to the system. Deleted slots are dropped along the way.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_shrink_to_fit(struct hash_table* h_table) {
+    //Make sure that the passed hash table actually exists.
+    if (h_table == NULL) {
+        fprintf(stderr, "Error. NULL h_table passed to hash_table_shrink_to_fit.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_shrink_to_fit")) {
+        return 0;
+    }
+    size_t required_length = table_length_for_capacity(h_table->max_load_factor,
+                                                       h_table->elements_stored);
+    //The table is already as small as it can be.
+    if (required_length >= h_table->table.length) {
+        return 1;
+    }
+
+    if (!resize_table(h_table, required_length)) {
+        return 0;
+    }
+    finish_migration(h_table);
+    return 1;
+}
+
+//Add the passed value to the hash table accessable by the
+//key passed.
+//values and keys will be copied into memory managed by the
+//hash table, unless the table borrows them.
+//function will return 1 on success, 0 on failure or when
+//the key is already stored, leaving its value unchanged.
+unsigned char hash_table_add(struct hash_table* h_table, void* key, size_t key_length,
+                             void* value, size_t value_length) {
+    //Make sure that parameters passed exist.
+    if (h_table == NULL || key == NULL || value == NULL) {
+        fprintf(stderr, "Error. NULL h_table, key or value passed to hash_table_add.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_add")) {
+        return 0;
+    }
+    struct slot_array* slot_array;
+    size_t slot_index;
+    //Only add the key when it isn't stored yet.
+    return find_or_insert_slot(h_table, hash_key(h_table, key, key_length), key, key_length,
+                               value, value_length, &slot_array, &slot_index) == SLOT_INSERTED;
+}
+
+//Add the passed value at the key passed, whose hash
+//is key_hash, as hash_table_add does.
+//function will return 1 on success, 0 on failure or when
+//the key is already stored, leaving its value unchanged.
+unsigned char hash_table_add_hashed(struct hash_table* h_table, void* key, size_t key_length,
+                                    void* value, size_t value_length, uint64_t key_hash) {
+    //Make sure that parameters passed exist.
+    if (h_table == NULL || key == NULL || value == NULL) {
+        fprintf(stderr, "Error. NULL h_table, key or value passed to hash_table_add_hashed.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_add_hashed")) {
+        return 0;
+    }
+    struct slot_array* slot_array;
+    size_t slot_index;
+    return find_or_insert_slot(h_table, key_hash, key, key_length, value, value_length,
+                               &slot_array, &slot_index) == SLOT_INSERTED;
+}
+
+//Store the passed value at key, replacing the value already
+//stored there, in one probe of the table.
+//inserted, when not NULL, is set to 1 when the key was added.
+//Returns a pointer to the stored value, valid until the table
+//is next used, or NULL on failure.
+void* hash_table_upsert(struct hash_table* h_table, void* key, size_t key_length,
+                        void* value, size_t value_length, unsigned char* inserted) {
+    return upsert(h_table, key, key_length, value, value_length, inserted, 1);
+}
+
+//Returns a pointer to the value stored at key, first adding
+//the passed value there when the key isn't stored, in one
+//probe of the table.
+//inserted, when not NULL, is set to 1 when the key was added.
+//The pointer is valid until the table is next used.
+//Returns NULL on failure.
+void* hash_table_get_or_insert(struct hash_table* h_table, void* key, size_t key_length,
+                               void* value, size_t value_length, unsigned char* inserted) {
+    return upsert(h_table, key, key_length, value, value_length, inserted, 0);
+}
+
+//removes the value stored at the key passed in the hash table
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_remove(struct hash_table* h_table, void* key, size_t key_length) {
+    //Make sure that parameters passed exist.
+    if (h_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. Either NULL h_table or NULL key passed to "
+                        "hash_table_remove.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_remove")) {
+        return 0;
+    }
+    //Move part of an in progress incremental resize along.
+    migrate_slots(h_table, MIGRATION_SLOTS_PER_OPERATION);
+    //Get the slot at the key passed.
+    struct slot_array* slot_array;
+    size_t slot_index;
+    struct table_slot* slot = get_slot(h_table, hash_key(h_table, key, key_length), key, key_length,
+                                       &slot_array, &slot_index);
+    //Check if the get_slot found
+    //the element at the key successfully.
+    if (slot == NULL) {
+        return 0;
+    }
+    //Keep what the slot holds, erasing it
+    //may move other slots into its place.
+    struct table_slot slot_to_remove = *slot;
+    //Erase the element's slot in h_table.
+    erase_slot(slot_array, slot_index);
+    bloom_count_removal(h_table, slot_array);
+    //free the element
+    free_slot(h_table, &slot_to_remove);
+    //Update the count of stored items
+    h_table->elements_stored--;
+    //element was removed successfully.
+    return 1;
+}
+
+//returns the value stored at the key passed.
+//will return NULL if there is nothing stored at the key passed.
+struct hash_table_key_value hash_table_get(struct hash_table* h_table, void* key, size_t key_length) {
+    //Initialize value_to_return
+    struct hash_table_key_value value_to_return;
+    //Initialize key and key length
+    //to sane defaults.
+    value_to_return.key = NULL;
+    value_to_return.key_length = 0;
+    //Initialize value and value length
+    //to sane defaults.
+    value_to_return.value = NULL;
+    value_to_return.value_length = 0;
+    //Make sure that the parameters passed exist
+    if (h_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. either NULL key or table passed to hash_table_get.\n");
+        return value_to_return;
+    }
+    return hash_table_get_hashed(h_table, key, key_length, hash_key(h_table, key, key_length));
+}
+
+//returns the value stored at the key passed, whose hash
+//is key_hash, as hash_table_get does.
+struct hash_table_key_value hash_table_get_hashed(struct hash_table* h_table, void* key, size_t key_length,
+                                                  uint64_t key_hash) {
+    struct hash_table_key_value value_to_return;
+    value_to_return.key = NULL;
+    value_to_return.key_length = 0;
+    value_to_return.value = NULL;
+    value_to_return.value_length = 0;
+    //Make sure that the parameters passed exist
+    if (h_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. either NULL key or table passed to hash_table_get_hashed.\n");
+        return value_to_return;
+    }
+    //Move part of an in progress incremental resize along.
+    migrate_slots(h_table, MIGRATION_SLOTS_PER_OPERATION);
+    //slot array and index for passing to get_slot
+    struct slot_array* slot_array;
+    size_t slot_index;
+    struct table_slot* slot = get_slot(h_table, key_hash, key, key_length, &slot_array, &slot_index);
+    //If the element wasn't found.
+    if (slot == NULL) {
+        return value_to_return;
+    }
+    //Set the values passed into the key and 
+    //key length fields of value_to_return
+    value_to_return.key = key;
+    value_to_return.key_length = key_length;
+    //Set the values in value_to_return to
+    //reflect the values in the slot.
+    value_to_return.value = slot_value(slot_array, slot);
+    value_to_return.value_length = slot_value_length(slot_array, slot);
+    return value_to_return;
+}
+
+//Look up count keys at once, storing what hash_table_get
+//would return for keys[i] in results[i].
+//Keys are worked through BATCH_WIDTH at a time: all of them are
+//hashed and their slots and elements prefetched before any probe
+//is resolved, so the cache misses of different keys overlap.
+void hash_table_get_batch(struct hash_table* h_table, void* const keys[], const size_t key_lengths[],
+                          size_t count, struct hash_table_key_value results[]) {
+    //Make sure that the parameters passed exist
+    if (h_table == NULL || keys == NULL || key_lengths == NULL || results == NULL) {
+        fprintf(stderr, "Error. NULL table, keys, key_lengths or results "
+                        "passed to hash_table_get_batch.\n");
+        return;
+    }
+    //Move part of an in progress incremental resize along.
+    //Only the table's slots are prefetched, keys not moved
+    //yet are looked up in the old table on a miss.
+    migrate_slots(h_table, MIGRATION_SLOTS_PER_OPERATION);
+    struct slot_array* array = &h_table->table;
+    uint64_t hashes[BATCH_WIDTH];
+    size_t candidates[BATCH_WIDTH];
+
+    for (size_t start = 0; start < count; start += BATCH_WIDTH) {
+        size_t width = count - start < BATCH_WIDTH ? count - start : BATCH_WIDTH;
+        //Hash every key, and prefetch the control
+        //bytes its probe starts at.
+        for (size_t i = 0; i < width; i++) {
+            if (keys[start + i] == NULL) {
+                continue;
+            }
+            hashes[i] = hash_key(h_table, keys[start + i], key_lengths[start + i]);
+            prefetch(array->control + (hash_position(hashes[i]) & (array->length - 1)));
+
+            if (array->bloom != NULL) {
+                prefetch(bloom_block(array, hashes[i]));
+            }
+        }
+        //Prefetch the first slot each key may be in,
+        //skipping keys the Bloom filter rules out.
+        for (size_t i = 0; i < width; i++) {
+            candidates[i] = SLOT_NOT_FOUND;
+
+            if (keys[start + i] == NULL || !bloom_may_contain(array, hashes[i])) {
+                continue;
+            }
+            candidates[i] = batch_candidate_slot(array, hashes[i]);
+
+            if (candidates[i] != SLOT_NOT_FOUND) {
+                prefetch(&array->slots[candidates[i]]);
+            }
+        }
+        //Prefetch the elements those slots point to
+        //when their cached hash matches the key's.
+        for (size_t i = 0; i < width; i++) {
+            if (candidates[i] == SLOT_NOT_FOUND) {
+                continue;
+            }
+            struct table_slot* candidate = &array->slots[candidates[i]];
+
+            if (slot_tag(candidate) == SLOT_TAG_ELEMENT && candidate->value.hash == hashes[i]) {
+                prefetch(slot_element(array, candidate));
+            }
+        }
+        //Resolve every probe, now that what
+        //it reads is on its way to the cache.
+        for (size_t i = 0; i < width; i++) {
+            struct hash_table_key_value* result = &results[start + i];
+            result->key = NULL;
+            result->key_length = 0;
+            result->value = NULL;
+            result->value_length = 0;
+
+            if (keys[start + i] == NULL) {
+                continue;
+            }
+            struct lookup_key lookup;
+            make_lookup_key(&lookup, keys[start + i], key_lengths[start + i]);
+            struct slot_array* found_array = array;
+            size_t index = find_slot(array, hashes[i], &lookup);
+            //Elements not moved yet by an incremental
+            //resize are still in the old table.
+            if (index == SLOT_NOT_FOUND && h_table->old_table.control != NULL) {
+                found_array = &h_table->old_table;
+                index = find_slot(found_array, hashes[i], &lookup);
+            }
+
+            if (index == SLOT_NOT_FOUND) {
+                COUNT_OPERATION(h_table->misses);
+                continue;
+            }
+            COUNT_OPERATION(h_table->hits);
+            struct table_slot* slot = &found_array->slots[index];
+            result->key = keys[start + i];
+            result->key_length = key_lengths[start + i];
+            result->value = slot_value(found_array, slot);
+            result->value_length = slot_value_length(found_array, slot);
+        }
+    }
+}
+
+//Add count key value pairs at once, as calling hash_table_add
+//for keys[i] and values[i] in order would.
+//The table is grown to fit every pair up front, then the pairs
+//are added by insert_batch.
+//function will return 1 when every pair was added, 0 when
+//one failed or its key was already stored.
+unsigned char hash_table_add_batch(struct hash_table* h_table, void* const keys[], const size_t key_lengths[],
+                                   void* const values[], const size_t value_lengths[], size_t count) {
+    //Make sure that the parameters passed exist
+    if (h_table == NULL || keys == NULL || key_lengths == NULL ||
+        values == NULL || value_lengths == NULL) {
+        fprintf(stderr, "Error. NULL table, keys, key_lengths, values or value_lengths "
+                        "passed to hash_table_add_batch.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_add_batch")) {
+        return 0;
+    }
+    //Grow once, rather than part way through the batch. An
+    //incremental resize this starts is moved along a few slots
+    //per pair by insert_batch, like any other add would.
+    if (count > SIZE_MAX - h_table->elements_stored ||
+        !grow_table(h_table, h_table->elements_stored + count, "hash_table_add_batch")) {
+        return 0;
+    }
+    size_t duplicates = 0;
+    unsigned char success = insert_batch(h_table, keys, key_lengths, values, value_lengths, count,
+                                         0, &duplicates);
+    return success && duplicates == 0;
+}
+
+//Add every (key, value) pair of source to destination, growing
+//destination once to fit them. Keys stored in both tables are
+//combined into destination's value, or given source's value
+//when combine is NULL. Tables with the same hash function and
+//seed reuse the hashes source's slots cache.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_merge(struct hash_table* destination, struct hash_table* source,
+                               hash_table_combine_function combine) {
+    //Make sure that the parameters passed exist
+    if (destination == NULL || source == NULL || destination == source) {
+        fprintf(stderr, "Error. NULL or identical tables passed to hash_table_merge.\n");
+        return 0;
+    }
+
+    if (is_snapshot(destination, "hash_table_merge")) {
+        return 0;
+    }
+    //A borrowing destination would point into memory source
+    //owns, source's free functions would free what the
+    //destination then points to, and destination's would free
+    //source's keys and values, or those it replaces.
+    if ((destination->borrowed && !source->borrowed) || table_frees_borrowed(source) ||
+        table_frees_borrowed(destination)) {
+        fprintf(stderr, "Error. hash_table_merge can't borrow from a table that copies or frees "
+                        "its keys and values, or into one that frees them.\n");
+        return 0;
+    }
+    //Grow once, rather than part way through the merge.
+    if (source->elements_stored > SIZE_MAX - destination->elements_stored ||
+        !hash_table_reserve(destination, destination->elements_stored + source->elements_stored)) {
+        return 0;
+    }
+    finish_migration(destination);
+    unsigned char same_hash = destination->hash_function == source->hash_function &&
+                              destination->seed == source->seed;
+    unsigned char success = 1;
+
+    for (size_t a = 0; a < 2; a++) {
+        struct slot_array* array = a == 0 ? &source->table : &source->old_table;
+
+        if (array->control == NULL) {
+            continue;
+        }
+
+        for (size_t i = 0; i < array->length; i++) {
+            if (!slot_is_full(array, i)) {
+                continue;
+            }
+            struct table_slot* slot = &array->slots[i];
+            void* key = slot_key(array, slot);
+            size_t key_length = slot_key_length(array, slot);
+            void* value = slot_value(array, slot);
+            size_t value_length = slot_value_length(array, slot);
+            uint64_t key_hash = same_hash ? slot_hash(array, slot) : hash_key(destination, key, key_length);
+            struct slot_array* found_array;
+            size_t found_index;
+            unsigned char outcome = find_or_insert_slot(destination, key_hash, key, key_length, value,
+                                                        value_length, &found_array, &found_index);
+
+            if (outcome != SLOT_FOUND) {
+                success &= outcome == SLOT_INSERTED;
+                continue;
+            }
+            struct table_slot* found = &found_array->slots[found_index];
+
+            if (combine == NULL) {
+                success &= replace_slot_value(destination, found_array, found, key_hash, value, value_length);
+            } else {
+                success &= combine(slot_value(found_array, found), slot_value_length(found_array, found),
+                                   value, value_length) != 0;
+            }
+        }
+    }
+    return success;
+}
+
+//Returns the hash h_table gives the passed key, which
+//hash_table_get_hashed and hash_table_add_hashed take.
+uint64_t hash_table_hash(struct hash_table* h_table, const void* key, size_t key_length) {
+    if (h_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. NULL h_table or key passed to hash_table_hash.\n");
+        return 0;
+    }
+    return hash_key(h_table, key, key_length);
+}
+
+//returns the number of elements stored in the hash table
+size_t hash_table_size(struct hash_table* h_table) {
+    //can't have any elements in it then
+    if (h_table == NULL) {
+        return 0;
+    }
+    //Return the size stored in the hash table struct
+    return h_table->elements_stored;
+}
+
+//Returns the mean number of probe steps taken by a lookup
+//of a key that isn't stored in the table, taken over every
+//position a probe sequence can start at. A step is one slot
+//group, or one slot for Robin Hood tables. Grows as deleted
+//slots build up, since those never end a probe.
+double hash_table_mean_miss_probe_length(struct hash_table* h_table) {
+    if (h_table == NULL || h_table->table.control == NULL) {
+        fprintf(stderr, "Error. NULL or corrupt h_table passed to "
+                        "hash_table_mean_miss_probe_length.\n");
+        return 0.0;
+    }
+    struct slot_array* array = &h_table->table;
+    size_t mask = array->length - 1;
+    size_t total_probes = 0;
+
+    for (size_t start = 0; start < array->length; start++) {
+        size_t position = start;
+        size_t probes = 1;
+        //Probe the same way find_slot does until the
+        //sequence ends.
+        if (array->robin_hood) {
+            while ((uint8_t)array->control[position] != ROBIN_HOOD_EMPTY &&
+                   robin_hood_distance(array, position) >= probes - 1 &&
+                   probes < array->length) {
+                position = (position + 1) & mask;
+                probes++;
+            }
+        } else {
+            while (group_match_empty(array->control + position) == 0 &&
+                   probes < array->length / GROUP_WIDTH) {
+                position = (position + probes * GROUP_WIDTH) & mask;
+                probes++;
+            }
+        }
+        total_probes += probes;
+    }
+    return (double)total_probes / (double)array->length;
+}
+
+//Returns the estimated fraction of lookups of missing keys
+//that the table's Bloom filter lets through to the probe.
+//While an incremental resize is in progress a missing key is
+//probed for when either slot array's filter lets it through.
+//Counts every bit of the filters, so it takes time
+//proportional to their size.
+double hash_table_bloom_false_positive_rate(struct hash_table* h_table) {
+    if (h_table == NULL || h_table->table.control == NULL) {
+        fprintf(stderr, "Error. NULL or corrupt h_table passed to "
+                        "hash_table_bloom_false_positive_rate.\n");
+        return 1.0;
+    }
+    double pass_rate = bloom_false_positive_rate(&h_table->table);
+
+    if (h_table->old_table.control != NULL) {
+        double old_pass_rate = bloom_false_positive_rate(&h_table->old_table);
+        pass_rate = 1.0 - (1.0 - pass_rate) * (1.0 - old_pass_rate);
+    }
+    return pass_rate;
+}
+
+//Returns the number of probe steps a lookup takes
+//to find the key of the full slot at index of array.
+static size_t slot_probe_length(struct slot_array* array, size_t index) {
+    if (array->robin_hood) {
+        return robin_hood_distance(array, index) + 1;
+    }
+    size_t mask = array->length - 1;
+    size_t position = hash_position(slot_hash(array, &array->slots[index])) & mask;
+    size_t probes = 1;
+    //Follow the key's probe sequence to the group holding it.
+    while (((index - position) & mask) >= GROUP_WIDTH && probes < array->length / GROUP_WIDTH) {
+        position = (position + probes * GROUP_WIDTH) & mask;
+        probes++;
+    }
+    return probes;
+}
+
+//Add the probe lengths and sizes of the elements
+//stored in array to stats.
+static void add_slot_array_stats(struct slot_array* array, struct hash_table_stats* stats,
+                                 size_t* total_probes, size_t* element_bytes) {
+    stats->slot_count += array->length;
+    stats->tombstones += array->tombstones;
+
+    for (size_t i = 0; i < array->length; i++) {
+        if (!slot_is_full(array, i)) {
+            continue;
+        }
+        struct table_slot* slot = &array->slots[i];
+        size_t probes = slot_probe_length(array, i);
+        *total_probes += probes;
+
+        if (probes > stats->max_probe_length) {
+            stats->max_probe_length = probes;
+        }
+
+        if (probes > HASH_TABLE_PROBE_HISTOGRAM_LENGTH) {
+            probes = HASH_TABLE_PROBE_HISTOGRAM_LENGTH;
+        }
+        stats->probe_length_histogram[probes - 1]++;
+        //Borrowed keys and values aren't the table's memory.
+        if (!array->borrowed) {
+            stats->key_bytes += slot_key_length(array, slot);
+            stats->value_bytes += slot_value_length(array, slot);
+        }
+
+        if (slot_tag(slot) == SLOT_TAG_ELEMENT) {
+            struct table_element* element = slot_element(array, slot);
+            *element_bytes += element_size(array->borrowed, element->key_length, element->value_length);
+        }
+    }
+}
+
+//Fill stats with statistics about h_table. Looks at
+//every slot, so it takes time proportional to the table.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_stats(struct hash_table* h_table, struct hash_table_stats* stats) {
+    //Make sure that the parameters passed exist
+    if (h_table == NULL || h_table->table.control == NULL || stats == NULL) {
+        fprintf(stderr, "Error. NULL or corrupt h_table, or NULL stats passed to hash_table_stats.\n");
+        return 0;
+    }
+    memset(stats, 0, sizeof(struct hash_table_stats));
+    stats->elements_stored = h_table->elements_stored;
+    size_t total_probes = 0;
+    size_t element_bytes = 0;
+    add_slot_array_stats(&h_table->table, stats, &total_probes, &element_bytes);
+
+    if (h_table->old_table.control != NULL) {
+        add_slot_array_stats(&h_table->old_table, stats, &total_probes, &element_bytes);
+    }
+    stats->load_factor = (double)stats->elements_stored / (double)stats->slot_count;
+
+    if (stats->elements_stored > 0) {
+        stats->mean_probe_length = (double)total_probes / (double)stats->elements_stored;
+    }
+    stats->mean_miss_probe_length = hash_table_mean_miss_probe_length(h_table);
+    stats->resize_count = h_table->resize_count;
+    stats->resize_seconds = h_table->resize_seconds;
+    //Everything allocated for the table that isn't
+    //a key or value counts as metadata.
+    size_t allocated_bytes = sizeof(struct hash_table);
+
+    if (h_table->snapshot != NULL) {
+        allocated_bytes += h_table->snapshot_size;
+    } else {
+        allocated_bytes += (sizeof(struct table_slot) + 1) * stats->slot_count + GROUP_WIDTH - 1;
+
+        if (h_table->old_table.control != NULL) {
+            allocated_bytes += GROUP_WIDTH - 1;
+        }
+
+        if (h_table->table.bloom != NULL) {
+            allocated_bytes += (h_table->table.bloom_blocks + 1) * BLOOM_BLOCK_BYTES - 1;
+        }
+
+        if (h_table->old_table.bloom != NULL) {
+            allocated_bytes += (h_table->old_table.bloom_blocks + 1) * BLOOM_BLOCK_BYTES - 1;
+        }
+
+        if (h_table->arena != NULL) {
+            //Arena chunks are allocated whole, used or not.
+            allocated_bytes += sizeof(struct element_arena);
+
+            for (struct arena_chunk* chunk = h_table->arena->chunks; chunk != NULL; chunk = chunk->next) {
+                allocated_bytes += sizeof(struct arena_chunk) + chunk->size;
+            }
+        } else {
+            allocated_bytes += element_bytes;
+        }
+    }
+    stats->metadata_bytes = allocated_bytes - stats->key_bytes - stats->value_bytes;
+#ifdef WC_HT_OP_COUNTERS
+    stats->op_counters_enabled = 1;
+    stats->hits = h_table->hits;
+    stats->misses = h_table->misses;
+    stats->probes = h_table->probes;
+#endif
+    return 1;
+}
+
+/*
+* (Key, Value) iterator
+*/
+struct hash_table_key_value_iterator {
+    //slot array being walked
+    struct slot_array* array;
+    //index of the next slot to look at
+    size_t current_index;
+    //end iteration index, one past the last slot walked
+    size_t max_index;
+};
 
 /*
 * (Key, Value) iterator functions
 */
 
+//Create an iterator over the pairs stored in the passed
+//range of h_table's slots.
+//Returns NULL on failure.
+static struct hash_table_key_value_iterator* create_iterator(struct hash_table* h_table,
+                                                             size_t start_index, size_t end_index) {
+    struct hash_table_key_value_iterator* iterator = malloc(sizeof(struct hash_table_key_value_iterator));
+
+    if (iterator == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    iterator->array = &h_table->table;
+    iterator->current_index = start_index;
+    iterator->max_index = end_index;
+    return iterator;
+}
+
+//Create an iterator over every (key, value) pair in h_table,
+//in the order they are stored in its slots.
+//Returns NULL on failure.
 struct hash_table_key_value_iterator* hash_table_get_iterator(struct hash_table* h_table) {
-    //create a new iterator
-    return NULL;
+    return hash_table_get_partition_iterator(h_table, 0, 1);
+}
+
+//Create an iterator over the pairs stored in part partition of
+//h_table's slots, split into partition_count ranges of nearly
+//equal length.
+//Returns NULL on failure.
+struct hash_table_key_value_iterator* hash_table_get_partition_iterator(struct hash_table* h_table,
+                                                                        size_t partition,
+                                                                        size_t partition_count) {
+    //Make sure that the parameters passed are valid.
+    if (h_table == NULL || partition_count == 0 || partition >= partition_count) {
+        fprintf(stderr, "Error. NULL h_table or invalid partition passed to "
+                        "hash_table_get_partition_iterator.\n");
+        return NULL;
+    }
+    //Gather every element into one slot array,
+    //so there is only one range of slots to walk.
+    finish_migration(h_table);
+    size_t length = h_table->table.length;
+    size_t partition_length = length / partition_count;
+    size_t remainder = length % partition_count;
+    //The first remainder partitions get one extra slot each.
+    size_t start_index = partition * partition_length +
+                         (partition < remainder ? partition : remainder);
+    size_t end_index = start_index + partition_length + (partition < remainder ? 1 : 0);
+    return create_iterator(h_table, start_index, end_index);
+}
+
+//Move the iterator to the next (key, value) pair, storing it in pair.
+//returns 1 when there was a next pair, 0 once the iterator is done.
+unsigned char hash_table_iterator_next(struct hash_table_key_value_iterator* iterator,
+                                       struct hash_table_key_value* pair) {
+    //Make sure that the parameters passed exist
+    if (iterator == NULL || pair == NULL) {
+        fprintf(stderr, "Error. NULL iterator or pair passed to hash_table_iterator_next.\n");
+        return 0;
+    }
+    struct slot_array* array = iterator->array;
+    //Skip over empty and deleted slots.
+    while (iterator->current_index < iterator->max_index) {
+        size_t index = iterator->current_index++;
+
+        if (slot_is_full(array, index)) {
+            struct table_slot* slot = &array->slots[index];
+            pair->key = slot_key(array, slot);
+            pair->key_length = slot_key_length(array, slot);
+            pair->value = slot_value(array, slot);
+            pair->value_length = slot_value_length(array, slot);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+//free a passed iterator from memory.
+void hash_table_iterator_free(struct hash_table_key_value_iterator* iterator) {
+    free(iterator);
+}
+
+//Save h_table to the file at path as a snapshot that
+//hash_table_open_mmap can serve lookups from in place.
+//The file is written next to path and renamed over it once
+//complete, so processes with the old snapshot mapped keep it.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_save(struct hash_table* h_table, const char* path) {
+    //Make sure that the parameters passed exist
+    if (h_table == NULL || path == NULL) {
+        fprintf(stderr, "Error. NULL h_table or path passed to hash_table_save.\n");
+        return 0;
+    }
+    uint32_t hash_id = snapshot_hash_id(h_table->hash_function);
+
+    if (hash_id == 0) {
+        fprintf(stderr, "Error. Only tables using a built in hash function can be saved.\n");
+        return 0;
+    }
+    //Save a single slot array.
+    finish_migration(h_table);
+    struct slot_array* array = &h_table->table;
+    size_t path_length = strlen(path);
+    char* temporary_path = malloc(path_length + sizeof(".tmp"));
+    struct snapshot_writer writer;
+    writer.buffer = malloc(SNAPSHOT_BUFFER_SIZE);
+
+    if (temporary_path == NULL || writer.buffer == NULL) {
+        free(temporary_path);
+        free(writer.buffer);
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+    memcpy(temporary_path, path, path_length);
+    memcpy(temporary_path + path_length, ".tmp", sizeof(".tmp"));
+    writer.file = fopen(temporary_path, "wb");
+
+    if (writer.file == NULL) {
+        free(temporary_path);
+        free(writer.buffer);
+        fprintf(stderr, "Error. Unable to create snapshot %s.\n", path);
+        return 0;
+    }
+    struct snapshot_header header;
+    memset(&header, 0, sizeof(header));
+    //Leave room for the header, which is written last
+    //along with the checksum of everything after it.
+    static const unsigned char header_space[SNAPSHOT_HEADER_SIZE];
+    writer.failed = fwrite(header_space, 1, SNAPSHOT_HEADER_SIZE, writer.file) != SNAPSHOT_HEADER_SIZE;
+    writer.buffered = 0;
+    writer.offset = SNAPSHOT_HEADER_SIZE;
+    writer.checksum = 0;
+    //Control bytes, followed by copies of the first
+    //ones for group loads that run past the last slot.
+    header.control_offset = writer.offset;
+    snapshot_write(&writer, array->control, array->length);
+
+    if (array->robin_hood) {
+        int8_t padding[SNAPSHOT_CONTROL_PADDING];
+        memset(padding, ROBIN_HOOD_EMPTY, sizeof(padding));
+        snapshot_write(&writer, padding, sizeof(padding));
+    } else {
+        snapshot_write(&writer, array->control, SNAPSHOT_CONTROL_PADDING);
+    }
+    snapshot_pad(&writer, SNAPSHOT_ALIGNMENT);
+    //Slots, with each element pointer replaced by the offset
+    //the element is written at after the slots.
+    header.slots_offset = writer.offset;
+    header.elements_offset = align_up(header.slots_offset + (uint64_t)array->length * sizeof(struct table_slot),
+                                      SNAPSHOT_ALIGNMENT);
+    uint64_t element_offset = header.elements_offset;
+
+    for (size_t i = 0; i < array->length; i++) {
+        struct table_slot slot;
+        memset(&slot, 0, sizeof(slot));
+
+        if (slot_is_full(array, i)) {
+            slot = array->slots[i];
+
+            if (slot_tag(&slot) == SLOT_TAG_ELEMENT) {
+                struct table_element* element = slot_element(array, &array->slots[i]);
+                slot.key.element_offset = (uintptr_t)element_offset;
+                element_offset += align_up(element_size(0, element->key_length, element->value_length),
+                                           SNAPSHOT_ELEMENT_ALIGNMENT);
+            }
+        }
+        snapshot_write(&writer, &slot, sizeof(slot));
+    }
+    snapshot_pad(&writer, SNAPSHOT_ALIGNMENT);
+    //Elements, in the order of their slots. Borrowed keys
+    //and values are copied in, so snapshots never borrow.
+    for (size_t i = 0; i < array->length; i++) {
+        struct table_slot* slot = &array->slots[i];
+
+        if (slot_is_full(array, i) && slot_tag(slot) == SLOT_TAG_ELEMENT) {
+            struct table_element* element = slot_element(array, slot);
+            struct table_element element_header;
+            element_header.key_length = element->key_length;
+            element_header.value_length = element->value_length;
+            snapshot_write(&writer, &element_header, sizeof(element_header));
+            snapshot_write(&writer, element_value(element, array->borrowed), element->value_length);
+            snapshot_write(&writer, element_key(element, array->borrowed), element->key_length);
+            snapshot_pad(&writer, SNAPSHOT_ELEMENT_ALIGNMENT);
+        }
+    }
+    snapshot_flush(&writer);
+    free(writer.buffer);
+    //Fill in and write the header.
+    memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+    header.version = SNAPSHOT_VERSION;
+    header.slot_size = sizeof(struct table_slot);
+    header.size_size = sizeof(size_t);
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.hash_id = hash_id;
+    header.robin_hood = array->robin_hood;
+    header.group_width = GROUP_WIDTH;
+    header.seed = h_table->seed;
+    header.length = array->length;
+    header.elements_stored = h_table->elements_stored;
+    header.tombstones = array->tombstones;
+    header.size = writer.offset;
+    header.checksum = writer.checksum;
+    header.header_checksum = snapshot_checksum(0, (const unsigned char*)&header,
+                                               offsetof(struct snapshot_header, header_checksum));
+
+    if (fseek(writer.file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, 1, sizeof(header), writer.file) != sizeof(header)) {
+        writer.failed = 1;
+    }
+
+    if (fclose(writer.file) != 0) {
+        writer.failed = 1;
+    }
+    //Replace any existing snapshot. Systems whose rename won't
+    //replace a file need the old one removed first.
+    if (!writer.failed && rename(temporary_path, path) != 0) {
+        remove(path);
+        writer.failed = rename(temporary_path, path) != 0;
+    }
+
+    if (writer.failed) {
+        remove(temporary_path);
+        free(temporary_path);
+        fprintf(stderr, "Error. Unable to write snapshot %s.\n", path);
+        return 0;
+    }
+    free(temporary_path);
+    return 1;
+}
+
+//Open a snapshot saved by hash_table_save as a read only table.
+//Lookups are served from the mapped file in place, so opening
+//takes the same time however many elements it holds.
+//Returns NULL on failure.
+struct hash_table* hash_table_open_mmap(const char* path) {
+    //Make sure that the path passed exists
+    if (path == NULL) {
+        fprintf(stderr, "Error. NULL path passed to hash_table_open_mmap.\n");
+        return NULL;
+    }
+    size_t size;
+    unsigned char mapped;
+    unsigned char* image = load_snapshot_image(path, &size, &mapped);
+
+    if (image == NULL) {
+        return NULL;
+    }
+    const struct snapshot_header* header = (const struct snapshot_header*)image;
+    struct hash_table* h_table = NULL;
+
+    if (snapshot_header_valid(header, size)) {
+        h_table = malloc(sizeof(struct hash_table));
+
+        if (h_table == NULL) {
+            fprintf(stderr, "Error. System out of memory.\n");
+        }
+    }
+
+    if (h_table == NULL) {
+        release_image(image, size, mapped);
+        return NULL;
+    }
+    memset(h_table, 0, sizeof(struct hash_table));
+    h_table->robin_hood = header->robin_hood != 0;
+    h_table->max_load_factor = DEFAULT_MAX_LOAD_FACTOR;
+    h_table->elements_stored = (size_t)header->elements_stored;
+    h_table->table_capacity = h_table->elements_stored;
+    h_table->hash_function = snapshot_hash_functions[header->hash_id];
+    h_table->seed = header->seed;
+    h_table->snapshot = image;
+    h_table->snapshot_size = size;
+    h_table->snapshot_mapped = mapped;
+    //Point the slot array into the image.
+    struct slot_array* array = &h_table->table;
+    array->control = (int8_t*)(image + header->control_offset);
+    array->slots = (struct table_slot*)(image + header->slots_offset);
+    array->length = (size_t)header->length;
+    array->tombstones = (size_t)header->tombstones;
+    array->robin_hood = h_table->robin_hood;
+    array->hash_function = h_table->hash_function;
+    array->seed = h_table->seed;
+    array->element_base = (uintptr_t)image;
+#ifdef WC_HT_OP_COUNTERS
+    array->probe_counter = &h_table->probes;
+#endif
+    return h_table;
+}
+
+//Check the whole image of a table opened by hash_table_open_mmap
+//against its checksum, and that every element lies within it.
+//Reads every byte, so it takes time proportional to the image.
+//returns 1 when the snapshot is intact, 0 otherwise.
+unsigned char hash_table_snapshot_verify(struct hash_table* h_table) {
+    //Make sure that the table passed is a snapshot
+    if (h_table == NULL || h_table->snapshot == NULL) {
+        fprintf(stderr, "Error. hash_table_snapshot_verify needs a table opened by hash_table_open_mmap.\n");
+        return 0;
+    }
+    const struct snapshot_header* header = (const struct snapshot_header*)h_table->snapshot;
+
+    if (snapshot_checksum(0, h_table->snapshot + SNAPSHOT_HEADER_SIZE,
+                          h_table->snapshot_size - SNAPSHOT_HEADER_SIZE) != header->checksum) {
+        fprintf(stderr, "Error. Snapshot checksum doesn't match.\n");
+        return 0;
+    }
+    struct slot_array* array = &h_table->table;
+    size_t elements = 0;
+
+    for (size_t i = 0; i < array->length; i++) {
+        if (!slot_is_full(array, i)) {
+            continue;
+        }
+        struct table_slot* slot = &array->slots[i];
+        uint8_t tag = slot_tag(slot);
+        elements++;
+
+        if (tag == SLOT_TAG_ELEMENT) {
+            uint64_t offset = slot->key.element_offset;
+            uint64_t space = h_table->snapshot_size - header->elements_offset;
+
+            if (offset < header->elements_offset || offset % SNAPSHOT_ELEMENT_ALIGNMENT != 0 ||
+                offset - header->elements_offset > space ||
+                space - (offset - header->elements_offset) < sizeof(struct table_element)) {
+                fprintf(stderr, "Error. Snapshot element is out of bounds.\n");
+                return 0;
+            }
+            struct table_element* element = slot_element(array, slot);
+            space -= offset - header->elements_offset + sizeof(struct table_element);
+
+            if (element->key_length > space || element->value_length > space - element->key_length) {
+                fprintf(stderr, "Error. Snapshot element is out of bounds.\n");
+                return 0;
+            }
+        } else if ((tag & 0x0F) > INLINE_VALUE_MAX) {
+            //Also catches SLOT_TAG_ERASED, which is never saved.
+            fprintf(stderr, "Error. Snapshot slot is corrupt.\n");
+            return 0;
+        }
+    }
+
+    if (elements != h_table->elements_stored) {
+        fprintf(stderr, "Error. Snapshot element count doesn't match.\n");
+        return 0;
+    }
+    return 1;
+}
+
+//Add every record of stream to h_table, see the header.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_load_stream(struct hash_table* h_table, FILE* stream, char delimiter,
+                                     unsigned int flags) {
+    //Make sure that the parameters passed exist.
+    if (h_table == NULL || stream == NULL) {
+        fprintf(stderr, "Error. NULL h_table or stream passed to hash_table_load_stream.\n");
+        return 0;
+    }
+
+    if (is_snapshot(h_table, "hash_table_load_stream")) {
+        return 0;
+    }
+    unsigned char borrow = (flags & HASH_TABLE_LOAD_BORROW) != 0;
+    //Elements point into an image the table releases
+    //itself, so it can't hand them to free functions.
+    if (borrow && (!h_table->borrowed || table_frees_borrowed(h_table))) {
+        fprintf(stderr, "Error. HASH_TABLE_LOAD_BORROW needs a table created with "
+                        "borrow_keys_values and no key_free or value_free.\n");
+        return 0;
+    }
+    if (borrow && !use_arena_for_borrowed(h_table)) {
+        return 0;
+    }
+    struct load_batch* batch = malloc(sizeof(struct load_batch));
+
+    if (batch == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+    batch->count = 0;
+    batch->replace = (flags & HASH_TABLE_LOAD_REPLACE) != 0;
+    batch->failed = 0;
+    size_t size = 0;
+    size_t offset = 0;
+    unsigned char* image = map_stream(stream, &size, &offset);
+    unsigned char mapped = image != NULL;
+    //Borrowed records need an image that outlives the load.
+    if (image == NULL && borrow) {
+        image = read_stream(stream, &size);
+
+        if (image == NULL) {
+            free(batch);
+            return 0;
+        }
+    }
+
+    if (image == NULL) {
+        batch->failed = !load_blocks(h_table, batch, stream, delimiter);
+    } else {
+        load_image(h_table, batch, image + offset, size - offset, delimiter);
+        flush_load_batch(h_table, batch);
+        //The stream has been read to its end.
+        if (mapped) {
+            fseek(stream, 0, SEEK_END);
+        }
+    }
+
+    if (image != NULL && borrow) {
+        struct loaded_image* loaded = malloc(sizeof(struct loaded_image));
+
+        if (loaded == NULL) {
+            //Elements already point into the image, so it
+            //has to stay, even though it can't be released.
+            fprintf(stderr, "Error. System out of memory.\n");
+            batch->failed = 1;
+        } else {
+            loaded->next = h_table->loaded_images;
+            loaded->bytes = image;
+            loaded->size = size;
+            loaded->mapped = mapped;
+            h_table->loaded_images = loaded;
+        }
+    } else if (image != NULL) {
+        release_image(image, size, mapped);
+    }
+    unsigned char success = !batch->failed;
+    free(batch);
+    return success;
 }
@@ -1,5 +1,8 @@
 #ifndef WC_HASH_TABLE_H
     #define WC_HASH_TABLE_H
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <stdio.h>
     //Struct for returning key, value pairs from the get function.
     //Memory inside the returned value must not be modified.
     //If data returned from get needs to be manipulated,
@@ -18,25 +21,316 @@
     struct hash_table_key_value_iterator;
     //hash table type
     struct hash_table;
+    //Function used to hash keys. Must return the same hash
+    //for equal keys and seeds.
+    typedef uint64_t (*hash_table_hash_function)(const void* key, size_t key_length,
+                                                 uint64_t seed);
+    //Function called on a borrowed key or value
+    //once the hash table is done with it.
+    typedef void (*hash_table_free_function)(void* pointer);
+    //Function combining the values of a key stored in both tables
+    //passed to hash_table_merge. Updates destination_value, the
+    //value stored in the destination table, in place using
+    //source_value. Returns 1 on success, 0 on failure.
+    typedef unsigned char (*hash_table_combine_function)(void* destination_value, size_t destination_value_length,
+                                                         const void* source_value, size_t source_value_length);
+    //Default hash function. A fast 64 bit hash that
+    //reads keys 8 and 16 bytes at a time.
+    uint64_t hash_table_hash_default(const void* key, size_t key_length, uint64_t seed);
+    //The classic djb2 hash function, kept for compatibility.
+    //A seed of 0 gives djb2's original results.
+    uint64_t hash_table_hash_djb2(const void* key, size_t key_length, uint64_t seed);
+    //Ways a hash table can place elements in its slots.
+    enum hash_table_probing {
+        //Probe groups of slots at once using control
+        //bytes holding part of each key's hash.
+        HASH_TABLE_PROBING_GROUPS,
+        //Linear probing that keeps each element's distance
+        //from its home slot low by letting elements far from
+        //home take slots from ones close to home. Lookups of
+        //missing keys stop early, and removes leave no tombstones.
+        HASH_TABLE_PROBING_ROBIN_HOOD
+    };
+    //Options used when creating a new hash table.
+    //Must be initialized with hash_table_options_init
+    //before any of them are changed.
+    struct hash_table_options {
+        //function used to hash keys.
+        //NULL uses hash_table_hash_default.
+        hash_table_hash_function hash_function;
+        //seed passed to hash_function.
+        uint64_t seed;
+        //when set, seed is ignored and a random seed
+        //is chosen, so that collisions cannot be
+        //forced by picking keys ahead of time.
+        unsigned char randomize_seed;
+        //number of elements the table can store before
+        //it first has to resize.
+        size_t initial_capacity;
+        //when set, elements are allocated out of an arena.
+        //See hash_table_new_with_arena.
+        unsigned char use_arena;
+        //size of the arena's chunks. 0 uses a default size.
+        size_t arena_chunk_size;
+        //when set, growing the table keeps the old and new
+        //slot arrays side by side and moves a bounded number
+        //of slots on each add, get and remove, instead of
+        //moving every element on the add that crossed the
+        //load limit.
+        unsigned char incremental_resize;
+        //how elements are placed in the table's slots.
+        enum hash_table_probing probing;
+        //fraction of the table's slots that can be used before
+        //it grows. Kept between 0.25 and 0.95, default 0.875.
+        double max_load_factor;
+        //when set, the table stores the key and value pointers
+        //passed to add instead of copying what they point to.
+        //The caller's keys and values must then outlive their
+        //elements, and must not change while they are stored.
+        unsigned char borrow_keys_values;
+        //when borrowing, called on an element's key and value once
+        //it is removed, or the table is cleared or freed, handing
+        //their ownership to the table. NULL leaves them alone.
+        hash_table_free_function key_free;
+        hash_table_free_function value_free;
+        //bits of Bloom filter kept per element the table has
+        //room for. Lookups of keys the filter rules out return
+        //without probing the table, at the cost of setting a few
+        //bits on each add. 0, the default, keeps no filter.
+        //10 rejects about 99% of missing keys.
+        size_t bloom_filter_bits;
+    };
+    //Fill the passed options with the defaults
+    //used by hash_table_new.
+    void hash_table_options_init(struct hash_table_options* options);
     //Create a new hash table. Returns a
     //pointer to a new hash table on success.
     //Returns NULL on failure.
     struct hash_table* hash_table_new(void);
+    //Create a new hash table whose elements are allocated out
+    //of large chunks of chunk_size bytes instead of one malloc
+    //each. Removed elements are reused by later adds, and
+    //freeing or clearing the table releases everything at once.
+    //Passing 0 for chunk_size uses a default chunk size.
+    //Returns NULL on failure.
+    struct hash_table* hash_table_new_with_arena(size_t chunk_size);
+    //Create a new hash table able to store capacity
+    //elements before it has to resize.
+    //Returns NULL on failure.
+    struct hash_table* hash_table_new_with_capacity(size_t capacity);
+    //Create a new hash table configured by the passed options.
+    //Returns NULL on failure.
+    struct hash_table* hash_table_new_with_options(const struct hash_table_options* options);
     //free a passed hash_table from memory.
     void hash_table_free(struct hash_table* h_table);
+    //remove every element stored in the hash table, keeping the
+    //table's current size so that it can be refilled.
+    void hash_table_clear(struct hash_table* h_table);
+    //Grow the hash table so that it can store capacity
+    //elements before it has to resize again.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_reserve(struct hash_table* h_table, size_t capacity);
+    //Shrink the hash table to the smallest size able to store
+    //the elements it holds, freeing the rest of its slot memory.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_shrink_to_fit(struct hash_table* h_table);
     //Add the passed value to the hash table accessable by the
     //key passed.
     //values and keys will be copied into memory managed by the
-    //has table.
-    //function will return 1 on success, 0 on failure.
+    //has table, unless the table borrows them.
+    //function will return 1 on success, 0 on failure or when
+    //the key is already stored, leaving its value unchanged.
     unsigned char hash_table_add(struct hash_table* h_table, void* key, size_t key_length,
                                  void* value, size_t value_length);
+    //Store the passed value at key, replacing the value already
+    //stored there. Finds the key and where to add it in one probe.
+    //inserted, when not NULL, is set to 1 when the key was added
+    //and 0 when its value was replaced.
+    //Returns a pointer to the stored value, which may be changed
+    //in place until the table is next used, or NULL on failure.
+    //Borrowing tables hand a replaced value to value_free.
+    void* hash_table_upsert(struct hash_table* h_table, void* key, size_t key_length,
+                            void* value, size_t value_length, unsigned char* inserted);
+    //Returns a pointer to the value stored at key, adding the
+    //passed value there first when the key isn't stored, so a
+    //counter can be found or created with one probe.
+    //inserted, when not NULL, is set to 1 when the key was added.
+    //The value may be changed in place until the table is next
+    //used. Borrowing tables don't take ownership of a key and
+    //value that weren't added. Returns NULL on failure.
+    void* hash_table_get_or_insert(struct hash_table* h_table, void* key, size_t key_length,
+                                   void* value, size_t value_length, unsigned char* inserted);
     //removes the value stored at the key passed in the hash table
     //returns 1 on success, 0 on failure.
     unsigned char hash_table_remove(struct hash_table* h_table, void* key, size_t key_length);
     //returns the value stored at the key passed.
     //will return null if there is nothing stored at the key passed.
+    //Short values are stored in the table's slots, so the value
+    //returned is only valid until the table is next used.
     struct hash_table_key_value hash_table_get(struct hash_table* h_table, void* key, size_t key_length);
+    //Look up count keys at once, storing what hash_table_get
+    //would return for keys[i] in results[i]. The lookups of a
+    //batch wait out their cache misses together, rather than
+    //one after another.
+    void hash_table_get_batch(struct hash_table* h_table, void* const keys[], const size_t key_lengths[],
+                              size_t count, struct hash_table_key_value results[]);
+    //Add count key value pairs at once, as calling hash_table_add
+    //for keys[i] and values[i] in order would.
+    //function will return 1 when every pair was added, 0 when
+    //one failed or its key was already stored.
+    unsigned char hash_table_add_batch(struct hash_table* h_table, void* const keys[], const size_t key_lengths[],
+                                       void* const values[], const size_t value_lengths[], size_t count);
+    //Add every (key, value) pair of source to destination, which
+    //is grown once to fit them. For keys stored in both tables,
+    //combine updates destination's value using source's, or when
+    //combine is NULL, source's value replaces destination's.
+    //Tables that borrow keys and values can only merge from
+    //tables that borrow them too, and borrowing tables with
+    //key_free or value_free can't be merged, either as source or
+    //as destination. source is left unchanged.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_merge(struct hash_table* destination, struct hash_table* source,
+                                   hash_table_combine_function combine);
+    //returns the hash h_table's hash function and seed give the
+    //key passed. Tables made with the same options hash alike.
+    uint64_t hash_table_hash(struct hash_table* h_table, const void* key, size_t key_length);
+    //hash_table_add and hash_table_get for a key whose hash,
+    //key_hash, the caller already has. key_hash must be the
+    //hash hash_table_hash returns for the key.
+    unsigned char hash_table_add_hashed(struct hash_table* h_table, void* key, size_t key_length,
+                                        void* value, size_t value_length, uint64_t key_hash);
+    struct hash_table_key_value hash_table_get_hashed(struct hash_table* h_table, void* key, size_t key_length,
+                                                      uint64_t key_hash);
     //returns the number of elements stored in the hash table
     size_t hash_table_size(struct hash_table* h_table);
+    //returns the mean number of probe steps (slot groups, or
+    //slots for Robin Hood tables) taken by a lookup of a key
+    //that isn't stored in the hash table.
+    double hash_table_mean_miss_probe_length(struct hash_table* h_table);
+    //returns the estimated fraction of lookups of missing keys
+    //that the table's Bloom filter lets through to the probe.
+    //Removed keys stay in the filter until enough of them
+    //pile up for it to be rebuilt, so the rate grows somewhat
+    //as keys are removed.
+    //Returns 1.0 for tables kept without a filter.
+    double hash_table_bloom_false_positive_rate(struct hash_table* h_table);
+    //Number of probe lengths hash_table_stats counts keys for.
+    #define HASH_TABLE_PROBE_HISTOGRAM_LENGTH 16
+    //Statistics about a hash table, filled in by hash_table_stats.
+    //Probe lengths are in probe steps: slot groups, or slots for
+    //Robin Hood tables.
+    struct hash_table_stats {
+        //number of elements stored.
+        size_t elements_stored;
+        //number of slots, counting the old slots of
+        //an incremental resize in progress.
+        size_t slot_count;
+        //elements_stored divided by slot_count.
+        double load_factor;
+        //number of slots marked deleted.
+        size_t tombstones;
+        //longest and mean probe taken by a lookup
+        //that finds one of the stored keys.
+        size_t max_probe_length;
+        double mean_probe_length;
+        //mean probe taken by a lookup of a key that
+        //isn't stored, see hash_table_mean_miss_probe_length.
+        double mean_miss_probe_length;
+        //probe_length_histogram[i] is the number of stored keys
+        //found in i + 1 steps. The last entry also counts
+        //every key found in more steps.
+        size_t probe_length_histogram[HASH_TABLE_PROBE_HISTOGRAM_LENGTH];
+        //number of times the table has resized, and the seconds
+        //spent on it. Slots that incremental resizes move a few
+        //at a time during later operations aren't timed.
+        size_t resize_count;
+        double resize_seconds;
+        //bytes the table has allocated for its copies of keys
+        //and values, and for everything else: slots, control
+        //bytes, element headers and unused arena memory.
+        size_t key_bytes;
+        size_t value_bytes;
+        size_t metadata_bytes;
+        //set when the library was configured with
+        //--enable-op-counters. The counters below stay 0 otherwise.
+        unsigned char op_counters_enabled;
+        //gets, adds and removes that found their key,
+        //and ones that didn't.
+        uint64_t hits;
+        uint64_t misses;
+        //probe steps taken by those operations.
+        uint64_t probes;
+    };
+    //Fill stats with statistics about h_table. Looks at every
+    //slot, so it takes time proportional to the table's size.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_stats(struct hash_table* h_table, struct hash_table_stats* stats);
+    //Create an iterator over every (key, value) pair in h_table.
+    //The table must not be changed while the iterator is in use.
+    //Returns NULL on failure.
+    struct hash_table_key_value_iterator* hash_table_get_iterator(struct hash_table* h_table);
+    //Create an iterator over one of partition_count parts of
+    //h_table, numbered from 0. Together the parts cover every
+    //pair once, so each can be scanned by a different thread.
+    //Create every part's iterator before the threads start,
+    //and don't change the table until they are done.
+    //Returns NULL on failure.
+    struct hash_table_key_value_iterator* hash_table_get_partition_iterator(struct hash_table* h_table,
+                                                                            size_t partition,
+                                                                            size_t partition_count);
+    //Move the iterator to the next (key, value) pair, storing it in pair.
+    //The pair is valid until the table is next changed.
+    //returns 1 when there was a next pair, 0 once the iterator is done.
+    unsigned char hash_table_iterator_next(struct hash_table_key_value_iterator* iterator,
+                                           struct hash_table_key_value* pair);
+    //free a passed iterator from memory.
+    void hash_table_iterator_free(struct hash_table_key_value_iterator* iterator);
+    //Save h_table to the file at path as a snapshot, an image of
+    //its slots and elements that hash_table_open_mmap can serve
+    //lookups from without rebuilding the table. Only tables using
+    //a built in hash function can be saved.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_save(struct hash_table* h_table, const char* path);
+    //Open the snapshot saved at path as a read only hash table.
+    //The file is mapped into memory and looked up in place, so
+    //opening takes the same time however large the table is, and
+    //processes opening the same snapshot share its pages.
+    //Gets, batch gets and iterators work as usual, functions that
+    //would change the table fail. hash_table_free unmaps it.
+    //Returns NULL when the file isn't a snapshot this build can read,
+    //such as a group probed table saved by a build with a different
+    //SIMD group width (configure's --enable-simd).
+    struct hash_table* hash_table_open_mmap(const char* path);
+    //Check every byte of a table opened by hash_table_open_mmap
+    //against the checksum saved with it. Opening only checks
+    //the snapshot's header, so this is left to the caller.
+    //returns 1 when the snapshot is intact, 0 otherwise.
+    unsigned char hash_table_snapshot_verify(struct hash_table* h_table);
+    //Flags of hash_table_load_stream.
+    //Store pointers into the stream's image instead of copying
+    //keys and values. The table must borrow keys and values, and
+    //have no key_free or value_free. It keeps the image, mapped
+    //from the stream's file or read into memory, until it is freed.
+    //Records' elements are carved out of the table's arena instead
+    //of allocated one by one. A table created with an arena, see
+    //hash_table_new_with_arena, keeps its own. A table without one
+    //is given one, which it keeps after the load: the elements it
+    //already holds are moved into it, and later adds of any key
+    //allocate from it too, as if the table had been created with
+    //hash_table_new_with_arena.
+    #define HASH_TABLE_LOAD_BORROW 1
+    //Replace the value of keys already stored with the value of
+    //later records. Without it the first value stored is kept.
+    #define HASH_TABLE_LOAD_REPLACE 2
+    //Add every record of stream, from its current position to its
+    //end, to h_table. A record is a line holding a key, the passed
+    //delimiter and a value, or only a key, stored with an empty
+    //value. Empty lines are skipped and a carriage return ending a
+    //line is dropped. Files are mapped into memory where the system
+    //allows it and other streams are read in large blocks, and the
+    //table is grown to fit the records before they are added in
+    //batches. flags is 0 or HASH_TABLE_LOAD_ flags joined with |.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_load_stream(struct hash_table* h_table, FILE* stream, char delimiter,
+                                         unsigned int flags);
 #endif
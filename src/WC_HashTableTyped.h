@@ -0,0 +1,269 @@
+#ifndef WC_HASH_TABLE_TYPED_H
+    #define WC_HASH_TABLE_TYPED_H
+    #include <stddef.h>
+    #include <stdint.h>
+    #include <stdlib.h>
+    #include <string.h>
+    //Hash tables specialized for fixed width keys, such as
+    //integer ids or pointers. Keys and values are stored by
+    //value in the table's slots, keys are hashed with an
+    //integer mixer and compared with ==, and nothing is
+    //allocated per element.
+    //
+    //WC_HASHTABLE_DEFINE(name, key_t, value_t, hash_fn, eq_fn)
+    //defines struct name and the functions below, all static,
+    //so a table can be defined in every file that uses it:
+    //
+    //  struct name* name_new(size_t capacity)
+    //      Create a table able to store capacity elements before
+    //      it has to resize. Returns NULL on failure.
+    //  void name_free(struct name* table)
+    //  unsigned char name_put(struct name* table, key_t key, value_t value)
+    //      Store value at key, replacing the value already stored
+    //      there. Returns 1 on success, 0 on failure.
+    //  value_t* name_get(struct name* table, key_t key)
+    //      Returns a pointer to the value stored at key, valid
+    //      until the table is next changed, or NULL.
+    //  unsigned char name_remove(struct name* table, key_t key)
+    //      Returns 1 when a value was removed, 0 otherwise.
+    //  size_t name_size(struct name* table)
+    //  void name_clear(struct name* table)
+    //
+    //hash_fn takes a key_t and returns a uint64_t. eq_fn takes
+    //two key_t and returns nonzero when they are equal.
+
+    //Mix the bits of a 64 bit integer key into a hash.
+    static inline uint64_t wc_hash_u64(uint64_t key) {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ULL;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebULL;
+        key ^= key >> 31;
+        return key;
+    }
+    //Mix the bits of a 32 bit integer key into a hash.
+    static inline uint64_t wc_hash_u32(uint32_t key) {
+        return wc_hash_u64(key);
+    }
+    //Mix the bits of a pointer key into a hash.
+    static inline uint64_t wc_hash_pointer(const void* key) {
+        return wc_hash_u64((uint64_t)(uintptr_t)key);
+    }
+    //Key comparison for keys that can be compared with ==.
+    #define WC_HASHTABLE_EQUAL(a, b) ((a) == (b))
+
+    //Control byte of a slot that never held an element.
+    #define WC_HASHTABLE_EMPTY ((uint8_t)0)
+    //Control byte of a slot whose element was removed.
+    #define WC_HASHTABLE_DELETED ((uint8_t)1)
+    //Full slots hold this bit plus 7 bits of their key's hash.
+    #define WC_HASHTABLE_FULL ((uint8_t)0x80)
+    //Smallest number of slots a table is given.
+    #define WC_HASHTABLE_MINIMUM_LENGTH ((size_t)16)
+
+    #define WC_HASHTABLE_DEFINE(name, key_t, value_t, hash_fn, eq_fn) \
+        /* A key and the value stored at it. */ \
+        struct name##_slot { \
+            key_t key; \
+            value_t value; \
+        }; \
+        \
+        struct name { \
+            /* one byte per slot, see WC_HASHTABLE_EMPTY. */ \
+            uint8_t* control; \
+            /* keys and values. */ \
+            struct name##_slot* slots; \
+            /* number of slots. Always a power of two. */ \
+            size_t length; \
+            /* number of elements stored. */ \
+            size_t elements_stored; \
+            /* number of slots marked deleted. */ \
+            size_t tombstones; \
+        }; \
+        \
+        /* Returns the control byte of a full slot holding a key with the passed hash. */ \
+        static inline uint8_t name##_hash_control(uint64_t key_hash) { \
+            return (uint8_t)(WC_HASHTABLE_FULL | (key_hash >> 57)); \
+        } \
+        \
+        /* Returns the number of slots able to store capacity elements, */ \
+        /* keeping the table at most 7/8 full. 0 when none can. */ \
+        static inline size_t name##_length_for_capacity(size_t capacity) { \
+            size_t length = WC_HASHTABLE_MINIMUM_LENGTH; \
+            while (length / 8 * 7 < capacity) { \
+                if (length > ((size_t)-1 / 2) / sizeof(struct name##_slot)) { \
+                    return 0; \
+                } \
+                length *= 2; \
+            } \
+            return length; \
+        } \
+        \
+        /* Give the table length empty slots. Returns 1 on success, 0 on failure. */ \
+        static inline unsigned char name##_allocate(struct name* table, size_t length) { \
+            table->control = (uint8_t*)calloc(length, 1); \
+            table->slots = (struct name##_slot*)malloc(sizeof(struct name##_slot) * length); \
+            if (table->control == NULL || table->slots == NULL) { \
+                free(table->control); \
+                free(table->slots); \
+                return 0; \
+            } \
+            table->length = length; \
+            table->tombstones = 0; \
+            return 1; \
+        } \
+        \
+        /* Store key and value, known not to be in the table, in the */ \
+        /* first free slot of their probe sequence. */ \
+        static inline void name##_insert_new(struct name* table, uint64_t key_hash, \
+                                             key_t key, value_t value) { \
+            size_t mask = table->length - 1; \
+            size_t index = (size_t)key_hash & mask; \
+            while (table->control[index] & WC_HASHTABLE_FULL) { \
+                index = (index + 1) & mask; \
+            } \
+            if (table->control[index] == WC_HASHTABLE_DELETED) { \
+                table->tombstones--; \
+            } \
+            table->control[index] = name##_hash_control(key_hash); \
+            table->slots[index].key = key; \
+            table->slots[index].value = value; \
+        } \
+        \
+        /* Move every element into length new slots. Returns 1 on success, 0 on failure. */ \
+        static inline unsigned char name##_rehash(struct name* table, size_t length) { \
+            struct name old_table = *table; \
+            if (!name##_allocate(table, length)) { \
+                *table = old_table; \
+                return 0; \
+            } \
+            for (size_t i = 0; i < old_table.length; i++) { \
+                if (old_table.control[i] & WC_HASHTABLE_FULL) { \
+                    name##_insert_new(table, hash_fn(old_table.slots[i].key), \
+                                      old_table.slots[i].key, old_table.slots[i].value); \
+                } \
+            } \
+            free(old_table.control); \
+            free(old_table.slots); \
+            return 1; \
+        } \
+        \
+        /* Returns the index of the slot holding key, or table->length. */ \
+        static inline size_t name##_find(struct name* table, uint64_t key_hash, key_t key) { \
+            size_t mask = table->length - 1; \
+            size_t index = (size_t)key_hash & mask; \
+            uint8_t key_control = name##_hash_control(key_hash); \
+            /* The table always has an empty slot, which ends the probe. */ \
+            while (table->control[index] != WC_HASHTABLE_EMPTY) { \
+                if (table->control[index] == key_control && eq_fn(table->slots[index].key, key)) { \
+                    return index; \
+                } \
+                index = (index + 1) & mask; \
+            } \
+            return table->length; \
+        } \
+        \
+        static inline struct name* name##_new(size_t capacity) { \
+            size_t length = name##_length_for_capacity(capacity); \
+            struct name* table = (struct name*)malloc(sizeof(struct name)); \
+            if (length == 0 || table == NULL) { \
+                free(table); \
+                return NULL; \
+            } \
+            if (!name##_allocate(table, length)) { \
+                free(table); \
+                return NULL; \
+            } \
+            table->elements_stored = 0; \
+            return table; \
+        } \
+        \
+        static inline void name##_free(struct name* table) { \
+            if (table == NULL) { \
+                return; \
+            } \
+            free(table->control); \
+            free(table->slots); \
+            free(table); \
+        } \
+        \
+        static inline unsigned char name##_put(struct name* table, key_t key, value_t value) { \
+            if (table == NULL) { \
+                return 0; \
+            } \
+            uint64_t key_hash = hash_fn(key); \
+            size_t index = name##_find(table, key_hash, key); \
+            if (index != table->length) { \
+                table->slots[index].value = value; \
+                return 1; \
+            } \
+            /* Keep used and deleted slots within 7/8 of the table. */ \
+            if (table->elements_stored + table->tombstones + 1 > table->length / 8 * 7) { \
+                size_t length = table->length; \
+                /* Deleted slots are cleared out at the same size */ \
+                /* unless the elements alone fill most of the table. */ \
+                if (table->elements_stored + 1 > table->length / 2) { \
+                    length *= 2; \
+                } \
+                if (!name##_rehash(table, length)) { \
+                    return 0; \
+                } \
+            } \
+            name##_insert_new(table, key_hash, key, value); \
+            table->elements_stored++; \
+            return 1; \
+        } \
+        \
+        static inline value_t* name##_get(struct name* table, key_t key) { \
+            if (table == NULL) { \
+                return NULL; \
+            } \
+            size_t index = name##_find(table, hash_fn(key), key); \
+            if (index == table->length) { \
+                return NULL; \
+            } \
+            return &table->slots[index].value; \
+        } \
+        \
+        static inline unsigned char name##_remove(struct name* table, key_t key) { \
+            if (table == NULL) { \
+                return 0; \
+            } \
+            size_t mask = table->length - 1; \
+            size_t index = name##_find(table, hash_fn(key), key); \
+            if (index == table->length) { \
+                return 0; \
+            } \
+            /* A slot followed by an empty one ends no other probe, */ \
+            /* so it can be emptied instead of marked deleted. */ \
+            if (table->control[(index + 1) & mask] == WC_HASHTABLE_EMPTY) { \
+                table->control[index] = WC_HASHTABLE_EMPTY; \
+            } else { \
+                table->control[index] = WC_HASHTABLE_DELETED; \
+                table->tombstones++; \
+            } \
+            table->elements_stored--; \
+            return 1; \
+        } \
+        \
+        static inline size_t name##_size(struct name* table) { \
+            return table == NULL ? 0 : table->elements_stored; \
+        } \
+        \
+        static inline void name##_clear(struct name* table) { \
+            if (table == NULL) { \
+                return; \
+            } \
+            memset(table->control, WC_HASHTABLE_EMPTY, table->length); \
+            table->elements_stored = 0; \
+            table->tombstones = 0; \
+        }
+
+    //Tables keyed by 64 bit integers, 32 bit integers and pointers.
+    #define WC_HASHTABLE_DEFINE_U64(name, value_t) \
+        WC_HASHTABLE_DEFINE(name, uint64_t, value_t, wc_hash_u64, WC_HASHTABLE_EQUAL)
+    #define WC_HASHTABLE_DEFINE_U32(name, value_t) \
+        WC_HASHTABLE_DEFINE(name, uint32_t, value_t, wc_hash_u32, WC_HASHTABLE_EQUAL)
+    #define WC_HASHTABLE_DEFINE_POINTER(name, value_t) \
+        WC_HASHTABLE_DEFINE(name, const void*, value_t, wc_hash_pointer, WC_HASHTABLE_EQUAL)
+#endif
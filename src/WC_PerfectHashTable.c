@@ -0,0 +1,497 @@
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "WC_PerfectHashTable.h"
+
+//Mean number of keys hashed to each bucket. Larger buckets
+//take fewer pilots, but longer searches for them.
+#define KEYS_PER_BUCKET 5
+//Fraction of the positions keys are first placed on that hold
+//a key. The spare positions keep the search for the pilots of
+//the last buckets short. Keys placed past the last slot are
+//then moved into the slots left free below it.
+#define PLACEMENT_LOAD_FACTOR 0.98
+//Pilots are stored in 16 bits. Builds where a bucket needs a
+//larger one start over with another seed.
+#define MAXIMUM_PILOT UINT16_MAX
+//Number of seeds tried before a build gives up.
+#define BUILD_ATTEMPTS 16
+//Values are stored at multiples of this many bytes.
+#define VALUE_ALIGNMENT ((size_t)8)
+//Largest number of key and value bytes stored in an entry.
+#define INLINE_PAIR_MAX 16
+
+//A key value pair stored in a slot of the table. Short pairs
+//are stored in the entry, so a lookup reads a single entry.
+struct perfect_entry {
+    //number of bytes the key takes up.
+    uint32_t key_length;
+    //number of bytes the value takes up.
+    uint32_t value_length;
+    union {
+        //offset of the value in the table's data, when the pair
+        //takes up more than INLINE_PAIR_MAX bytes. The key follows it.
+        size_t offset;
+        //value bytes, immediately followed by the key bytes.
+        unsigned char bytes[INLINE_PAIR_MAX];
+    } pair;
+};
+
+struct hash_table_perfect {
+    //number of pairs stored, which is also the number of entries.
+    size_t size;
+    //seed the keys are hashed with.
+    uint64_t seed;
+    //number of buckets keys are split into.
+    size_t bucket_count;
+    //pilot chosen for each bucket.
+    uint16_t* pilots;
+    //number of positions keys are first placed on.
+    //At least size, see PLACEMENT_LOAD_FACTOR.
+    size_t position_count;
+    //slot below size each position from size on moves to.
+    uint32_t* remap;
+    //entry of each slot.
+    struct perfect_entry* entries;
+    //values and keys of every entry.
+    unsigned char* data;
+};
+
+/* Private PerfectHashTable functions */
+
+//Returns a number below range spread as evenly as value is.
+static inline size_t reduce(uint64_t value, size_t range) {
+#if defined(__SIZEOF_INT128__)
+    return (size_t)(((__uint128_t)value * range) >> 64);
+#else
+    return (size_t)(value % range);
+#endif
+}
+
+//Mix the bits of a 64 bit value.
+static inline uint64_t mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+//Returns the bucket of a key with the passed hash.
+static inline size_t bucket_of(size_t bucket_count, uint64_t key_hash) {
+    return reduce(key_hash, bucket_count);
+}
+
+//Returns the position a key with the passed hash
+//is placed on by its bucket's pilot.
+static inline size_t position_of(size_t position_count, uint64_t key_hash, uint64_t pilot) {
+    return reduce(mix(key_hash ^ (pilot * 0x9e3779b97f4a7c15ULL)), position_count);
+}
+
+//Returns the slot of a key with the passed hash.
+static inline size_t slot_of(const struct hash_table_perfect* p_table, uint64_t key_hash) {
+    uint16_t pilot = p_table->pilots[bucket_of(p_table->bucket_count, key_hash)];
+    size_t position = position_of(p_table->position_count, key_hash, pilot);
+
+    if (position >= p_table->size) {
+        return p_table->remap[position - p_table->size];
+    }
+    return position;
+}
+
+//Returns the number of bytes of the table's data a pair with
+//the passed lengths takes up. 0 when it is stored in its entry.
+static inline size_t pair_data_size(size_t key_length, size_t value_length) {
+    if (key_length + value_length <= INLINE_PAIR_MAX) {
+        return 0;
+    }
+    return (value_length + key_length + VALUE_ALIGNMENT - 1) & ~(VALUE_ALIGNMENT - 1);
+}
+
+//Returns a pointer to the value of an entry. The key follows it.
+static inline unsigned char* entry_value(struct hash_table_perfect* p_table, struct perfect_entry* entry) {
+    if (entry->key_length + entry->value_length <= INLINE_PAIR_MAX) {
+        return entry->pair.bytes;
+    }
+    return p_table->data + entry->pair.offset;
+}
+
+//Returns 1 when bit index of bits is set.
+static inline unsigned char bit_is_set(const uint64_t* bits, size_t index) {
+    return (bits[index / 64] >> (index % 64)) & 1;
+}
+
+//Set bit index of bits.
+static inline void set_bit(uint64_t* bits, size_t index) {
+    bits[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+//Working memory of a build.
+struct perfect_build {
+    //hash of each pair's key.
+    uint64_t* hashes;
+    //pairs ordered by bucket.
+    size_t* order;
+    //index in order of the first pair of each bucket,
+    //followed by the total number of pairs.
+    size_t* bucket_starts;
+    //buckets from the largest to the smallest.
+    size_t* buckets_by_size;
+    //positions taken so far, one bit each.
+    uint64_t* taken;
+    //positions of the bucket being placed.
+    size_t* bucket_positions;
+};
+
+//Place every pair on its own position, hashing keys with seed.
+//Pilots are stored in p_table, which has its bucket and
+//position counts set.
+//Returns 1 on success, 0 when the seed can't place every
+//pair, and 2 when a key was passed twice.
+static unsigned char place_pairs(struct hash_table_perfect* p_table, struct perfect_build* build,
+                                 const struct hash_table_key_value pairs[], size_t count, uint64_t seed) {
+    size_t bucket_count = p_table->bucket_count;
+    size_t* bucket_starts = build->bucket_starts;
+    //Hash every key and count the pairs of each bucket.
+    memset(bucket_starts, 0, sizeof(size_t) * (bucket_count + 1));
+
+    for (size_t i = 0; i < count; i++) {
+        build->hashes[i] = hash_table_hash_default(pairs[i].key, pairs[i].key_length, seed);
+        bucket_starts[bucket_of(bucket_count, build->hashes[i]) + 1]++;
+    }
+    size_t largest_bucket = 0;
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        if (bucket_starts[i + 1] > largest_bucket) {
+            largest_bucket = bucket_starts[i + 1];
+        }
+        bucket_starts[i + 1] += bucket_starts[i];
+    }
+    //Order the pairs by bucket.
+    size_t* next = build->buckets_by_size;
+    memcpy(next, bucket_starts, sizeof(size_t) * bucket_count);
+
+    for (size_t i = 0; i < count; i++) {
+        build->order[next[bucket_of(bucket_count, build->hashes[i])]++] = i;
+    }
+    //Order the buckets by size, largest first, since large
+    //buckets find free positions easily while most are free.
+    size_t* size_starts = calloc(largest_bucket + 2, sizeof(size_t));
+
+    if (size_starts == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        size_starts[largest_bucket - (bucket_starts[i + 1] - bucket_starts[i]) + 1]++;
+    }
+
+    for (size_t i = 0; i <= largest_bucket; i++) {
+        size_starts[i + 1] += size_starts[i];
+    }
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        build->buckets_by_size[size_starts[largest_bucket - (bucket_starts[i + 1] - bucket_starts[i])]++] = i;
+    }
+    free(size_starts);
+    memset(build->taken, 0, sizeof(uint64_t) * (p_table->position_count / 64 + 1));
+    //Find the smallest pilot placing each bucket's
+    //pairs on positions no other pair has taken.
+    for (size_t b = 0; b < bucket_count; b++) {
+        size_t bucket = build->buckets_by_size[b];
+        size_t start = bucket_starts[bucket];
+        size_t size = bucket_starts[bucket + 1] - start;
+
+        if (size == 0) {
+            //Every bucket after this one is empty too.
+            break;
+        }
+        //Keys with the same hash would share a position
+        //whatever the pilot.
+        for (size_t i = 0; i < size; i++) {
+            for (size_t j = 0; j < i; j++) {
+                const struct hash_table_key_value* one = &pairs[build->order[start + i]];
+                const struct hash_table_key_value* two = &pairs[build->order[start + j]];
+
+                if (build->hashes[build->order[start + i]] == build->hashes[build->order[start + j]]) {
+                    if (one->key_length == two->key_length &&
+                        memcmp(one->key, two->key, one->key_length) == 0) {
+                        return 2;
+                    }
+                    return 0;
+                }
+            }
+        }
+        uint64_t pilot = 0;
+
+        for (; pilot <= MAXIMUM_PILOT; pilot++) {
+            size_t placed = 0;
+
+            for (; placed < size; placed++) {
+                size_t position = position_of(p_table->position_count,
+                                              build->hashes[build->order[start + placed]], pilot);
+
+                if (bit_is_set(build->taken, position)) {
+                    break;
+                }
+                size_t i = 0;
+
+                while (i < placed && build->bucket_positions[i] != position) {
+                    i++;
+                }
+
+                if (i < placed) {
+                    break;
+                }
+                build->bucket_positions[placed] = position;
+            }
+
+            if (placed == size) {
+                break;
+            }
+        }
+
+        if (pilot > MAXIMUM_PILOT) {
+            return 0;
+        }
+        p_table->pilots[bucket] = (uint16_t)pilot;
+
+        for (size_t i = 0; i < size; i++) {
+            set_bit(build->taken, build->bucket_positions[i]);
+        }
+    }
+    return 1;
+}
+
+//free the working memory of a build.
+static void free_build(struct perfect_build* build) {
+    free(build->hashes);
+    free(build->order);
+    free(build->bucket_starts);
+    free(build->buckets_by_size);
+    free(build->taken);
+    free(build->bucket_positions);
+}
+
+/* Public PerfectHashTable functions */
+
+//Build a perfect hash table holding a copy of the count
+//(key, value) pairs passed.
+//Returns NULL on failure, or when a key is passed twice.
+struct hash_table_perfect* hash_table_perfect_build_from_pairs(const struct hash_table_key_value pairs[],
+                                                               size_t count) {
+    //Make sure that the pairs passed exist
+    if (pairs == NULL && count != 0) {
+        fprintf(stderr, "Error. NULL pairs passed to hash_table_perfect_build_from_pairs.\n");
+        return NULL;
+    }
+    //Slots are remapped with 32 bit indexes.
+    if (count >= UINT32_MAX) {
+        fprintf(stderr, "Error. Too many pairs passed to hash_table_perfect_build_from_pairs.\n");
+        return NULL;
+    }
+    size_t data_size = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (pairs[i].key == NULL || pairs[i].value == NULL) {
+            fprintf(stderr, "Error. NULL key or value passed to hash_table_perfect_build_from_pairs.\n");
+            return NULL;
+        }
+
+        if (pairs[i].key_length > UINT32_MAX || pairs[i].value_length > UINT32_MAX) {
+            fprintf(stderr, "Error. Key or value passed to hash_table_perfect_build_from_pairs is too long.\n");
+            return NULL;
+        }
+        data_size += pair_data_size(pairs[i].key_length, pairs[i].value_length);
+    }
+    struct hash_table_perfect* p_table = calloc(1, sizeof(struct hash_table_perfect));
+
+    if (p_table == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    p_table->size = count;
+    p_table->bucket_count = count / KEYS_PER_BUCKET + 1;
+    p_table->position_count = (size_t)((double)count / PLACEMENT_LOAD_FACTOR) + 1;
+    p_table->pilots = calloc(p_table->bucket_count, sizeof(uint16_t));
+    p_table->remap = calloc(p_table->position_count - count, sizeof(uint32_t));
+    p_table->entries = malloc(sizeof(struct perfect_entry) * (count + 1));
+    p_table->data = malloc(data_size + 1);
+    struct perfect_build build;
+    build.hashes = malloc(sizeof(uint64_t) * (count + 1));
+    build.order = malloc(sizeof(size_t) * (count + 1));
+    build.bucket_starts = malloc(sizeof(size_t) * (p_table->bucket_count + 1));
+    build.buckets_by_size = malloc(sizeof(size_t) * p_table->bucket_count);
+    build.taken = malloc(sizeof(uint64_t) * (p_table->position_count / 64 + 1));
+    build.bucket_positions = malloc(sizeof(size_t) * (count + 1));
+
+    if (p_table->pilots == NULL || p_table->remap == NULL || p_table->entries == NULL ||
+        p_table->data == NULL || build.hashes == NULL || build.order == NULL ||
+        build.bucket_starts == NULL || build.buckets_by_size == NULL || build.taken == NULL ||
+        build.bucket_positions == NULL) {
+        free_build(&build);
+        hash_table_perfect_free(p_table);
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    //Try seeds until one places every pair.
+    unsigned char placed = 0;
+
+    for (uint64_t attempt = 0; attempt < BUILD_ATTEMPTS && placed == 0; attempt++) {
+        p_table->seed = mix(attempt + 1);
+        placed = place_pairs(p_table, &build, pairs, count, p_table->seed);
+    }
+
+    if (placed != 1) {
+        free_build(&build);
+        hash_table_perfect_free(p_table);
+
+        if (placed == 2) {
+            fprintf(stderr, "Error. Same key passed twice to hash_table_perfect_build_from_pairs.\n");
+        } else {
+            fprintf(stderr, "Error. Unable to find a perfect hash function for the pairs passed.\n");
+        }
+        return NULL;
+    }
+    //Move the pairs placed past the last slot into the slots
+    //left free below it, which there are as many of.
+    size_t free_slot = 0;
+
+    for (size_t position = count; position < p_table->position_count; position++) {
+        if (bit_is_set(build.taken, position)) {
+            while (bit_is_set(build.taken, free_slot)) {
+                free_slot++;
+            }
+            p_table->remap[position - count] = (uint32_t)free_slot++;
+        }
+    }
+    //Copy each pair into its slot's entry.
+    size_t offset = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        struct perfect_entry* entry = &p_table->entries[slot_of(p_table, build.hashes[i])];
+        entry->key_length = (uint32_t)pairs[i].key_length;
+        entry->value_length = (uint32_t)pairs[i].value_length;
+        unsigned char* value = entry->pair.bytes;
+
+        if (pair_data_size(pairs[i].key_length, pairs[i].value_length) != 0) {
+            entry->pair.offset = offset;
+            value = p_table->data + offset;
+            offset += pair_data_size(pairs[i].key_length, pairs[i].value_length);
+        }
+        memcpy(value, pairs[i].value, pairs[i].value_length);
+        memcpy(value + pairs[i].value_length, pairs[i].key, pairs[i].key_length);
+    }
+    free_build(&build);
+    return p_table;
+}
+
+//Build a perfect hash table holding a copy of every
+//(key, value) pair stored in h_table.
+//Returns NULL on failure.
+struct hash_table_perfect* hash_table_perfect_build(struct hash_table* h_table) {
+    //Make sure that the hash table passed exists
+    if (h_table == NULL) {
+        fprintf(stderr, "Error. NULL h_table passed to hash_table_perfect_build.\n");
+        return NULL;
+    }
+    size_t count = hash_table_size(h_table);
+    struct hash_table_key_value* pairs = malloc(sizeof(struct hash_table_key_value) * (count + 1));
+    struct hash_table_key_value_iterator* iterator = hash_table_get_iterator(h_table);
+
+    if (pairs == NULL || iterator == NULL) {
+        free(pairs);
+        hash_table_iterator_free(iterator);
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    size_t pair_count = 0;
+
+    while (pair_count < count && hash_table_iterator_next(iterator, &pairs[pair_count])) {
+        pair_count++;
+    }
+    hash_table_iterator_free(iterator);
+    struct hash_table_perfect* p_table = hash_table_perfect_build_from_pairs(pairs, pair_count);
+    free(pairs);
+    return p_table;
+}
+
+//free a passed perfect hash table from memory.
+void hash_table_perfect_free(struct hash_table_perfect* p_table) {
+    //Make sure that the passed table actually exists.
+    if (p_table == NULL) {
+        fprintf(stderr, "Error. Attempting to free a NULL perfect hash table.\n");
+        return;
+    }
+    free(p_table->pilots);
+    free(p_table->remap);
+    free(p_table->entries);
+    free(p_table->data);
+    free(p_table);
+}
+
+//returns the value stored at the key passed.
+//will return NULL if there is nothing stored at the key passed.
+struct hash_table_key_value hash_table_perfect_get(struct hash_table_perfect* p_table, void* key,
+                                                   size_t key_length) {
+    //Initialize value_to_return
+    struct hash_table_key_value value_to_return;
+    value_to_return.key = NULL;
+    value_to_return.key_length = 0;
+    value_to_return.value = NULL;
+    value_to_return.value_length = 0;
+    //Make sure that parameters passed exist.
+    if (p_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. NULL p_table or key passed to hash_table_perfect_get.\n");
+        return value_to_return;
+    }
+
+    if (p_table->size == 0) {
+        return value_to_return;
+    }
+    //Every key maps to a slot, so a key that isn't
+    //stored is told apart by comparing it.
+    uint64_t key_hash = hash_table_hash_default(key, key_length, p_table->seed);
+    struct perfect_entry* entry = &p_table->entries[slot_of(p_table, key_hash)];
+
+    if (entry->key_length != key_length) {
+        return value_to_return;
+    }
+    unsigned char* value = entry_value(p_table, entry);
+
+    if (memcmp(value + entry->value_length, key, key_length) != 0) {
+        return value_to_return;
+    }
+    value_to_return.key = key;
+    value_to_return.key_length = key_length;
+    value_to_return.value = value;
+    value_to_return.value_length = entry->value_length;
+    return value_to_return;
+}
+
+//returns the number of elements stored in the perfect hash table
+size_t hash_table_perfect_size(struct hash_table_perfect* p_table) {
+    //can't have any elements in it then
+    if (p_table == NULL) {
+        return 0;
+    }
+    return p_table->size;
+}
+
+//returns the number of bits per key taken by the pilots
+//and remapped slots, leaving out the keys and values.
+double hash_table_perfect_bits_per_key(struct hash_table_perfect* p_table) {
+    //Make sure that the passed table has keys.
+    if (p_table == NULL || p_table->size == 0) {
+        return 0.0;
+    }
+    size_t bits = p_table->bucket_count * sizeof(uint16_t) * 8 +
+                  (p_table->position_count - p_table->size) * sizeof(uint32_t) * 8;
+    return (double)bits / (double)p_table->size;
+}
@@ -0,0 +1,37 @@
+#ifndef WC_PERFECT_HASH_TABLE_H
+    #define WC_PERFECT_HASH_TABLE_H
+    #include <stddef.h>
+    #include "WC_HashTable.h"
+    //A read only hash table built once from a fixed set of keys.
+    //Keys are placed with a minimal perfect hash function, so
+    //every key has a slot of its own, there are exactly as many
+    //slots as keys, and a lookup hashes the key and compares it
+    //against the one slot it maps to, without probing.
+    //
+    //The hash function is made of a small pilot value per bucket
+    //of keys, chosen at build time so that the keys of a bucket
+    //land on free slots (PTHash style). It takes about 4 bits
+    //per key on top of the keys and values themselves.
+    struct hash_table_perfect;
+    //Build a perfect hash table holding a copy of every
+    //(key, value) pair stored in h_table.
+    //Returns NULL on failure.
+    struct hash_table_perfect* hash_table_perfect_build(struct hash_table* h_table);
+    //Build a perfect hash table holding a copy of the count
+    //(key, value) pairs passed. Keys must all be different.
+    //Returns NULL on failure, or when a key is passed twice.
+    struct hash_table_perfect* hash_table_perfect_build_from_pairs(const struct hash_table_key_value pairs[],
+                                                                   size_t count);
+    //free a passed perfect hash table from memory.
+    void hash_table_perfect_free(struct hash_table_perfect* p_table);
+    //returns the value stored at the key passed.
+    //will return null if there is nothing stored at the key passed.
+    //The value returned stays valid until the table is freed.
+    struct hash_table_key_value hash_table_perfect_get(struct hash_table_perfect* p_table, void* key,
+                                                       size_t key_length);
+    //returns the number of elements stored in the perfect hash table
+    size_t hash_table_perfect_size(struct hash_table_perfect* p_table);
+    //returns the number of bits per key taken by the perfect
+    //hash function, leaving out the keys and values themselves.
+    double hash_table_perfect_bits_per_key(struct hash_table_perfect* p_table);
+#endif
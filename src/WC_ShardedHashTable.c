@@ -0,0 +1,506 @@
+#ifdef HAVE_CONFIG_H
+    #include "config.h"
+#endif
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#ifdef HAVE_UNISTD_H
+    #include <unistd.h>
+#endif
+#include "WC_ShardedHashTable.h"
+
+//Number of shards a table gets when none is requested.
+#define DEFAULT_SHARD_COUNT 64
+//Fewest pairs a thread of hash_table_sharded_build is
+//given, below which starting threads costs more than it saves.
+#define MINIMUM_PAIRS_PER_THREAD 4096
+
+struct hash_table_sharded {
+    //tables the keys are split between.
+    struct hash_table** shards;
+    //number of shards. Always a power of two.
+    size_t shard_count;
+    //number of high hash bits that pick a shard.
+    unsigned int shard_bits;
+    //hash function and seed every shard was created with,
+    //which tables have to share to be merged shard by shard.
+    hash_table_hash_function hash_function;
+    uint64_t seed;
+};
+
+//A pair of hash_table_sharded_build, sorted by shard.
+struct sorted_pair {
+    //index of the pair in the arrays passed.
+    size_t index;
+    //hash of the pair's key.
+    uint64_t hash;
+};
+
+//Input of hash_table_sharded_build, shared by its threads.
+struct build_input {
+    struct hash_table_sharded* s_table;
+    void* const* keys;
+    const size_t* key_lengths;
+    void* const* values;
+    const size_t* value_lengths;
+    //hash of each key, filled in by the first pass.
+    uint64_t* hashes;
+    //pairs sorted by shard, filled in by the second pass.
+    struct sorted_pair* sorted;
+    //index into sorted of each shard's first pair, and
+    //one more entry holding the number of pairs.
+    size_t* shard_starts;
+    //next shard for a thread of the last pass to fill.
+    _Atomic size_t next_shard;
+    //cleared once a pair fails to be added.
+    _Atomic unsigned char success;
+};
+
+//Work of one thread of hash_table_sharded_build.
+struct build_work {
+    struct build_input* input;
+    //range of the pairs passed the thread hashes and sorts.
+    size_t start;
+    size_t end;
+    //number of the thread's pairs belonging to each shard,
+    //then the index in sorted its next pair of each shard
+    //is stored at.
+    size_t* shard_positions;
+};
+
+//Work of one thread of hash_table_sharded_merge.
+struct merge_work {
+    struct hash_table_sharded* destination;
+    struct hash_table_sharded* source;
+    hash_table_combine_function combine;
+    //next shard for a thread to merge.
+    _Atomic size_t* next_shard;
+    //cleared once a shard fails to merge.
+    _Atomic unsigned char* success;
+};
+
+/* Private ShardedHashTable functions */
+
+//Returns the index of the shard keys hashing to key_hash belong to.
+static inline size_t shard_for_hash(const struct hash_table_sharded* s_table, uint64_t key_hash) {
+    if (s_table->shard_bits == 0) {
+        return 0;
+    }
+    return (size_t)(key_hash >> (64 - s_table->shard_bits));
+}
+
+//Returns the number of threads to use when
+//thread_count of them are asked for.
+static size_t threads_to_use(size_t thread_count) {
+    if (thread_count == 0) {
+#if defined(HAVE_UNISTD_H) && defined(_SC_NPROCESSORS_ONLN)
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        thread_count = processors > 0 ? (size_t)processors : 1;
+#else
+        thread_count = 1;
+#endif
+    }
+    return thread_count;
+}
+
+//Run work on each of count argument structures of
+//size bytes each, each on a thread of its own, and wait
+//for them all to finish. Work that a thread couldn't
+//be started for is run on the calling thread instead.
+static void run_threads(void* (*work)(void*), void* arguments, size_t size, size_t count) {
+    unsigned char* argument_bytes = arguments;
+    pthread_t* threads = count > 1 ? malloc(sizeof(pthread_t) * count) : NULL;
+    size_t started = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (threads == NULL || pthread_create(&threads[started], NULL, work, argument_bytes + i * size) != 0) {
+            work(argument_bytes + i * size);
+            continue;
+        }
+        started++;
+    }
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+//First pass of hash_table_sharded_build: hash the
+//thread's keys and count them by shard.
+static void* hash_pairs(void* arg) {
+    struct build_work* work = arg;
+    struct build_input* input = work->input;
+    struct hash_table_sharded* s_table = input->s_table;
+
+    for (size_t i = work->start; i < work->end; i++) {
+        if (input->keys[i] == NULL) {
+            continue;
+        }
+        input->hashes[i] = hash_table_hash(s_table->shards[0], input->keys[i], input->key_lengths[i]);
+        work->shard_positions[shard_for_hash(s_table, input->hashes[i])]++;
+    }
+    return NULL;
+}
+
+//Second pass: store the thread's pairs in sorted, in the
+//part of each shard's range set aside for the thread.
+static void* sort_pairs(void* arg) {
+    struct build_work* work = arg;
+    struct build_input* input = work->input;
+
+    for (size_t i = work->start; i < work->end; i++) {
+        if (input->keys[i] == NULL) {
+            continue;
+        }
+        struct sorted_pair* pair = &input->sorted[work->shard_positions[shard_for_hash(input->s_table,
+                                                                                         input->hashes[i])]++];
+        pair->index = i;
+        pair->hash = input->hashes[i];
+    }
+    return NULL;
+}
+
+//Last pass: take shards one at a time and add their pairs,
+//until every shard is filled. No other thread touches
+//the shards a thread takes.
+static void* fill_shards(void* arg) {
+    struct build_work* work = arg;
+    struct build_input* input = work->input;
+    struct hash_table_sharded* s_table = input->s_table;
+    size_t shard_index;
+
+    while ((shard_index = atomic_fetch_add(&input->next_shard, 1)) < s_table->shard_count) {
+        struct hash_table* shard = s_table->shards[shard_index];
+        size_t start = input->shard_starts[shard_index];
+        size_t end = input->shard_starts[shard_index + 1];
+        unsigned char success = hash_table_reserve(shard, hash_table_size(shard) + (end - start));
+
+        for (size_t i = start; i < end; i++) {
+            size_t index = input->sorted[i].index;
+
+            if (input->values[index] == NULL ||
+                !hash_table_add_hashed(shard, input->keys[index], input->key_lengths[index],
+                                       input->values[index], input->value_lengths[index],
+                                       input->sorted[i].hash)) {
+                success = 0;
+            }
+        }
+
+        if (!success) {
+            atomic_store(&input->success, 0);
+        }
+    }
+    return NULL;
+}
+
+//Take shards one at a time and merge them into
+//the same shard of the destination.
+static void* merge_shards(void* arg) {
+    struct merge_work* work = arg;
+    size_t shard_index;
+
+    while ((shard_index = atomic_fetch_add(work->next_shard, 1)) < work->source->shard_count) {
+        if (!hash_table_merge(work->destination->shards[shard_index], work->source->shards[shard_index],
+                              work->combine)) {
+            atomic_store(work->success, 0);
+        }
+    }
+    return NULL;
+}
+
+/* Public ShardedHashTable functions */
+
+//Create a new sharded hash table of shard_count shards,
+//each created with options. Returns NULL on failure.
+struct hash_table_sharded* hash_table_sharded_new(size_t shard_count,
+                                                  const struct hash_table_options* options) {
+    if (shard_count == 0) {
+        shard_count = DEFAULT_SHARD_COUNT;
+    }
+    unsigned int shard_bits = 0;
+
+    while (shard_bits < 32 && ((size_t)1 << shard_bits) < shard_count) {
+        shard_bits++;
+    }
+    shard_count = (size_t)1 << shard_bits;
+    struct hash_table_options shard_options;
+
+    if (options != NULL) {
+        shard_options = *options;
+    } else {
+        hash_table_options_init(&shard_options);
+    }
+    //Draw one random seed for every shard, by hashing
+    //with a table that picked a random seed of its own.
+    if (shard_options.randomize_seed) {
+        struct hash_table* seed_table = hash_table_new_with_options(&shard_options);
+
+        if (seed_table == NULL) {
+            return NULL;
+        }
+        shard_options.seed = hash_table_hash(seed_table, &seed_table, sizeof(seed_table));
+        shard_options.randomize_seed = 0;
+        hash_table_free(seed_table);
+    }
+
+    if (shard_options.hash_function == NULL) {
+        shard_options.hash_function = hash_table_hash_default;
+    }
+    shard_options.initial_capacity = (shard_options.initial_capacity + shard_count - 1) / shard_count;
+    struct hash_table_sharded* new_table = malloc(sizeof(struct hash_table_sharded));
+
+    if (new_table == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+    new_table->shards = malloc(sizeof(struct hash_table*) * shard_count);
+
+    if (new_table->shards == NULL) {
+        free(new_table);
+        fprintf(stderr, "Error. System out of memory.\n");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < shard_count; i++) {
+        new_table->shards[i] = hash_table_new_with_options(&shard_options);
+
+        if (new_table->shards[i] == NULL) {
+            for (size_t j = 0; j < i; j++) {
+                hash_table_free(new_table->shards[j]);
+            }
+            free(new_table->shards);
+            free(new_table);
+            return NULL;
+        }
+    }
+    new_table->shard_count = shard_count;
+    new_table->shard_bits = shard_bits;
+    new_table->hash_function = shard_options.hash_function;
+    new_table->seed = shard_options.seed;
+    return new_table;
+}
+
+//free a passed sharded hash table from memory.
+void hash_table_sharded_free(struct hash_table_sharded* s_table) {
+    //Make sure that the passed table actually exists.
+    if (s_table == NULL) {
+        fprintf(stderr, "Error. Attempting to free a NULL sharded hash table.\n");
+        return;
+    }
+
+    for (size_t i = 0; i < s_table->shard_count; i++) {
+        hash_table_free(s_table->shards[i]);
+    }
+    free(s_table->shards);
+    free(s_table);
+}
+
+//Add the passed value to the shard of the key passed.
+//function will return 1 on success, 0 on failure or when
+//the key is already stored.
+unsigned char hash_table_sharded_add(struct hash_table_sharded* s_table, void* key, size_t key_length,
+                                     void* value, size_t value_length) {
+    //Make sure that parameters passed exist.
+    if (s_table == NULL || key == NULL || value == NULL) {
+        fprintf(stderr, "Error. NULL s_table, key or value passed to hash_table_sharded_add.\n");
+        return 0;
+    }
+    //Hash the key once, for picking
+    //the shard and probing it.
+    uint64_t key_hash = hash_table_hash(s_table->shards[0], key, key_length);
+    return hash_table_add_hashed(s_table->shards[shard_for_hash(s_table, key_hash)], key, key_length,
+                                 value, value_length, key_hash);
+}
+
+//removes the value stored at the key passed
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_sharded_remove(struct hash_table_sharded* s_table, void* key, size_t key_length) {
+    //Make sure that parameters passed exist.
+    if (s_table == NULL || key == NULL) {
+        fprintf(stderr, "Error. Either NULL s_table or NULL key passed to hash_table_sharded_remove.\n");
+        return 0;
+    }
+    uint64_t key_hash = hash_table_hash(s_table->shards[0], key, key_length);
+    return hash_table_remove(s_table->shards[shard_for_hash(s_table, key_hash)], key, key_length);
+}
+
+//returns the value stored at the key passed.
+//will return null if there is nothing stored at the key passed.
+struct hash_table_key_value hash_table_sharded_get(struct hash_table_sharded* s_table, void* key,
+                                                   size_t key_length) {
+    //Make sure that the parameters passed exist
+    if (s_table == NULL || key == NULL) {
+        struct hash_table_key_value value_to_return = {NULL, 0, NULL, 0};
+        fprintf(stderr, "Error. either NULL key or table passed to hash_table_sharded_get.\n");
+        return value_to_return;
+    }
+    uint64_t key_hash = hash_table_hash(s_table->shards[0], key, key_length);
+    return hash_table_get_hashed(s_table->shards[shard_for_hash(s_table, key_hash)], key, key_length,
+                                 key_hash);
+}
+
+//returns the number of elements stored in every shard.
+size_t hash_table_sharded_size(struct hash_table_sharded* s_table) {
+    //can't have any elements in it then
+    if (s_table == NULL) {
+        return 0;
+    }
+    size_t size = 0;
+
+    for (size_t i = 0; i < s_table->shard_count; i++) {
+        size += hash_table_size(s_table->shards[i]);
+    }
+    return size;
+}
+
+//returns the number of shards the table is split into.
+size_t hash_table_sharded_shard_count(struct hash_table_sharded* s_table) {
+    if (s_table == NULL) {
+        return 0;
+    }
+    return s_table->shard_count;
+}
+
+//returns shard index of the table, NULL when there is none.
+struct hash_table* hash_table_sharded_shard(struct hash_table_sharded* s_table, size_t index) {
+    if (s_table == NULL || index >= s_table->shard_count) {
+        fprintf(stderr, "Error. NULL s_table or invalid index passed to hash_table_sharded_shard.\n");
+        return NULL;
+    }
+    return s_table->shards[index];
+}
+
+//Add count key value pairs using up to thread_count threads.
+//Threads first hash their part of the pairs and count them
+//by shard. The counts give every thread its own range of each
+//shard's part of sorted, which the threads then store their
+//pairs in, keeping their order. Last, threads take whole shards
+//and add their pairs, so no two threads touch the same shard.
+//function will return 1 when every pair was added, 0 when
+//one failed or its key was already stored.
+unsigned char hash_table_sharded_build(struct hash_table_sharded* s_table, void* const keys[],
+                                       const size_t key_lengths[], void* const values[],
+                                       const size_t value_lengths[], size_t count, size_t thread_count) {
+    //Make sure that the parameters passed exist
+    if (s_table == NULL || keys == NULL || key_lengths == NULL || values == NULL || value_lengths == NULL) {
+        fprintf(stderr, "Error. NULL table, keys, key_lengths, values or value_lengths "
+                        "passed to hash_table_sharded_build.\n");
+        return 0;
+    }
+    thread_count = threads_to_use(thread_count);
+    //Give every thread enough pairs to be worth starting.
+    if (thread_count > count / MINIMUM_PAIRS_PER_THREAD) {
+        thread_count = count / MINIMUM_PAIRS_PER_THREAD > 0 ? count / MINIMUM_PAIRS_PER_THREAD : 1;
+    }
+    struct build_input input;
+    input.s_table = s_table;
+    input.keys = keys;
+    input.key_lengths = key_lengths;
+    input.values = values;
+    input.value_lengths = value_lengths;
+    input.hashes = malloc(sizeof(uint64_t) * (count + 1));
+    input.sorted = malloc(sizeof(struct sorted_pair) * (count + 1));
+    input.shard_starts = malloc(sizeof(size_t) * (s_table->shard_count + 1));
+    atomic_init(&input.next_shard, 0);
+    atomic_init(&input.success, 1);
+    struct build_work* work = malloc(sizeof(struct build_work) * thread_count);
+    size_t* shard_positions = calloc(thread_count * s_table->shard_count, sizeof(size_t));
+
+    if (input.hashes == NULL || input.sorted == NULL || input.shard_starts == NULL || work == NULL ||
+        shard_positions == NULL) {
+        free(input.hashes);
+        free(input.sorted);
+        free(input.shard_starts);
+        free(work);
+        free(shard_positions);
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+
+    for (size_t t = 0; t < thread_count; t++) {
+        work[t].input = &input;
+        work[t].start = count / thread_count * t;
+        work[t].end = t + 1 == thread_count ? count : count / thread_count * (t + 1);
+        work[t].shard_positions = shard_positions + t * s_table->shard_count;
+    }
+    run_threads(hash_pairs, work, sizeof(struct build_work), thread_count);
+    //Lay each shard's pairs out thread after thread, so the
+    //pairs of a shard stay in the order they were passed in.
+    size_t position = 0;
+
+    for (size_t s = 0; s < s_table->shard_count; s++) {
+        input.shard_starts[s] = position;
+
+        for (size_t t = 0; t < thread_count; t++) {
+            size_t thread_pairs = work[t].shard_positions[s];
+            work[t].shard_positions[s] = position;
+            position += thread_pairs;
+        }
+    }
+    input.shard_starts[s_table->shard_count] = position;
+    run_threads(sort_pairs, work, sizeof(struct build_work), thread_count);
+    run_threads(fill_shards, work, sizeof(struct build_work), thread_count);
+    unsigned char success = atomic_load(&input.success);
+    //NULL keys were skipped, rather than added.
+    if (position != count) {
+        fprintf(stderr, "Error. NULL key passed to hash_table_sharded_build.\n");
+        success = 0;
+    }
+    free(input.hashes);
+    free(input.sorted);
+    free(input.shard_starts);
+    free(work);
+    free(shard_positions);
+    return success;
+}
+
+//Merge every shard of source into the same shard
+//of destination, using up to thread_count threads.
+//returns 1 on success, 0 on failure.
+unsigned char hash_table_sharded_merge(struct hash_table_sharded* destination,
+                                       struct hash_table_sharded* source,
+                                       hash_table_combine_function combine, size_t thread_count) {
+    //Make sure that the parameters passed exist
+    if (destination == NULL || source == NULL || destination == source) {
+        fprintf(stderr, "Error. NULL or identical tables passed to hash_table_sharded_merge.\n");
+        return 0;
+    }
+    //Keys only belong to the same shard of both
+    //tables when the tables split them alike.
+    if (destination->shard_count != source->shard_count || destination->hash_function != source->hash_function ||
+        destination->seed != source->seed) {
+        fprintf(stderr, "Error. hash_table_sharded_merge needs tables of the same shard count, "
+                        "hash function and seed.\n");
+        return 0;
+    }
+    thread_count = threads_to_use(thread_count);
+
+    if (thread_count > source->shard_count) {
+        thread_count = source->shard_count;
+    }
+    struct merge_work* work = malloc(sizeof(struct merge_work) * thread_count);
+
+    if (work == NULL) {
+        fprintf(stderr, "Error. System out of memory.\n");
+        return 0;
+    }
+    _Atomic size_t next_shard;
+    _Atomic unsigned char success;
+    atomic_init(&next_shard, 0);
+    atomic_init(&success, 1);
+
+    for (size_t t = 0; t < thread_count; t++) {
+        work[t].destination = destination;
+        work[t].source = source;
+        work[t].combine = combine;
+        work[t].next_shard = &next_shard;
+        work[t].success = &success;
+    }
+    run_threads(merge_shards, work, sizeof(struct merge_work), thread_count);
+    free(work);
+    return atomic_load(&success);
+}
@@ -0,0 +1,66 @@
+#ifndef WC_SHARDED_HASH_TABLE_H
+    #define WC_SHARDED_HASH_TABLE_H
+    #include <stddef.h>
+    #include "WC_HashTable.h"
+    //A hash table split into independent hash tables, its shards.
+    //The high bits of a key's hash pick the shard it is stored in,
+    //so a lookup hashes the key once and probes only its shard.
+    //Since no two shards hold the same key, they can be filled
+    //and merged by separate threads without any locks.
+    //
+    //A sharded table is not itself safe to change from many
+    //threads at once, outside of hash_table_sharded_build and
+    //hash_table_sharded_merge.
+    struct hash_table_sharded;
+    //Create a new sharded hash table of shard_count shards,
+    //rounded up to a power of two. Passing 0 for shard_count
+    //uses a default. Every shard is created with options, or the
+    //defaults when options is NULL, except that they all share
+    //one seed, and initial_capacity is spread across them.
+    //Returns NULL on failure.
+    struct hash_table_sharded* hash_table_sharded_new(size_t shard_count,
+                                                      const struct hash_table_options* options);
+    //free a passed sharded hash table from memory.
+    void hash_table_sharded_free(struct hash_table_sharded* s_table);
+    //Add the passed value to the shard of the key passed,
+    //as hash_table_add does.
+    //function will return 1 on success, 0 on failure or when
+    //the key is already stored, leaving its value unchanged.
+    unsigned char hash_table_sharded_add(struct hash_table_sharded* s_table, void* key, size_t key_length,
+                                         void* value, size_t value_length);
+    //removes the value stored at the key passed
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_sharded_remove(struct hash_table_sharded* s_table, void* key, size_t key_length);
+    //returns the value stored at the key passed.
+    //will return null if there is nothing stored at the key passed.
+    struct hash_table_key_value hash_table_sharded_get(struct hash_table_sharded* s_table, void* key,
+                                                       size_t key_length);
+    //returns the number of elements stored in every shard.
+    size_t hash_table_sharded_size(struct hash_table_sharded* s_table);
+    //returns the number of shards the table is split into.
+    size_t hash_table_sharded_shard_count(struct hash_table_sharded* s_table);
+    //returns shard index of the table, for reading it, such as
+    //with an iterator. Keys must not be added to a shard directly,
+    //since they may belong to another one.
+    //Returns NULL when there is no such shard.
+    struct hash_table* hash_table_sharded_shard(struct hash_table_sharded* s_table, size_t index);
+    //Add count key value pairs, keys[i] and values[i], using up
+    //to thread_count threads, or one per processor when it is 0.
+    //The pairs are hashed and split by shard in parallel, then
+    //each thread fills whole shards of its own. Pairs end up
+    //stored as calling hash_table_sharded_add for them in order
+    //would store them.
+    //function will return 1 when every pair was added, 0 when
+    //one failed or its key was already stored.
+    unsigned char hash_table_sharded_build(struct hash_table_sharded* s_table, void* const keys[],
+                                           const size_t key_lengths[], void* const values[],
+                                           const size_t value_lengths[], size_t count, size_t thread_count);
+    //Merge every shard of source into the same shard of destination
+    //with hash_table_merge, using up to thread_count threads, or one
+    //per processor when it is 0. Both tables must have been created
+    //with the same shard count, hash function and seed.
+    //returns 1 on success, 0 on failure.
+    unsigned char hash_table_sharded_merge(struct hash_table_sharded* destination,
+                                           struct hash_table_sharded* source,
+                                           hash_table_combine_function combine, size_t thread_count);
+#endif
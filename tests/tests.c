@@ -1,6 +1,1228 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include "WC_HashTable.h"
+#include "WC_HashTableTyped.h"
+#include "WC_ConcurrentHashTable.h"
+#include "WC_PerfectHashTable.h"
+#include "WC_ShardedHashTable.h"
+
+//Print a message and count a failure
+//when condition doesn't hold.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "Check failed: %s (%s:%d)\n", #condition, __FILE__, __LINE__); \
+            failures++; \
+        } \
+    } while (0)
+
+//Number of checks that failed.
+static int failures = 0;
+
+//Churn a table through millions of insert/remove cycles while
+//keeping its size constant, and make sure deleted slots don't
+//make probes longer as the churn goes on.
+static void test_churn_probe_length(void) {
+    const size_t live_keys = 10000;
+    const size_t cycles = 2000000;
+    struct hash_table* table = hash_table_new();
+    char key[32];
+
+    for (size_t i = 0; i < live_keys; i++) {
+        size_t key_length = (size_t)sprintf(key, "churn%zu", i);
+        hash_table_add(table, key, key_length, &i, sizeof(i));
+    }
+    double initial_probe_length = hash_table_mean_miss_probe_length(table);
+    double worst_probe_length = initial_probe_length;
+
+    for (size_t i = 0; i < cycles; i++) {
+        //Add a new key, then remove the oldest one.
+        size_t new_index = i + live_keys;
+        size_t key_length = (size_t)sprintf(key, "churn%zu", new_index);
+        hash_table_add(table, key, key_length, &new_index, sizeof(new_index));
+        key_length = (size_t)sprintf(key, "churn%zu", i);
+        CHECK(hash_table_remove(table, key, key_length) == 1);
+
+        if (i % 100000 == 0) {
+            double probe_length = hash_table_mean_miss_probe_length(table);
+
+            if (probe_length > worst_probe_length) {
+                worst_probe_length = probe_length;
+            }
+        }
+    }
+    CHECK(hash_table_size(table) == live_keys);
+    //The live keys must all still be found.
+    for (size_t i = cycles; i < cycles + live_keys; i++) {
+        size_t key_length = (size_t)sprintf(key, "churn%zu", i);
+        struct hash_table_key_value found = hash_table_get(table, key, key_length);
+        CHECK(found.value != NULL && *(const size_t*)found.value == i);
+    }
+    printf("Mean miss probe length: %.3f initially, %.3f at worst during churn.\n",
+           initial_probe_length, worst_probe_length);
+    //Deleted slots are cleared out before they pile up, so
+    //probes stay within a few groups however long the churn runs.
+    CHECK(worst_probe_length < 4.0);
+    hash_table_free(table);
+}
+
+//Build the key and value test_arena stores for index i, with
+//lengths spread over both inline and heap sized keys and values.
+//Returns the key's length, storing the value's in value_length.
+static size_t arena_pair(size_t i, unsigned int round, char* key, unsigned char* value,
+                         size_t* value_length) {
+    size_t key_length = (size_t)sprintf(key, "%zu%.*s", i, (int)(i % 40), "arena padding to vary the key length");
+    *value_length = i % 97 + 1;
+    memset(value, (int)((i + round) & 0xFF), *value_length);
+    return key_length;
+}
+
+//Make sure an arena backed table stores keys and values of
+//mixed sizes, reuses the blocks removed elements give back,
+//and can be cleared and filled again.
+static void test_arena(void) {
+    enum { ARENA_KEYS = 5000 };
+    //Small chunks, so the arena has to grow many times.
+    struct hash_table* table = hash_table_new_with_arena(1024);
+    char key[64];
+    unsigned char value[128];
+    size_t value_length;
+    CHECK(table != NULL);
+
+    for (unsigned int round = 0; round < 2; round++) {
+        for (size_t i = 0; i < ARENA_KEYS; i++) {
+            size_t key_length = arena_pair(i, round, key, value, &value_length);
+            CHECK(hash_table_add(table, key, key_length, value, value_length) == 1);
+        }
+        CHECK(hash_table_size(table) == ARENA_KEYS);
+        //Remove every third key, then add them back with new
+        //values, taking blocks off the size class free lists.
+        for (size_t i = 0; i < ARENA_KEYS; i += 3) {
+            size_t key_length = arena_pair(i, round, key, value, &value_length);
+            CHECK(hash_table_remove(table, key, key_length) == 1);
+        }
+        CHECK(hash_table_size(table) == ARENA_KEYS - (ARENA_KEYS + 2) / 3);
+
+        for (size_t i = 0; i < ARENA_KEYS; i += 3) {
+            size_t key_length = arena_pair(i, round + 1, key, value, &value_length);
+            CHECK(hash_table_add(table, key, key_length, value, value_length) == 1);
+        }
+        CHECK(hash_table_size(table) == ARENA_KEYS);
+
+        for (size_t i = 0; i < ARENA_KEYS; i++) {
+            size_t key_length = arena_pair(i, i % 3 == 0 ? round + 1 : round, key, value, &value_length);
+            struct hash_table_key_value found = hash_table_get(table, key, key_length);
+            CHECK(found.value != NULL && found.value_length == value_length &&
+                  memcmp(found.value, value, value_length) == 0);
+        }
+        //Clearing hands the whole arena back for the next round.
+        hash_table_clear(table);
+        CHECK(hash_table_size(table) == 0);
+        CHECK(hash_table_get(table, key, strlen(key)).value == NULL);
+    }
+    hash_table_free(table);
+}
+
+//Make sure djb2 can still be picked as a table's hash
+//function, and that the seed changes the hashes keys get.
+static void test_hash_functions(void) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.hash_function = hash_table_hash_djb2;
+    struct hash_table* table = hash_table_new_with_options(&options);
+    char key[32];
+    //djb2 with a seed of 0 is the classic function.
+    CHECK(hash_table_hash(table, "a", 1) == 5381 * 33 + 'a');
+
+    for (size_t i = 0; i < 2000; i++) {
+        size_t key_length = (size_t)sprintf(key, "djb2%zu", i);
+        CHECK(hash_table_add(table, key, key_length, &i, sizeof(i)) == 1);
+    }
+
+    for (size_t i = 0; i < 2000; i += 2) {
+        size_t key_length = (size_t)sprintf(key, "djb2%zu", i);
+        CHECK(hash_table_remove(table, key, key_length) == 1);
+    }
+    CHECK(hash_table_size(table) == 1000);
+
+    for (size_t i = 0; i < 2000; i++) {
+        size_t key_length = (size_t)sprintf(key, "djb2%zu", i);
+        struct hash_table_key_value found = hash_table_get(table, key, key_length);
+        CHECK(i % 2 == 0 ? found.value == NULL : found.value != NULL && *(const size_t*)found.value == i);
+    }
+    hash_table_free(table);
+    //Tables seeded differently hash the same key differently,
+    //with either hash function.
+    for (unsigned char djb2 = 0; djb2 < 2; djb2++) {
+        options.hash_function = djb2 ? hash_table_hash_djb2 : NULL;
+        options.seed = 1;
+        struct hash_table* one = hash_table_new_with_options(&options);
+        options.seed = 2;
+        struct hash_table* two = hash_table_new_with_options(&options);
+        CHECK(hash_table_hash(one, "seeded key", 10) != hash_table_hash(two, "seeded key", 10));
+        hash_table_free(one);
+        hash_table_free(two);
+    }
+}
+
+//Make sure presized tables fill without resizing, that shrinking
+//a drained table gives slots back and keeps the keys left, and
+//that reserve leaves no incremental resize half done.
+static void test_capacity(void) {
+    enum { CAPACITY_KEYS = 20000 };
+    struct hash_table* table = hash_table_new_with_capacity(CAPACITY_KEYS);
+    struct hash_table_stats stats;
+    char key[32];
+
+    for (size_t i = 0; i < CAPACITY_KEYS; i++) {
+        size_t key_length = (size_t)sprintf(key, "capacity%zu", i);
+        hash_table_add(table, key, key_length, &i, sizeof(i));
+    }
+    CHECK(hash_table_stats(table, &stats) == 1);
+    CHECK(stats.elements_stored == CAPACITY_KEYS && stats.resize_count == 0);
+    size_t full_slot_count = stats.slot_count;
+    //Drain all but every hundredth key, then shrink.
+    for (size_t i = 0; i < CAPACITY_KEYS; i++) {
+        if (i % 100 != 0) {
+            size_t key_length = (size_t)sprintf(key, "capacity%zu", i);
+            CHECK(hash_table_remove(table, key, key_length) == 1);
+        }
+    }
+    CHECK(hash_table_shrink_to_fit(table) == 1);
+    CHECK(hash_table_stats(table, &stats) == 1);
+    CHECK(stats.slot_count < full_slot_count / 32 && stats.tombstones == 0);
+    CHECK(hash_table_size(table) == CAPACITY_KEYS / 100);
+
+    for (size_t i = 0; i < CAPACITY_KEYS; i += 100) {
+        size_t key_length = (size_t)sprintf(key, "capacity%zu", i);
+        struct hash_table_key_value found = hash_table_get(table, key, key_length);
+        CHECK(found.value != NULL && *(const size_t*)found.value == i);
+    }
+    hash_table_free(table);
+    //An incremental table reserving room has moved every
+    //element by the time reserve returns, so its only slots
+    //are those of the new, power of two sized array.
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.incremental_resize = 1;
+    table = hash_table_new_with_options(&options);
+
+    for (size_t i = 0; i < 1000; i++) {
+        size_t key_length = (size_t)sprintf(key, "capacity%zu", i);
+        hash_table_add(table, key, key_length, &i, sizeof(i));
+    }
+    CHECK(hash_table_reserve(table, CAPACITY_KEYS) == 1);
+    CHECK(hash_table_stats(table, &stats) == 1);
+    size_t resize_count = stats.resize_count;
+    CHECK((stats.slot_count & (stats.slot_count - 1)) == 0);
+    CHECK(stats.slot_count >= CAPACITY_KEYS);
+
+    for (size_t i = 1000; i < CAPACITY_KEYS; i++) {
+        size_t key_length = (size_t)sprintf(key, "capacity%zu", i);
+        hash_table_add(table, key, key_length, &i, sizeof(i));
+    }
+    CHECK(hash_table_stats(table, &stats) == 1);
+    CHECK(stats.resize_count == resize_count && stats.elements_stored == CAPACITY_KEYS);
+
+    for (size_t i = 0; i < CAPACITY_KEYS; i++) {
+        size_t key_length = (size_t)sprintf(key, "capacity%zu", i);
+        CHECK(hash_table_get(table, key, key_length).value != NULL);
+    }
+    hash_table_free(table);
+}
+
+//Fill tables with hash_table_add_batch, and make sure
+//hash_table_get_batch agrees with hash_table_get for keys
+//that are stored and keys that aren't.
+static void test_batch(void) {
+    enum { stored_keys = 5000, looked_up_keys = 10000 };
+    static char key_storage[looked_up_keys][32];
+    static void* keys[looked_up_keys];
+    static size_t key_lengths[looked_up_keys];
+    static size_t values[looked_up_keys];
+    static void* value_pointers[looked_up_keys];
+    static size_t value_lengths[looked_up_keys];
+    static struct hash_table_key_value results[looked_up_keys];
+
+    for (size_t i = 0; i < looked_up_keys; i++) {
+        key_lengths[i] = (size_t)sprintf(key_storage[i], "batch%zu", i);
+        keys[i] = key_storage[i];
+        values[i] = i;
+        value_pointers[i] = &values[i];
+        value_lengths[i] = sizeof(values[i]);
+    }
+    enum hash_table_probing probings[2] = {HASH_TABLE_PROBING_GROUPS, HASH_TABLE_PROBING_ROBIN_HOOD};
+
+    for (size_t p = 0; p < 2; p++) {
+        struct hash_table_options options;
+        hash_table_options_init(&options);
+        options.probing = probings[p];
+        options.incremental_resize = 1;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        //Add in a few uneven batches.
+        CHECK(hash_table_add_batch(table, keys, key_lengths, value_pointers, value_lengths, 37) == 1);
+        CHECK(hash_table_add_batch(table, keys + 37, key_lengths + 37, value_pointers + 37,
+                                   value_lengths + 37, stored_keys - 37) == 1);
+        CHECK(hash_table_size(table) == stored_keys);
+        hash_table_get_batch(table, keys, key_lengths, looked_up_keys, results);
+
+        for (size_t i = 0; i < looked_up_keys; i++) {
+            struct hash_table_key_value expected = hash_table_get(table, keys[i], key_lengths[i]);
+            CHECK(results[i].value == expected.value);
+            CHECK(results[i].value_length == expected.value_length);
+            CHECK((results[i].value != NULL) == (i < stored_keys));
+        }
+        hash_table_free(table);
+    }
+}
+
+//Returns 1 when h_table is part way through an incremental
+//resize, going by the old slots stats counts on top of the
+//new table's power of two.
+static unsigned char resize_in_progress(struct hash_table* h_table) {
+    struct hash_table_stats stats;
+    hash_table_stats(h_table, &stats);
+    return (stats.slot_count & (stats.slot_count - 1)) != 0;
+}
+
+//Make sure batch operations on a table part way through an
+//incremental resize find the keys still in the old slots, and
+//only move the resize along as far as single operations do.
+static void test_batch_incremental(void) {
+    enum { BATCH_KEYS = 3000 };
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.incremental_resize = 1;
+
+    for (unsigned char robin_hood = 0; robin_hood < 2; robin_hood++) {
+        options.probing = robin_hood ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        char (*keys)[32] = malloc(sizeof(*keys) * BATCH_KEYS * 2);
+        void* key_pointers[BATCH_KEYS * 2];
+        size_t key_lengths[BATCH_KEYS * 2];
+        size_t values[BATCH_KEYS * 2];
+        void* value_pointers[BATCH_KEYS * 2];
+        size_t value_lengths[BATCH_KEYS * 2];
+        struct hash_table_key_value results[BATCH_KEYS * 2];
+        size_t stored = 0;
+
+        for (size_t i = 0; i < BATCH_KEYS * 2; i++) {
+            key_lengths[i] = (size_t)sprintf(keys[i], "incremental%zu", i);
+            key_pointers[i] = keys[i];
+            values[i] = i;
+            value_pointers[i] = &values[i];
+            value_lengths[i] = sizeof(size_t);
+        }
+        //Add keys until one starts a resize, once the
+        //table is big enough for it to take a while.
+        while (stored < BATCH_KEYS && (stored < 1000 || !resize_in_progress(table))) {
+            hash_table_add(table, keys[stored], key_lengths[stored], &values[stored], sizeof(size_t));
+            stored++;
+        }
+        CHECK(resize_in_progress(table));
+        //Adding a few keys mustn't finish the resize.
+        CHECK(hash_table_add_batch(table, key_pointers + stored, key_lengths + stored, value_pointers + stored,
+                                   value_lengths + stored, 16) == 1);
+        CHECK(resize_in_progress(table));
+        stored += 16;
+        //Look up the stored keys and as many missing ones.
+        hash_table_get_batch(table, key_pointers, key_lengths, stored * 2, results);
+        CHECK(resize_in_progress(table));
+        //Inline values move along with their slots, so read
+        //the results before hash_table_get moves any more.
+        for (size_t i = 0; i < stored * 2; i++) {
+            CHECK(i < stored ? results[i].value != NULL && results[i].value_length == sizeof(size_t) &&
+                                   *(const size_t*)results[i].value == i :
+                               results[i].value == NULL);
+        }
+
+        for (size_t i = 0; i < stored * 2; i++) {
+            struct hash_table_key_value found = hash_table_get(table, keys[i], key_lengths[i]);
+            CHECK((results[i].value == NULL) == (found.value == NULL));
+        }
+        free(keys);
+        hash_table_free(table);
+    }
+}
+
+//Make sure keys and values around the size stored in a
+//slot itself are told apart and come back intact.
+static void test_inline_keys(void) {
+    struct hash_table* table = hash_table_new();
+    //Keys that only differ in length or in their last byte.
+    const char* keys[] = {"", "a", "abc", "abc\0", "abcdefghijklmn", "abcdefghijklmno",
+                          "abcdefghijklmnop", "abcdefghijklmnoq", "abcdefghijklmnopq"};
+    size_t key_lengths[] = {0, 1, 3, 4, 14, 15, 16, 16, 17};
+    const char values[] = "0123456789abcdef";
+    const size_t key_count = sizeof(key_lengths) / sizeof(key_lengths[0]);
+
+    for (size_t i = 0; i < key_count; i++) {
+        //Value lengths of 0 to 16 bytes.
+        hash_table_add(table, (void*)keys[i], key_lengths[i], (void*)values, i * 2);
+    }
+    CHECK(hash_table_size(table) == key_count);
+
+    for (size_t i = 0; i < key_count; i++) {
+        struct hash_table_key_value found = hash_table_get(table, (void*)keys[i], key_lengths[i]);
+        CHECK(found.value != NULL && found.value_length == i * 2 &&
+              memcmp(found.value, values, i * 2) == 0);
+    }
+    CHECK(hash_table_get(table, "ab", 2).value == NULL);
+    CHECK(hash_table_remove(table, "abc", 3) == 1);
+    CHECK(hash_table_get(table, "abc\0", 4).value != NULL);
+    hash_table_free(table);
+}
+
+//Hash function sending every key of a length to the same hash,
+//so lookups can only tell keys apart by comparing them.
+static uint64_t length_hash(const void* key, size_t key_length, uint64_t seed) {
+    (void)key;
+    return (uint64_t)key_length * 0x9E3779B97F4A7C15ULL + seed;
+}
+
+//Look up random keys of 1 to 256 bytes that are equal to, or
+//differ in one byte from, a stored key, and make sure the table
+//agrees with memcmp about which ones match.
+static void test_key_compare(void) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.hash_function = length_hash;
+    uint64_t random_state = 777;
+    unsigned char stored[256];
+    unsigned char probe[256];
+
+    for (size_t round = 0; round < 4000; round++) {
+        struct hash_table* table = hash_table_new_with_options(&options);
+        random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t length = 1 + (size_t)(random_state >> 33) % 256;
+
+        for (size_t i = 0; i < length; i++) {
+            random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+            stored[i] = (unsigned char)(random_state >> 56);
+        }
+        memcpy(probe, stored, length);
+        //Change one byte of most probes.
+        if (round % 4 != 0) {
+            random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+            probe[(random_state >> 33) % length] ^= (unsigned char)(1 + (random_state >> 56) % 255);
+        }
+        hash_table_add(table, stored, length, &round, sizeof(round));
+        struct hash_table_key_value found = hash_table_get(table, probe, length);
+        CHECK((found.value != NULL) == (memcmp(stored, probe, length) == 0));
+        hash_table_free(table);
+    }
+}
+
+//A table from 64 bit ids to counts.
+WC_HASHTABLE_DEFINE_U64(id_table, size_t)
+
+//Run random puts, gets and removes on a typed table, checking
+//every result against a plain array of the expected values.
+static void test_typed(void) {
+    enum { key_range = 4096 };
+    static size_t expected[key_range];
+    static unsigned char present[key_range];
+    struct id_table* table = id_table_new(0);
+    uint64_t random_state = 12345;
+    size_t stored = 0;
+
+    for (size_t step = 0; step < 400000; step++) {
+        random_state = random_state * 6364136223846793005ULL + 1442695040888963407ULL;
+        size_t id = (size_t)(random_state >> 33) % key_range;
+        //Spread the ids over the whole 64 bit range.
+        uint64_t key = (uint64_t)id * 0x9E3779B97F4A7C15ULL;
+
+        switch ((random_state >> 20) % 3) {
+            case 0:
+                CHECK(id_table_put(table, key, step) == 1);
+                stored += !present[id];
+                present[id] = 1;
+                expected[id] = step;
+                break;
+            case 1:
+                CHECK(id_table_remove(table, key) == present[id]);
+                stored -= present[id];
+                present[id] = 0;
+                break;
+            default: {
+                size_t* value = id_table_get(table, key);
+                CHECK((value != NULL) == present[id]);
+                CHECK(value == NULL || *value == expected[id]);
+            }
+        }
+    }
+    CHECK(id_table_size(table) == stored);
+    id_table_clear(table);
+    CHECK(id_table_size(table) == 0 && id_table_get(table, 0) == NULL);
+    id_table_free(table);
+}
+
+//Number of borrowed keys and values freed by count_free.
+static size_t borrowed_frees = 0;
+
+//Free function counting what the table hands back.
+static void count_free(void* pointer) {
+    borrowed_frees++;
+    free(pointer);
+}
+
+//Make sure borrowing tables store the caller's pointers, and
+//hand owned keys and values back on remove, clear and free.
+static void test_borrowed(void) {
+    static char words[] = "apple\0banana\0cherry";
+    static size_t counts[3] = {1, 2, 3};
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.borrow_keys_values = 1;
+    struct hash_table* table = hash_table_new_with_options(&options);
+    hash_table_add(table, words, 6, &counts[0], sizeof(counts[0]));
+    hash_table_add(table, words + 6, 7, &counts[1], sizeof(counts[1]));
+    hash_table_add(table, words + 13, 7, &counts[2], sizeof(counts[2]));
+    struct hash_table_key_value found = hash_table_get(table, "banana", 7);
+    CHECK(found.value == &counts[1]);
+    struct hash_table_key_value_iterator* iterator = hash_table_get_iterator(table);
+    struct hash_table_key_value pair;
+
+    while (hash_table_iterator_next(iterator, &pair)) {
+        CHECK((const char*)pair.key >= words && (const char*)pair.key < words + sizeof(words));
+    }
+    hash_table_iterator_free(iterator);
+    hash_table_free(table);
+    //Hand ownership to the table, with and without an arena.
+    options.key_free = count_free;
+    options.value_free = count_free;
+
+    for (unsigned char use_arena = 0; use_arena < 2; use_arena++) {
+        options.use_arena = use_arena;
+        table = hash_table_new_with_options(&options);
+        borrowed_frees = 0;
+
+        for (size_t i = 0; i < 100; i++) {
+            char* key = malloc(32);
+            size_t* value = malloc(sizeof(size_t));
+            *value = i;
+            size_t key_length = (size_t)sprintf(key, "owned%zu", i);
+            hash_table_add(table, key, key_length, value, sizeof(*value));
+        }
+        CHECK(hash_table_remove(table, "owned7", 6) == 1);
+        CHECK(borrowed_frees == 2);
+        hash_table_clear(table);
+        CHECK(borrowed_frees == 200);
+        char* key = malloc(8);
+        size_t* value = malloc(sizeof(size_t));
+        memcpy(key, "last", 5);
+        hash_table_add(table, key, 5, value, sizeof(*value));
+        hash_table_free(table);
+        CHECK(borrowed_frees == 202);
+    }
+    //A destination owning what it borrows would free the
+    //source's keys and values, so merging into it fails
+    //and leaves both tables as they were.
+    options.use_arena = 0;
+    struct hash_table* destination = hash_table_new_with_options(&options);
+    options.key_free = NULL;
+    options.value_free = NULL;
+    struct hash_table* source = hash_table_new_with_options(&options);
+    char* key = malloc(8);
+    size_t* value = malloc(sizeof(size_t));
+    memcpy(key, "apple", 6);
+    *value = 9;
+    hash_table_add(destination, key, 6, value, sizeof(*value));
+    hash_table_add(source, words, 6, &counts[0], sizeof(counts[0]));
+    hash_table_add(source, words + 6, 7, &counts[1], sizeof(counts[1]));
+    borrowed_frees = 0;
+    CHECK(hash_table_merge(destination, source, NULL) == 0);
+    CHECK(hash_table_size(destination) == 1 && hash_table_size(source) == 2);
+    CHECK(hash_table_get(destination, "apple", 6).value == value);
+    CHECK(hash_table_get(destination, "banana", 7).value == NULL);
+    CHECK(borrowed_frees == 0);
+    hash_table_free(source);
+    hash_table_free(destination);
+    CHECK(borrowed_frees == 2);
+}
+
+//Count words with get_or_insert, then make sure upsert replaces
+//values of any length, and that add leaves stored keys alone.
+static void test_upsert(void) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+
+    for (unsigned char mode = 0; mode < 4; mode++) {
+        options.incremental_resize = mode & 1;
+        options.probing = (mode & 2) ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        char key[32];
+        size_t zero = 0;
+        size_t words_added = 0;
+
+        for (size_t i = 0; i < 30000; i++) {
+            size_t key_length = (size_t)sprintf(key, "word%zu", i % 10000);
+            unsigned char inserted;
+            size_t* count = hash_table_get_or_insert(table, key, key_length, &zero, sizeof(zero), &inserted);
+            CHECK(count != NULL);
+            words_added += inserted;
+            (*count)++;
+        }
+        CHECK(words_added == 10000 && hash_table_size(table) == 10000);
+        struct hash_table_key_value found = hash_table_get(table, "word42", 6);
+        CHECK(found.value != NULL && *(const size_t*)found.value == 3);
+        //A stored key isn't replaced by add.
+        size_t other = 7;
+        CHECK(hash_table_add(table, "word42", 6, &other, sizeof(other)) == 0);
+        found = hash_table_get(table, "word42", 6);
+        CHECK(*(const size_t*)found.value == 3);
+        //Grow the value out of the slot and back into it.
+        static const char long_value[] = "a value too long to be stored inline";
+        unsigned char inserted = 1;
+        CHECK(hash_table_upsert(table, "word42", 6, (void*)long_value, sizeof(long_value), &inserted) != NULL);
+        CHECK(inserted == 0);
+        found = hash_table_get(table, "word42", 6);
+        CHECK(found.value_length == sizeof(long_value) && strcmp(found.value, long_value) == 0);
+        hash_table_upsert(table, "word42", 6, &other, sizeof(other), NULL);
+        found = hash_table_get(table, "word42", 6);
+        CHECK(found.value_length == sizeof(other) && *(const size_t*)found.value == 7);
+        hash_table_upsert(table, "new word", 9, &other, sizeof(other), &inserted);
+        CHECK(inserted == 1 && hash_table_size(table) == 10001);
+        hash_table_free(table);
+    }
+    //Borrowing tables free the value an upsert replaces.
+    hash_table_options_init(&options);
+    options.borrow_keys_values = 1;
+    options.value_free = count_free;
+    struct hash_table* table = hash_table_new_with_options(&options);
+    borrowed_frees = 0;
+    size_t* value = malloc(sizeof(size_t));
+    hash_table_upsert(table, "borrowed", 9, value, sizeof(*value), NULL);
+    value = malloc(sizeof(size_t));
+    CHECK(hash_table_upsert(table, "borrowed", 9, value, sizeof(*value), NULL) == value);
+    CHECK(borrowed_frees == 1);
+    hash_table_free(table);
+    CHECK(borrowed_frees == 2);
+}
+
+//Save tables to snapshots, open them again and make sure every
+//key is found in the mapped image, which can't be changed.
+static void test_snapshot(void) {
+    const char* path = "WCHT_test_snapshot.bin";
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+
+    for (unsigned char robin_hood = 0; robin_hood < 2; robin_hood++) {
+        options.probing = robin_hood ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        options.randomize_seed = 1;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        char key[64];
+
+        for (size_t i = 0; i < 20000; i++) {
+            //Mix keys stored in the slots with ones in elements.
+            size_t key_length = (size_t)sprintf(key, i % 2 ? "snap%zu" : "a longer snapshot key %zu", i);
+            hash_table_add(table, key, key_length, &i, sizeof(i));
+        }
+
+        for (size_t i = 0; i < 20000; i += 3) {
+            size_t key_length = (size_t)sprintf(key, i % 2 ? "snap%zu" : "a longer snapshot key %zu", i);
+            hash_table_remove(table, key, key_length);
+        }
+        CHECK(hash_table_save(table, path) == 1);
+        struct hash_table* snapshot = hash_table_open_mmap(path);
+        CHECK(snapshot != NULL && hash_table_snapshot_verify(snapshot) == 1);
+        CHECK(hash_table_size(snapshot) == hash_table_size(table));
+
+        for (size_t i = 0; i < 20000; i++) {
+            size_t key_length = (size_t)sprintf(key, i % 2 ? "snap%zu" : "a longer snapshot key %zu", i);
+            struct hash_table_key_value found = hash_table_get(snapshot, key, key_length);
+
+            if (i % 3 == 0) {
+                CHECK(found.value == NULL);
+            } else {
+                CHECK(found.value != NULL && *(const size_t*)found.value == i);
+            }
+        }
+        size_t pairs = 0;
+        struct hash_table_key_value_iterator* iterator = hash_table_get_iterator(snapshot);
+        struct hash_table_key_value pair;
+
+        while (hash_table_iterator_next(iterator, &pair)) {
+            pairs++;
+        }
+        hash_table_iterator_free(iterator);
+        CHECK(pairs == hash_table_size(table));
+        CHECK(hash_table_add(snapshot, "new", 3, &pairs, sizeof(pairs)) == 0);
+        CHECK(hash_table_remove(snapshot, "snap1", 5) == 0);
+        hash_table_free(snapshot);
+        hash_table_free(table);
+    }
+    //A changed byte is caught by the checksum.
+    FILE* file = fopen(path, "r+b");
+    fseek(file, -1, SEEK_END);
+    fputc(0x5A, file);
+    fclose(file);
+    struct hash_table* snapshot = hash_table_open_mmap(path);
+    CHECK(snapshot != NULL && hash_table_snapshot_verify(snapshot) == 0);
+    hash_table_free(snapshot);
+    //Files that aren't snapshots are refused.
+    file = fopen(path, "wb");
+    fputs("not a snapshot", file);
+    fclose(file);
+    CHECK(hash_table_open_mmap(path) == NULL);
+    remove(path);
+}
+
+//Freeze a table into a perfect hash table and make sure every
+//key maps to its own value, and missing keys to nothing.
+static void test_perfect_hash(void) {
+    struct hash_table* table = hash_table_new();
+    char key[64];
+
+    for (size_t i = 0; i < 50000; i++) {
+        size_t key_length = (size_t)sprintf(key, "perfect%zu", i);
+        hash_table_add(table, key, key_length, &i, sizeof(i));
+    }
+    struct hash_table_perfect* perfect = hash_table_perfect_build(table);
+    CHECK(perfect != NULL && hash_table_perfect_size(perfect) == 50000);
+    CHECK(hash_table_perfect_bits_per_key(perfect) < 5.0);
+
+    for (size_t i = 0; i < 60000; i++) {
+        size_t key_length = (size_t)sprintf(key, "perfect%zu", i);
+        struct hash_table_key_value found = hash_table_perfect_get(perfect, key, key_length);
+
+        if (i < 50000) {
+            CHECK(found.value != NULL && found.value_length == sizeof(i) && *(const size_t*)found.value == i);
+        } else {
+            CHECK(found.value == NULL);
+        }
+    }
+    hash_table_perfect_free(perfect);
+    hash_table_free(table);
+    //Keys passed twice can't be told apart.
+    struct hash_table_key_value pairs[3] = {
+        {"one", 3, "1", 1}, {"two", 3, "2", 1}, {"one", 3, "3", 1}
+    };
+    CHECK(hash_table_perfect_build_from_pairs(pairs, 3) == NULL);
+    perfect = hash_table_perfect_build_from_pairs(pairs, 2);
+    CHECK(perfect != NULL && hash_table_perfect_get(perfect, "two", 3).value != NULL);
+    hash_table_perfect_free(perfect);
+}
+
+//Make sure the statistics of a table add up, with and without
+//operation counters compiled in.
+static void test_stats(void) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+
+    for (unsigned char robin_hood = 0; robin_hood < 2; robin_hood++) {
+        options.probing = robin_hood ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        char key[64];
+        size_t key_bytes = 0;
+
+        for (size_t i = 0; i < 10000; i++) {
+            size_t key_length = (size_t)sprintf(key, i % 2 ? "stat%zu" : "a longer statistics key %zu", i);
+            hash_table_add(table, key, key_length, &i, sizeof(i));
+            key_bytes += key_length;
+        }
+
+        for (size_t i = 0; i < 100; i++) {
+            size_t key_length = (size_t)sprintf(key, "missing%zu", i);
+            hash_table_get(table, key, key_length);
+        }
+        struct hash_table_stats stats;
+        CHECK(hash_table_stats(table, &stats) == 1);
+        CHECK(stats.elements_stored == 10000 && stats.resize_count > 0);
+        CHECK(stats.load_factor > 0.0 && stats.load_factor < 1.0);
+        CHECK(stats.key_bytes == key_bytes && stats.value_bytes == 10000 * sizeof(size_t));
+        CHECK(stats.metadata_bytes >= stats.slot_count * 8);
+        size_t histogram_total = 0;
+
+        for (size_t i = 0; i < HASH_TABLE_PROBE_HISTOGRAM_LENGTH; i++) {
+            histogram_total += stats.probe_length_histogram[i];
+        }
+        CHECK(histogram_total == 10000 && stats.max_probe_length >= 1);
+        CHECK(stats.mean_probe_length >= 1.0 && stats.mean_probe_length <= (double)stats.max_probe_length);
+
+        if (stats.op_counters_enabled) {
+            CHECK(stats.misses >= 10100 && stats.probes >= stats.misses);
+        } else {
+            CHECK(stats.hits == 0 && stats.misses == 0 && stats.probes == 0);
+        }
+        hash_table_free(table);
+    }
+}
+
+//Make sure a table keeping a Bloom filter still finds every key
+//it stores, across resizes, removes and clears, and that the
+//filter's false positive rate is low for the bits it is given.
+static void test_bloom_filter(void) {
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.bloom_filter_bits = 10;
+
+    for (unsigned int variant = 0; variant < 3; variant++) {
+        options.probing = variant == 1 ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        options.incremental_resize = variant == 2;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        char key[64];
+
+        for (size_t i = 0; i < 20000; i++) {
+            size_t key_length = (size_t)sprintf(key, "bloom%zu", i);
+            CHECK(hash_table_add(table, key, key_length, &i, sizeof(i)) == 1);
+        }
+        size_t found = 0;
+
+        for (size_t i = 0; i < 20000; i++) {
+            size_t key_length = (size_t)sprintf(key, "bloom%zu", i);
+            struct hash_table_key_value pair = hash_table_get(table, key, key_length);
+            found += pair.value != NULL && *(size_t*)pair.value == i;
+        }
+        CHECK(found == 20000);
+        size_t false_hits = 0;
+
+        for (size_t i = 0; i < 20000; i++) {
+            size_t key_length = (size_t)sprintf(key, "missing%zu", i);
+            false_hits += hash_table_get(table, key, key_length).value != NULL;
+        }
+        CHECK(false_hits == 0);
+        double rate = hash_table_bloom_false_positive_rate(table);
+        CHECK(rate > 0.0 && rate < 0.05);
+        //Removed keys stay in the filter, but are no longer found.
+        for (size_t i = 0; i < 20000; i += 2) {
+            size_t key_length = (size_t)sprintf(key, "bloom%zu", i);
+            CHECK(hash_table_remove(table, key, key_length) == 1);
+        }
+        found = 0;
+
+        for (size_t i = 0; i < 20000; i++) {
+            size_t key_length = (size_t)sprintf(key, "bloom%zu", i);
+            found += hash_table_get(table, key, key_length).value != NULL;
+        }
+        CHECK(found == 10000);
+        //Clearing empties the filter along with the table.
+        hash_table_clear(table);
+        CHECK(hash_table_bloom_false_positive_rate(table) == 0.0);
+        sprintf(key, "bloom%d", 1);
+        CHECK(hash_table_get(table, key, strlen(key)).value == NULL);
+        CHECK(hash_table_add(table, key, strlen(key), key, 1) == 1);
+        CHECK(hash_table_get(table, key, strlen(key)).value != NULL);
+        hash_table_free(table);
+    }
+    //Tables without a filter let every missing key through.
+    struct hash_table* table = hash_table_new();
+    CHECK(hash_table_bloom_false_positive_rate(table) == 1.0);
+    hash_table_free(table);
+}
+
+//Churn a table keeping a Bloom filter through remove then add
+//cycles, and make sure the bits of removed keys don't pile up
+//in the filter until it lets every missing key through.
+static void test_bloom_churn(void) {
+    const size_t live_keys = 10000;
+    const size_t cycles = 250000;
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.bloom_filter_bits = 10;
+
+    for (unsigned char robin_hood = 0; robin_hood < 2; robin_hood++) {
+        options.probing = robin_hood ? HASH_TABLE_PROBING_ROBIN_HOOD : HASH_TABLE_PROBING_GROUPS;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        char key[32];
+        double worst_rate = 0.0;
+
+        for (size_t i = 0; i < live_keys; i++) {
+            size_t key_length = (size_t)sprintf(key, "churn%zu", i);
+            hash_table_add(table, key, key_length, &i, sizeof(i));
+        }
+
+        for (size_t i = 0; i < cycles; i++) {
+            //Remove the oldest key, then add a new one.
+            size_t key_length = (size_t)sprintf(key, "churn%zu", i);
+            CHECK(hash_table_remove(table, key, key_length) == 1);
+            size_t new_index = i + live_keys;
+            key_length = (size_t)sprintf(key, "churn%zu", new_index);
+            hash_table_add(table, key, key_length, &new_index, sizeof(new_index));
+
+            if (i % 10000 == 0) {
+                double rate = hash_table_bloom_false_positive_rate(table);
+
+                if (rate > worst_rate) {
+                    worst_rate = rate;
+                }
+            }
+        }
+        printf("Bloom filter false positive rate at worst during %s churn: %.4f.\n",
+               robin_hood ? "Robin Hood" : "group", worst_rate);
+        CHECK(worst_rate < 0.05);
+        CHECK(hash_table_size(table) == live_keys);
+        //Rebuilding the filter must keep every live key in it.
+        for (size_t i = cycles; i < cycles + live_keys; i++) {
+            size_t key_length = (size_t)sprintf(key, "churn%zu", i);
+            struct hash_table_key_value found = hash_table_get(table, key, key_length);
+            CHECK(found.value != NULL && *(const size_t*)found.value == i);
+        }
+        hash_table_free(table);
+    }
+}
+
+//Write the records test_load_stream loads to a temporary file,
+//after a header line, and leave it positioned at the header.
+static FILE* write_load_stream_records(void) {
+    FILE* stream = tmpfile();
+
+    if (stream == NULL) {
+        return NULL;
+    }
+    fputs("header line\n", stream);
+    fputs("alpha\t1\nbeta\t22\r\n\ngamma\nalpha\tdup\n", stream);
+    //Enough records to span several blocks when read in blocks.
+    for (size_t i = 0; i < 200000; i++) {
+        fprintf(stream, "stream key %zu\t%zu\n", i, i * 3);
+    }
+    fputs("delta\t4", stream);
+    rewind(stream);
+    return stream;
+}
+
+//Make sure records loaded from a stream are split into keys
+//and values, copied or borrowed, and that duplicates keep
+//their first value unless asked to replace it.
+static void test_load_stream(void) {
+    for (unsigned int flags = 0; flags < 4; flags++) {
+        FILE* stream = write_load_stream_records();
+        CHECK(stream != NULL);
+
+        if (stream == NULL) {
+            return;
+        }
+        char header[64];
+        CHECK(fgets(header, sizeof(header), stream) != NULL);
+        struct hash_table_options options;
+        hash_table_options_init(&options);
+        options.borrow_keys_values = (flags & HASH_TABLE_LOAD_BORROW) != 0;
+        struct hash_table* table = hash_table_new_with_options(&options);
+        struct hash_table_key_value pair;
+        static char early_key[] = "early key";
+        size_t borrow = (flags & HASH_TABLE_LOAD_BORROW) != 0;
+        //Elements a borrowing table holds before a
+        //load are moved into the arena it is given.
+        if (borrow) {
+            CHECK(hash_table_add(table, early_key, 9, early_key, 5) == 1);
+        }
+        CHECK(hash_table_load_stream(table, stream, '\t', flags) == 1);
+        fclose(stream);
+        CHECK(hash_table_size(table) == 200004 + borrow);
+
+        if (borrow) {
+            pair = hash_table_get(table, "early key", 9);
+            CHECK(pair.value == early_key && pair.value_length == 5);
+            CHECK(hash_table_remove(table, "early key", 9) == 1);
+            CHECK(hash_table_remove(table, "beta", 4) == 1);
+            CHECK(hash_table_add(table, early_key, 9, early_key, 5) == 1);
+            CHECK(hash_table_size(table) == 200003 + borrow);
+        }
+        pair = hash_table_get(table, "alpha", 5);
+        const char* alpha = flags & HASH_TABLE_LOAD_REPLACE ? "dup" : "1";
+        CHECK(pair.value_length == strlen(alpha) && memcmp(pair.value, alpha, strlen(alpha)) == 0);
+        pair = hash_table_get(table, "beta", 4);
+        CHECK(borrow ? pair.value == NULL : pair.value_length == 2 && memcmp(pair.value, "22", 2) == 0);
+        pair = hash_table_get(table, "gamma", 5);
+        CHECK(pair.value != NULL && pair.value_length == 0);
+        pair = hash_table_get(table, "delta", 5);
+        CHECK(pair.value_length == 1 && memcmp(pair.value, "4", 1) == 0);
+        CHECK(hash_table_get(table, "header line", 11).value == NULL);
+        size_t found = 0;
+
+        for (size_t i = 0; i < 200000; i += 999) {
+            char key[64];
+            char value[64];
+            size_t key_length = (size_t)sprintf(key, "stream key %zu", i);
+            size_t value_length = (size_t)sprintf(value, "%zu", i * 3);
+            pair = hash_table_get(table, key, key_length);
+            found += pair.value_length == value_length && memcmp(pair.value, value, value_length) == 0;
+        }
+        CHECK(found == 201);
+        hash_table_free(table);
+    }
+    //Borrowing needs a table that borrows.
+    FILE* stream = write_load_stream_records();
+    struct hash_table* table = hash_table_new();
+    CHECK(hash_table_load_stream(table, stream, '\t', HASH_TABLE_LOAD_BORROW) == 0);
+    CHECK(hash_table_size(table) == 0);
+    hash_table_free(table);
+    fclose(stream);
+}
+
+//Number of parts the partitioned iterator test splits a table into.
+#define ITERATOR_PARTITIONS 3
+
+//Sum the values seen by the iterator passed in arg,
+//storing the sum and the number of pairs in totals.
+struct iterator_totals {
+    struct hash_table_key_value_iterator* iterator;
+    size_t pairs;
+    size_t sum;
+};
+
+static void* sum_partition(void* arg) {
+    struct iterator_totals* totals = arg;
+    struct hash_table_key_value pair;
+
+    while (hash_table_iterator_next(totals->iterator, &pair)) {
+        totals->pairs++;
+        totals->sum += *(const size_t*)pair.value;
+    }
+    return NULL;
+}
+
+//Walk a table that went through removes and an incremental
+//resize, whole and in parallel partitions, and make sure every
+//pair is seen exactly once.
+static void test_iterator(void) {
+    const size_t key_count = 3000;
+    struct hash_table_options options;
+    hash_table_options_init(&options);
+    options.incremental_resize = 1;
+    struct hash_table* table = hash_table_new_with_options(&options);
+    size_t expected_sum = 0;
+    char key[32];
+
+    for (size_t i = 0; i < key_count; i++) {
+        size_t key_length = (size_t)sprintf(key, "iterate%zu", i);
+        hash_table_add(table, key, key_length, &i, sizeof(i));
+    }
+    //Remove every third key.
+    for (size_t i = 0; i < key_count; i++) {
+        if (i % 3 == 0) {
+            size_t key_length = (size_t)sprintf(key, "iterate%zu", i);
+            hash_table_remove(table, key, key_length);
+        } else {
+            expected_sum += i;
+        }
+    }
+    struct hash_table_key_value_iterator* iterator = hash_table_get_iterator(table);
+    struct hash_table_key_value pair;
+    size_t pairs = 0;
+    size_t sum = 0;
+
+    while (hash_table_iterator_next(iterator, &pair)) {
+        struct hash_table_key_value found = hash_table_get(table, (void*)pair.key, pair.key_length);
+        CHECK(found.value == pair.value);
+        pairs++;
+        sum += *(const size_t*)pair.value;
+    }
+    hash_table_iterator_free(iterator);
+    CHECK(pairs == hash_table_size(table));
+    CHECK(sum == expected_sum);
+
+    pthread_t threads[ITERATOR_PARTITIONS];
+    struct iterator_totals totals[ITERATOR_PARTITIONS];
+
+    for (size_t i = 0; i < ITERATOR_PARTITIONS; i++) {
+        totals[i].iterator = hash_table_get_partition_iterator(table, i, ITERATOR_PARTITIONS);
+        totals[i].pairs = 0;
+        totals[i].sum = 0;
+    }
+
+    for (size_t i = 0; i < ITERATOR_PARTITIONS; i++) {
+        pthread_create(&threads[i], NULL, sum_partition, &totals[i]);
+    }
+    pairs = 0;
+    sum = 0;
+
+    for (size_t i = 0; i < ITERATOR_PARTITIONS; i++) {
+        pthread_join(threads[i], NULL);
+        hash_table_iterator_free(totals[i].iterator);
+        pairs += totals[i].pairs;
+        sum += totals[i].sum;
+    }
+    CHECK(pairs == hash_table_size(table));
+    CHECK(sum == expected_sum);
+    CHECK(hash_table_get_partition_iterator(table, 3, 3) == NULL);
+    hash_table_free(table);
+}
+
+//Number of threads each side of the concurrent test runs.
+#define CONCURRENT_THREADS 4
+//Number of keys each concurrent writer owns.
+#define CONCURRENT_KEYS 20000
+
+static struct hash_table_concurrent* concurrent_table;
+
+//Keep rewriting and removing the keys owned by the writer
+//passed in arg. A key's value always equals its number.
+static void* concurrent_writer(void* arg) {
+    size_t writer = *(size_t*)arg;
+    char key[32];
+
+    for (size_t round = 0; round < 4; round++) {
+        for (size_t i = writer; i < CONCURRENT_THREADS * CONCURRENT_KEYS; i += CONCURRENT_THREADS) {
+            size_t key_length = (size_t)sprintf(key, "concurrent%zu", i);
+
+            if (round == 2 && i % 2 == 0) {
+                hash_table_concurrent_remove(concurrent_table, key, key_length);
+            } else {
+                hash_table_concurrent_add(concurrent_table, key, key_length, &i, sizeof(i));
+            }
+        }
+    }
+    return NULL;
+}
+
+//Read keys while the writers run, counting any found
+//key whose value doesn't match it.
+static void* concurrent_reader(void* arg) {
+    size_t* mismatches = arg;
+    struct hash_table_concurrent_reader* reader = hash_table_concurrent_reader_register(concurrent_table);
+    char key[32];
+
+    for (size_t round = 0; round < 4; round++) {
+        for (size_t i = 0; i < CONCURRENT_THREADS * CONCURRENT_KEYS; i++) {
+            size_t key_length = (size_t)sprintf(key, "concurrent%zu", i);
+            hash_table_concurrent_read_begin(reader);
+            struct hash_table_key_value found = hash_table_concurrent_get(reader, key, key_length);
+
+            if (found.value != NULL && *(const size_t*)found.value != i) {
+                (*mismatches)++;
+            }
+            hash_table_concurrent_read_end(reader);
+        }
+    }
+    hash_table_concurrent_reader_unregister(reader);
+    return NULL;
+}
+
+//Combine function of test_sharded, adding
+//the source counter to the destination one.
+static unsigned char add_counters(void* destination_value, size_t destination_value_length,
+                                  const void* source_value, size_t source_value_length) {
+    if (destination_value_length != sizeof(size_t) || source_value_length != sizeof(size_t)) {
+        return 0;
+    }
+    *(size_t*)destination_value += *(const size_t*)source_value;
+    return 1;
+}
+
+//Build a sharded table on several threads, make sure it holds
+//what adding the pairs one at a time would, then merge
+//tables both shard by shard and whole.
+static void test_sharded(void) {
+    enum { SHARDED_KEYS = 40000 };
+    char (*keys)[32] = malloc(sizeof(*keys) * SHARDED_KEYS);
+    void** key_pointers = malloc(sizeof(void*) * SHARDED_KEYS);
+    size_t* key_lengths = malloc(sizeof(size_t) * SHARDED_KEYS);
+    size_t* counters = malloc(sizeof(size_t) * SHARDED_KEYS);
+    void** value_pointers = malloc(sizeof(void*) * SHARDED_KEYS);
+    size_t* value_lengths = malloc(sizeof(size_t) * SHARDED_KEYS);
+
+    for (size_t i = 0; i < SHARDED_KEYS; i++) {
+        key_lengths[i] = (size_t)sprintf(keys[i], "sharded%zu", i);
+        key_pointers[i] = keys[i];
+        counters[i] = i;
+        value_pointers[i] = &counters[i];
+        value_lengths[i] = sizeof(size_t);
+    }
+    struct hash_table_sharded* built = hash_table_sharded_new(10, NULL);
+    CHECK(hash_table_sharded_shard_count(built) == 16);
+    CHECK(hash_table_sharded_build(built, key_pointers, key_lengths, value_pointers, value_lengths,
+                                   SHARDED_KEYS, 4) == 1);
+    CHECK(hash_table_sharded_size(built) == SHARDED_KEYS);
+    struct hash_table_sharded* added = hash_table_sharded_new(16, NULL);
+
+    for (size_t i = 0; i < SHARDED_KEYS; i++) {
+        CHECK(hash_table_sharded_add(added, keys[i], key_lengths[i], &counters[i], sizeof(size_t)) == 1);
+    }
+    //Both tables must have put every key in the same shard.
+    for (size_t i = 0; i < 16; i++) {
+        CHECK(hash_table_size(hash_table_sharded_shard(built, i)) ==
+              hash_table_size(hash_table_sharded_shard(added, i)));
+    }
+
+    for (size_t i = 0; i < SHARDED_KEYS + 100; i++) {
+        char key[32];
+        size_t key_length = (size_t)sprintf(key, "sharded%zu", i);
+        struct hash_table_key_value found = hash_table_sharded_get(built, key, key_length);
+
+        if (i < SHARDED_KEYS) {
+            CHECK(found.value != NULL && *(const size_t*)found.value == i);
+        } else {
+            CHECK(found.value == NULL);
+        }
+    }
+    //Keys already stored can't be built in again.
+    CHECK(hash_table_sharded_build(built, key_pointers, key_lengths, value_pointers, value_lengths, 10, 2) == 0);
+    CHECK(hash_table_sharded_size(built) == SHARDED_KEYS);
+    CHECK(hash_table_sharded_remove(built, keys[0], key_lengths[0]) == 1);
+    CHECK(hash_table_sharded_get(built, keys[0], key_lengths[0]).value == NULL);
+    //Merging sums the counters of keys in both tables,
+    //and copies over those missing from built.
+    CHECK(hash_table_sharded_merge(built, added, add_counters, 3) == 1);
+    CHECK(hash_table_sharded_size(built) == SHARDED_KEYS);
+    CHECK(*(const size_t*)hash_table_sharded_get(built, keys[0], key_lengths[0]).value == 0);
+    CHECK(*(const size_t*)hash_table_sharded_get(built, keys[7], key_lengths[7]).value == 14);
+    //Tables splitting keys differently can't be merged.
+    struct hash_table_sharded* other = hash_table_sharded_new(8, NULL);
+    CHECK(hash_table_sharded_merge(built, other, NULL, 1) == 0);
+    hash_table_sharded_free(other);
+    hash_table_sharded_free(added);
+    hash_table_sharded_free(built);
+    //Merging plain tables, with and without a combine function.
+    struct hash_table* destination = hash_table_new();
+    struct hash_table* source = hash_table_new();
+
+    for (size_t i = 0; i < 1000; i++) {
+        hash_table_add(destination, keys[i], key_lengths[i], &counters[i], sizeof(size_t));
+        hash_table_add(source, keys[i + 500], key_lengths[i + 500], &counters[i + 500], sizeof(size_t));
+    }
+    CHECK(hash_table_merge(destination, source, add_counters) == 1);
+    CHECK(hash_table_size(destination) == 1500);
+    CHECK(*(const size_t*)hash_table_get(destination, keys[600], key_lengths[600]).value == 1200);
+    CHECK(*(const size_t*)hash_table_get(destination, keys[1200], key_lengths[1200]).value == 1200);
+    CHECK(hash_table_merge(destination, source, NULL) == 1);
+    CHECK(*(const size_t*)hash_table_get(destination, keys[600], key_lengths[600]).value == 600);
+    hash_table_free(source);
+    hash_table_free(destination);
+    free(keys);
+    free(key_pointers);
+    free(key_lengths);
+    free(counters);
+    free(value_pointers);
+    free(value_lengths);
+}
+
+//Run writers and lock-free readers on a concurrent table at
+//once, then make sure every key ended up stored.
+static void test_concurrent(void) {
+    pthread_t writers[CONCURRENT_THREADS];
+    pthread_t readers[CONCURRENT_THREADS];
+    size_t writer_ids[CONCURRENT_THREADS];
+    size_t mismatches[CONCURRENT_THREADS] = {0};
+    concurrent_table = hash_table_concurrent_new(0);
+    CHECK(concurrent_table != NULL);
+
+    for (size_t i = 0; i < CONCURRENT_THREADS; i++) {
+        writer_ids[i] = i;
+        pthread_create(&writers[i], NULL, concurrent_writer, &writer_ids[i]);
+        pthread_create(&readers[i], NULL, concurrent_reader, &mismatches[i]);
+    }
+
+    for (size_t i = 0; i < CONCURRENT_THREADS; i++) {
+        pthread_join(writers[i], NULL);
+        pthread_join(readers[i], NULL);
+        CHECK(mismatches[i] == 0);
+    }
+    CHECK(hash_table_concurrent_size(concurrent_table) == CONCURRENT_THREADS * CONCURRENT_KEYS);
+    struct hash_table_concurrent_reader* reader = hash_table_concurrent_reader_register(concurrent_table);
+    char key[32];
+    hash_table_concurrent_read_begin(reader);
+
+    for (size_t i = 0; i < CONCURRENT_THREADS * CONCURRENT_KEYS; i++) {
+        size_t key_length = (size_t)sprintf(key, "concurrent%zu", i);
+        struct hash_table_key_value found = hash_table_concurrent_get(reader, key, key_length);
+        CHECK(found.value != NULL && *(const size_t*)found.value == i);
+    }
+    hash_table_concurrent_read_end(reader);
+    hash_table_concurrent_free(concurrent_table);
+}
 
 int main(void) {
 
@@ -37,20 +1259,47 @@ int main(void) {
 
     struct hash_table_key_value test_value = hash_table_get(new_table, key_one, strlen(key_one) + 1);
     printf("Value of key %s: %s\n", key_one, (char*)test_value.value);
+    CHECK(test_value.value != NULL && strcmp(test_value.value, value_one) == 0);
 
     //print out the size of the table (number of elements stored)
     printf("Size of the table: %I64d\n", hash_table_size(new_table));
+    CHECK(hash_table_size(new_table) == 8);
 
     unsigned char remove_success = hash_table_remove(new_table, key_one, strlen(key_one) + 1);
     printf("Remove successful? %d.\n", remove_success);
+    CHECK(remove_success == 1);
     
     test_value = hash_table_get(new_table, key_one, strlen(key_one) + 1);
     printf("Value of key %s: %s\n", key_one, (char*)test_value.value);
+    CHECK(test_value.value == NULL);
 
     //print out the size of the table (number of elements stored)
     printf("Size of the table: %I64d\n", hash_table_size(new_table));
+    CHECK(hash_table_size(new_table) == 7);
 
     hash_table_free(new_table);
-    printf("Done.\n");
-    return 0;
+
+    test_churn_probe_length();
+    test_arena();
+    test_hash_functions();
+    test_capacity();
+    test_batch();
+    test_batch_incremental();
+    test_iterator();
+    test_inline_keys();
+    test_typed();
+    test_key_compare();
+    test_borrowed();
+    test_upsert();
+    test_snapshot();
+    test_perfect_hash();
+    test_stats();
+    test_bloom_filter();
+    test_bloom_churn();
+    test_load_stream();
+    test_sharded();
+    test_concurrent();
+
+    printf("Done. %d check(s) failed.\n", failures);
+    return failures == 0 ? 0 : 1;
 }